@@ -2,8 +2,13 @@
 #define __CONFIG_H__
 
 #include "global.hpp"
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <cstring>
 #include <sstream>
 #include <vector>
 #include "PPMImage.hpp"
@@ -13,6 +18,15 @@
 #include "material.hpp"
 #include "project_path.hpp"
 #include "texture.hpp"
+#include "IrradianceCache.hpp"
+#include "LightBVH.hpp"
+#include "Accelerator.hpp"
+#include "mesh.hpp"
+#include "BVH.hpp"
+#include "MappedFile.hpp"
+#include "RenderThreadPool.hpp"
+#include "TextureCache.hpp"
+#include "Trace.hpp"
 
 #define MUTILTHREAD
 #define INIT_WORLD_WITH_CONFIG
@@ -23,62 +37,111 @@ using std::string;
 
 class ConfigManager {
     string config_path;
+    const char* cursor = nullptr;
+    const char* end = nullptr;
+    int line_num = 0;
 
     shared_ptr<Camera> camera;
     std::vector<shared_ptr<Material>> materials;
     std::vector<shared_ptr<Hittable>> objs;
     std::vector<shared_ptr<Texture>> textures;
+    shared_ptr<IrradianceCache> irradiance_cache;
+    shared_ptr<PPMImage> env_image;
+    shared_ptr<TextureCache> texture_cache;
+    size_t texture_cache_size = 0;
+    std::map<string, shared_ptr<Hittable>> prototypes;
+    string prototype_name;
+    size_t prototype_start = 0;
 
-    bool use_bvh = false;
+    AcceleratorType accelerator_type = AcceleratorType::List;
     bool is_sample_world = false;
+    bool light_bench = false;
+    bool accel_bench = false;
+    bool noise_bench = false;
+    int many_lights_num = 0;
+    LightSampling light_sampling = LightSampling::None;
+    bool scene_cache = false;
+    std::vector<string> referenced_files;
+    friend class SceneCache;
 
-    double GetDouble(string& line, int& index) const {
-        if (index >= line.length()) {
-            std::cerr << "GetDouble error!\n";
-            return 0;
+    struct PendingImage {
+        shared_ptr<PPMImage> image;
+        string file_name;
+        shared_ptr<ImageTexture> texture;
+    };
+    std::vector<PendingImage> pending_images;
+    std::vector<shared_ptr<PerlinNoise>> pending_noises;
+    std::vector<shared_ptr<NoiseVolume>> pending_volumes;
+    shared_ptr<RenderThreadPool> load_pool;
+    std::vector<DWORD> images_end, noises_end;
+    DWORD load_start = 0;
+
+    void ReportError(const char* message) const {
+        std::cerr << config_path << ":" << line_num << ": " << message << "\n";
+    }
+    bool GetLine(std::string_view& line) {
+        if (cursor >= end) {
+            line = std::string_view();
+            return false;
         }
+        const char* line_end = (const char*)memchr(cursor, '\n', end - cursor);
+        if (line_end == nullptr) line_end = end;
+        line = std::string_view(cursor, line_end - cursor);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        cursor = line_end == end ? end : line_end + 1;
+        ++line_num;
+        return true;
+    }
+    void GetValueLine(std::string_view& line) {
+        if (!GetLine(line)) ReportError("unexpected end of file!");
+    }
+
+    double GetDouble(std::string_view line, size_t& index) const {
+        while (index < line.length() && (line[index] == ' ' || line[index] == '\t')) ++index;
         double ans = 0.;
-        int is_negative = 1;
-        int is_frac = 0;
-        if (line[index] == '-') is_negative = -1, ++index;
-        while (index < line.length()) {
-            if (line[index] >= '0' && line[index] <= '9') {
-                if (is_frac) {
-                    ans = ans + std::pow(10, -is_frac) * (line[index] - '0');
-                    ++is_frac;
-                }
-                else ans = ans * 10 + line[index] - '0';
-            }
-            else if (line[index] == '.') is_frac = 1;
-            else if (line[index] == '-' && is_negative == 1) is_negative = -1;
-            else if (line[index] == ' ') break;
-            else std::cerr << "GetDouble error!\n";
-            ++index;
+        auto result = std::from_chars(line.data() + index, line.data() + line.length(), ans);
+        if (result.ec != std::errc()) {
+            ReportError("GetDouble error!");
+            index = line.length();
+            return 0.;
         }
-        ++index;
-        return ans * is_negative;
+        index = result.ptr - line.data();
+        return ans;
     }
-    double GetDouble(string& line) const {
-        int index = 0;
+    double GetDouble(std::string_view line) const {
+        size_t index = 0;
         return GetDouble(line, index);
     }
 
-    vec3d GetVec3d(string& line) const {
-        int index = 0;
+    vec3d GetVec3d(std::string_view line) const {
+        size_t index = 0;
         double x = GetDouble(line, index);
         double y = GetDouble(line, index);
         double z = GetDouble(line, index);
         return vec3d(x, y, z);
     }
-    Color GetColor(string& line) const {
+    Color GetColor(std::string_view line) const {
         auto temp = GetVec3d(line);
         return Color(temp.x, temp.y, temp.z);
     }
-    point3d GetPoint3d(string& line) const {
+    point3d GetPoint3d(std::string_view line) const {
         return GetVec3d(line);
     }
+    void TransformLastObject(const Transform& t) {
+        if (objs.empty()) {
+            ReportError("Transform error!");
+            return;
+        }
+        auto instance = std::dynamic_pointer_cast<Instance>(objs.back());
+        if (instance) objs.back() = make_shared<Instance>(instance->GetPrototype(), t * instance->GetTransform());
+        else objs.back() = make_shared<Instance>(objs.back(), t);
+    }
 public:
     Color bgcolor = Color(0.7, 0.8, 1.);
+    double env_scale = 1.;
+    int frames_num = 1;
+    double frame_time = 1.;
+    string output_file = "image.ppm";
     double window_ar = default_aspect_ratio;
     double window_w = default_width;
     double window_h = default_height;
@@ -88,172 +151,362 @@ public:
         ss << source_path << fileName;
         config_path = ss.str();
     }
-    ~ConfigManager() = default;
+    ~ConfigManager() { WaitForLoading(); }
 
     void GetConfig() {
-        std::ifstream f;
-        f.open(config_path);
-        if(!f.is_open()) {
+        MappedFile f;
+        if (!f.Open(config_path)) {
             std::cerr << config_path << " cannot be open.\n";
-            f.close();
             return;
         }
+        cursor = f.GetData();
+        end = cursor + f.GetSize();
+        line_num = 0;
+        if (end - cursor >= 3 && memcmp(cursor, "\xef\xbb\xbf", 3) == 0) cursor += 3;
         std::cout << "start read configuration.\n";
+        DWORD start_time = GetTickCount();
 
-        string line;
+        std::string_view line;
         int type = 0;
-        while (std::getline(f, line)) {
+        while (GetLine(line)) {
             if (line.length() > 0) {
                 if (line[0] == '#') continue;
                 
-                if (line.compare("BVH") == 0) use_bvh = true;
+                if (line.compare("BVH") == 0) accelerator_type = AcceleratorType::BVH;
+                else if (line.compare("Accelerator") == 0) {
+                    GetValueLine(line);
+                    if (line.compare("list") == 0) accelerator_type = AcceleratorType::List;
+                    else if (line.compare("bvh") == 0) accelerator_type = AcceleratorType::BVH;
+                    else if (line.compare("grid") == 0) accelerator_type = AcceleratorType::Grid;
+                    else if (line.compare("lazybvh") == 0) accelerator_type = AcceleratorType::LazyBVH;
+                    else ReportError("Accelerator error!");
+                }
+                else if (line.compare("AccelBench") == 0) accel_bench = true;
+                else if (line.compare("SceneCache") == 0) scene_cache = true;
                 else if (line.compare("SAMPLE_WORLD") == 0) is_sample_world = true;
+                else if (line.compare("LightBench") == 0) light_bench = true;
+                else if (line.compare("NoiseBench") == 0) noise_bench = true;
+                else if (line.compare("Frames") == 0) {
+                    GetValueLine(line);
+                    frames_num = std::max(1, (int) GetDouble(line));
+                    GetValueLine(line);
+                    frame_time = GetDouble(line);
+                }
+                else if (line.compare("Output") == 0) {
+                    GetValueLine(line);
+                    output_file = string(line);
+                }
+                else if (line.compare("ManyLightWorld") == 0) {
+                    GetValueLine(line);
+                    many_lights_num = GetDouble(line);
+                }
+                else if (line.compare("LightSampling") == 0) {
+                    GetValueLine(line);
+                    if (line.compare("bvh") == 0) light_sampling = LightSampling::BVH;
+                    else if (line.compare("uniform") == 0) light_sampling = LightSampling::Uniform;
+                    else ReportError("LightSampling error!");
+                }
                 else if (line.compare("Camera") == 0 && is_sample_world) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     point3d o = GetPoint3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     vec3d up_dir = GetVec3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     point3d look_at = GetPoint3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double vfov = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double lr = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double dist = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double t1 = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double t2 = GetDouble(line);
                     camera = make_shared<Camera>(o, up_dir, look_at, vfov, lr, dist, t1, t2, window_ar);
                 }
                 else if (line.compare("XCamera") == 0 && !is_sample_world) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     point3d o = GetPoint3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     vec3d up_dir = GetVec3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     point3d look_at = GetPoint3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double vfov = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double lr = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double dist = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double t1 = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double t2 = GetDouble(line);
                     camera = make_shared<Camera>(o, up_dir, look_at, vfov, lr, dist, t1, t2, window_ar);
                 }
                 else if (line.compare("aspect_ratio") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     window_ar = GetDouble(line);
                 }
                 else if (line.compare("Height") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     window_h = GetDouble(line);
                 }
                 else if (line.compare("Width") == 0) {
-                    std::getline(f, line);
-                    window_w = line[0] == '-' ? window_h * window_ar : GetDouble(line);
+                    GetValueLine(line);
+                    if (line.empty()) ReportError("Width error!");
+                    else window_w = line[0] == '-' ? window_h * window_ar : GetDouble(line);
+                }
+                else if (line.compare("IrradianceCache") == 0) {
+                    GetValueLine(line);
+                    int samples = GetDouble(line);
+                    GetValueLine(line);
+                    double a = GetDouble(line);
+                    GetValueLine(line);
+                    size_t index = 0;
+                    double min_r = GetDouble(line, index);
+                    double max_r = GetDouble(line, index);
+                    irradiance_cache = make_shared<IrradianceCache>(samples, a, min_r, max_r);
+                }
+                else if (line.compare("TextureCache") == 0) {
+                    GetValueLine(line);
+                    texture_cache_size = (size_t)(GetDouble(line) * 1024 * 1024);
                 }
                 else if (line.compare("BgColor") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     bgcolor = GetColor(line);
                 }
+                else if (line.compare("EnvMap") == 0) {
+                    GetValueLine(line);
+                    env_image = make_shared<PPMImage>();
+                    pending_images.push_back({ env_image, string(line), nullptr });
+                    referenced_files.emplace_back(line);
+                    GetValueLine(line);
+                    env_scale = GetDouble(line);
+                }
                 else if (line.compare("Solid") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     Color color = GetColor(line);
                     textures.emplace_back(make_shared<SolidTexture>(color));
                 }
                 else if (line.compare("Checker") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     Color color0 = GetColor(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     Color color1 = GetColor(line);
                     textures.emplace_back(make_shared<CheckerTexture>(color0, color1));
                 }
+                else if (line.compare("CheckerTexture") == 0) {
+                    GetValueLine(line);
+                    int index0 = GetDouble(line) - 1;
+                    GetValueLine(line);
+                    int index1 = GetDouble(line) - 1;
+                    if (index0 < 0 || index0 >= textures.size() || index1 < 0 || index1 >= textures.size()) ReportError("CheckerTexture error!");
+                    else textures.emplace_back(make_shared<CheckerTexture>(textures[index0], textures[index1]));
+                }
                 else if (line.compare("Noise") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
+                    double scale = GetDouble(line);
+                    GetValueLine(line);
+                    Color color = GetColor(line);
+                    auto noise = make_shared<PerlinNoise>(false);
+                    pending_noises.push_back(noise);
+                    textures.emplace_back(make_shared<NoiseTexture>(noise, color, scale));
+                }
+                else if (line.compare("SharedNoise") == 0) {
+                    GetValueLine(line);
+                    int index = GetDouble(line) - 1;
+                    GetValueLine(line);
                     double scale = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     Color color = GetColor(line);
-                    textures.emplace_back(make_shared<NoiseTexture>(make_shared<PerlinNoise>(), color, scale));
+                    auto texture = index < 0 || index >= textures.size() ? nullptr : std::dynamic_pointer_cast<NoiseTexture>(textures[index]);
+                    if (texture == nullptr) ReportError("SharedNoise error!");
+                    else textures.emplace_back(make_shared<NoiseTexture>(texture->GetNoise(), color, scale));
+                }
+                else if (line.compare("NoiseVolume") == 0) {
+                    GetValueLine(line);
+                    point3d p1 = GetPoint3d(line);
+                    GetValueLine(line);
+                    point3d p2 = GetPoint3d(line);
+                    GetValueLine(line);
+                    double cell_size = GetDouble(line);
+                    auto texture = textures.empty() ? nullptr : std::dynamic_pointer_cast<NoiseTexture>(textures.back());
+                    auto noise = texture == nullptr ? nullptr : std::dynamic_pointer_cast<PerlinNoise>(texture->GetNoise());
+                    if (noise == nullptr || !(cell_size > 0.)) ReportError("NoiseVolume error!");
+                    else {
+                        auto volume = make_shared<NoiseVolume>(noise, p1, p2, cell_size);
+                        if (volume->GetSamplesNum() > ((size_t)1 << 28)) ReportError("NoiseVolume is too large!");
+                        else {
+                            texture->SetNoise(volume);
+                            pending_volumes.push_back(volume);
+                        }
+                    }
                 }
                 else if (line.compare("Image") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     auto image = make_shared<PPMImage>();
-                    image->read_from_file(line);
-                    textures.emplace_back(make_shared<ImageTexture>(image));
+                    auto texture = make_shared<ImageTexture>(image);
+                    pending_images.push_back({ image, string(line), texture });
+                    referenced_files.emplace_back(line);
+                    textures.emplace_back(texture);
                 }
                 else if (line.compare("Lambertian") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     int index = GetDouble(line) - 1;
                     if (index >= 0 && index < textures.size())
                         materials.push_back(make_shared<Lambertian>(textures[index]));
                 }
                 else if (line.compare("Dielectrics") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double n = GetDouble(line);
                     materials.push_back(make_shared<Dielectrics>(n));
                 }
                 else if (line.compare("Metal") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     int index = GetDouble(line) - 1;
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double fuzz = GetDouble(line);
                     if (index >= 0 && index < textures.size())
                         materials.push_back(make_shared<Metal>(textures[index], fuzz));
                 }
                 else if (line.compare("DiffuseLight") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     int index = GetDouble(line) - 1;
                     if (index >= 0 && index < textures.size())
                         materials.push_back(make_shared<DiffuseLight>(textures[index]));
                 }
                 else if (line.compare("Sphere") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     point3d o = GetPoint3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double r = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     int material_index = (int) GetDouble(line) -1;
-                    if (material_index < 0 || material_index >= materials.size()) std::cerr << "Sphere material error!\n";
+                    if (material_index < 0 || material_index >= materials.size()) ReportError("Sphere material error!");
                     else {
                         auto material = materials[material_index];
                         objs.push_back(make_shared<Sphere>(o, r, material));
                     }
                 }
+                else if (line.compare("Plane") == 0) {
+                    GetValueLine(line);
+                    point3d o = GetPoint3d(line);
+                    GetValueLine(line);
+                    vec3d n = GetVec3d(line);
+                    GetValueLine(line);
+                    int material_index = (int) GetDouble(line) -1;
+                    if (material_index < 0 || material_index >= materials.size()) ReportError("Plane material error!");
+                    else {
+                        auto material = materials[material_index];
+                        objs.push_back(make_shared<Plane>(o, n, material));
+                    }
+                }
+                else if (line.compare("Box") == 0) {
+                    GetValueLine(line);
+                    point3d p1 = GetPoint3d(line);
+                    GetValueLine(line);
+                    point3d p2 = GetPoint3d(line);
+                    GetValueLine(line);
+                    int material_index = (int) GetDouble(line) -1;
+                    if (material_index < 0 || material_index >= materials.size()) ReportError("Box material error!");
+                    else {
+                        auto material = materials[material_index];
+                        objs.push_back(make_shared<Box>(p1, p2, material));
+                    }
+                }
+                else if (line.compare("Mesh") == 0) {
+                    GetValueLine(line);
+                    string mesh_file(line);
+                    referenced_files.push_back(mesh_file);
+                    GetValueLine(line);
+                    int material_index = (int) GetDouble(line) -1;
+                    if (material_index < 0 || material_index >= materials.size()) ReportError("Mesh material error!");
+                    else {
+                        auto mesh_data = LoadMesh(mesh_file, thread_num);
+                        if (mesh_data) objs.push_back(make_shared<Mesh>(mesh_data, materials[material_index]));
+                    }
+                }
+                else if (line.compare("RotateY") == 0) {
+                    GetValueLine(line);
+                    TransformLastObject(Transform::RotateY(GetDouble(line)));
+                }
+                else if (line.compare("Translate") == 0) {
+                    GetValueLine(line);
+                    TransformLastObject(Transform::Translate(GetVec3d(line)));
+                }
+                else if (line.compare("Scale") == 0) {
+                    GetValueLine(line);
+                    TransformLastObject(Transform::Scale(GetVec3d(line)));
+                }
+                else if (line.compare("Prototype") == 0) {
+                    GetValueLine(line);
+                    prototype_name = line;
+                    prototype_start = objs.size();
+                }
+                else if (line.compare("PrototypeEnd") == 0) {
+                    if (prototype_name.empty() || objs.size() == prototype_start) ReportError("Prototype error!");
+                    else {
+                        std::vector<shared_ptr<Hittable>> members(objs.begin() + prototype_start, objs.end());
+                        objs.resize(prototype_start);
+                        if (members.size() == 1) prototypes[prototype_name] = members[0];
+                        else prototypes[prototype_name] = make_shared<BVH_Node>(members, 0, members.size(), 0, 1);
+                    }
+                    prototype_name.clear();
+                }
+                else if (line.compare("Instance") == 0) {
+                    GetValueLine(line);
+                    auto it = prototypes.find(string(line));
+                    if (it == prototypes.end()) ReportError("Instance prototype error!");
+                    else objs.push_back(make_shared<Instance>(it->second, Transform()));
+                }
+                else if (line.compare("InstanceArray") == 0) {
+                    GetValueLine(line);
+                    auto it = prototypes.find(string(line));
+                    GetValueLine(line);
+                    int count = (int) GetDouble(line);
+                    GetValueLine(line);
+                    point3d region_min = GetPoint3d(line);
+                    GetValueLine(line);
+                    point3d region_max = GetPoint3d(line);
+                    if (it == prototypes.end()) ReportError("InstanceArray prototype error!");
+                    else {
+                        for (int i = 0; i < count; i++) {
+                            point3d p = region_min + get_random_vec3d() * (region_max - region_min);
+                            objs.push_back(make_shared<Instance>(it->second, Transform::Translate(p) * Transform::RotateY(get_random(0., 360.))));
+                        }
+                    }
+                }
                 else if (line.compare("MovingSphere") == 0) {
-                    std::getline(f, line);
+                    GetValueLine(line);
                     point3d o1 = GetPoint3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     point3d o2 = GetPoint3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double r = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double t1 = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     double t2 = GetDouble(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     int material_index = (int) GetDouble(line) -1;
-                    if (material_index < 0 || material_index >= materials.size()) std::cerr << "Sphere material error!\n";
+                    if (material_index < 0 || material_index >= materials.size()) ReportError("Sphere material error!");
                     else {
                         auto material = materials[material_index];
                         objs.push_back(make_shared<MovingSphere>(t1, o1, t2, o2, r, material));
                     }
                 }
                 else if (line.compare("Rect") == 0) {
-                    std::getline(f, line);
-                    char axis = line[0];
-                    std::getline(f, line);
+                    GetValueLine(line);
+                    if (line.empty()) ReportError("Rect axis error!");
+                    char axis = line.empty() ? '\0' : line[0];
+                    GetValueLine(line);
                     point3d p1 = GetPoint3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     point3d p2 = GetPoint3d(line);
-                    std::getline(f, line);
+                    GetValueLine(line);
                     int material_index = (int) GetDouble(line) -1;
-                    if (material_index < 0 || material_index >= materials.size()) std::cerr << "Rect material error!\n";
+                    if (material_index < 0 || material_index >= materials.size()) ReportError("Rect material error!");
                     else {
                         auto material = materials[material_index];
                         if (axis == 'x') objs.push_back(make_shared<Rect<0>>(p1, p2, material));
@@ -262,22 +515,114 @@ public:
                         // if (axis == 'x') objs.push_back(make_shared<YZRect>(p1, p2, material));
                         // else if (axis == 'y') objs.push_back(make_shared<XZRect>(p1, p2, material));
                         // else if (axis == 'z') objs.push_back(make_shared<XYRect>(p1, p2, material));
-                        else std::cerr << "Rect error!\n";
+                        else ReportError("Rect error!");
                     }
                 }
             }
         }
 
-        f.close();
-        std::cout << "read configuration end.\n";
+        f.Close();
+        cursor = end = nullptr;
+        std::cout << "read configuration end: " << objs.size() << " objects in " << (GetTickCount() - start_time) * 1.0 / 1000 << "s\n";
+        StartLoading();
+    }
+
+    void StartLoading() {
+        int tasks_num = (int)(pending_images.size() + pending_noises.size());
+        if (tasks_num == 0) return;
+        if (texture_cache_size > 0 && texture_cache == nullptr) texture_cache = make_shared<TextureCache>(texture_cache_size);
+        load_pool = make_shared<RenderThreadPool>(std::min(thread_num, tasks_num));
+        int spare_threads = std::max(1, thread_num / tasks_num);
+        images_end.assign(pending_images.size(), 0);
+        noises_end.assign(pending_noises.size(), 0);
+        load_start = GetTickCount();
+        for (size_t i = 0; i < pending_images.size(); i++) {
+            auto image = pending_images[i].image;
+            auto file_name = pending_images[i].file_name;
+            auto texture = pending_images[i].texture;
+            auto cache = texture_cache;
+            DWORD* end_time = &images_end[i];
+            load_pool->AddTask([image, file_name, texture, cache, end_time, spare_threads](RenderTaskParam param) {
+                TraceSpan span("texture decode", param.from, param.to);
+                if (texture != nullptr && cache != nullptr) texture->BuildTiled(file_name, cache, spare_threads);
+                else {
+                    image->read_from_file(file_name, spare_threads);
+                    if (texture != nullptr) texture->BuildMipMap();
+                }
+                *end_time = GetTickCount();
+            }, { (int)i, (int)i + 1 });
+        }
+        for (size_t i = 0; i < pending_noises.size(); i++) {
+            auto noise = pending_noises[i];
+            std::vector<shared_ptr<NoiseVolume>> volumes;
+            for (auto& volume : pending_volumes) {
+                if (volume->GetSource() == noise) volumes.push_back(volume);
+            }
+            DWORD* end_time = &noises_end[i];
+            load_pool->AddTask([noise, volumes, end_time, spare_threads](RenderTaskParam param) {
+                TraceSpan span("noise generate", param.from, param.to);
+                noise->Generate();
+                for (auto& volume : volumes) volume->Build(spare_threads);
+                *end_time = GetTickCount();
+            }, { (int)i, (int)i + 1 });
+        }
+        load_pool->Dispatch();
+    }
+
+    void WaitForLoading() {
+        if (load_pool == nullptr) return;
+        DWORD wait_start = GetTickCount();
+        load_pool->WaitForTaskEnding();
+        load_pool = nullptr;
+        DWORD wait_end = GetTickCount();
+        DWORD images_time = 0, noises_time = 0;
+        for (auto t : images_end) images_time = std::max(images_time, t - load_start);
+        for (auto t : noises_end) noises_time = std::max(noises_time, t - load_start);
+        std::cout << "decode " << pending_images.size() << " images: " << images_time * 1.0 / 1000 << "s, generate "
+                  << pending_noises.size() << " noise tables: " << noises_time * 1.0 / 1000 << "s, waited "
+                  << (wait_end - wait_start) * 1.0 / 1000 << "s\n";
+        size_t texture_bytes = 0;
+        for (auto& pending : pending_images) {
+            if (pending.texture != nullptr) texture_bytes += pending.texture->GetMemorySize();
+        }
+        if (texture_bytes > 0) std::cout << "image textures with mipmaps: " << texture_bytes / 1024 << " KB\n";
+        size_t volume_bytes = 0;
+        for (auto& volume : pending_volumes) volume_bytes += volume->GetMemorySize();
+        if (volume_bytes > 0) std::cout << pending_volumes.size() << " noise volumes: " << volume_bytes / 1024 << " KB\n";
+        if (texture_cache != nullptr) std::cout << "texture cache: " << texture_cache->GetCapacity() / 1024 << " KB\n";
+        pending_images.clear();
+        pending_noises.clear();
+        pending_volumes.clear();
+    }
+
+    void CompileTextures() {
+        for (auto& material : materials) material->compile_texture();
     }
 
     shared_ptr<Camera>& GetCamera() { return camera; }
     
     std::vector<shared_ptr<Hittable>>& GetObjects() { return objs; }
+    shared_ptr<IrradianceCache>& GetIrradianceCache() { return irradiance_cache; }
+    shared_ptr<PPMImage>& GetEnvImage() { return env_image; }
+    shared_ptr<TextureCache>& GetTextureCache() { return texture_cache; }
+    std::vector<shared_ptr<Noise>> GetNoises() const {
+        std::vector<shared_ptr<Noise>> noises;
+        for (auto& texture : textures) {
+            auto noise_texture = std::dynamic_pointer_cast<NoiseTexture>(texture);
+            if (noise_texture != nullptr && std::find(noises.begin(), noises.end(), noise_texture->GetNoise()) == noises.end())
+                noises.push_back(noise_texture->GetNoise());
+        }
+        return noises;
+    }
 
-    bool CheckUseBVH() const { return use_bvh; }
+    AcceleratorType GetAcceleratorType() const { return accelerator_type; }
     bool CheckIsSampleWorld() const { return is_sample_world; }
+    bool CheckLightBench() const { return light_bench; }
+    bool CheckAccelBench() const { return accel_bench; }
+    bool CheckNoiseBench() const { return noise_bench; }
+    bool CheckSceneCache() const { return scene_cache; }
+    int GetManyLightsNum() const { return many_lights_num; }
+    LightSampling GetLightSampling() const { return light_sampling; }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+﻿#ifndef __ACCELERATOR_H__
+#define __ACCELERATOR_H__
+
+#include "BVH.hpp"
+#include "hittable.hpp"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+enum class AcceleratorType { List, BVH, Grid, LazyBVH };
+
+// 场景求交的加速结构，只负责有包围盒的物体，无限大平面等仍由 world_hit 单独求交
+class Accelerator {
+public:
+    virtual ~Accelerator() = default;
+    virtual bool hit(const Ray& ray, double t_min, double t_max, hit_info& ret) = 0;
+    // 换帧后快门区间变化，更新运动物体
+    virtual void Update(double, double, int) {}
+    virtual const char* GetName() const = 0;
+};
+
+std::shared_ptr<Accelerator> CreateAccelerator(AcceleratorType type, const std::vector<std::shared_ptr<Hittable>>& objs,
+    double time0, double time1, int threads_num);
+
+// 逐个物体求交
+class ListAccelerator : public Accelerator {
+    std::vector<std::shared_ptr<Hittable>> objs;
+public:
+    ListAccelerator(const std::vector<std::shared_ptr<Hittable>>& objs_) : objs(objs_) {}
+
+    bool hit(const Ray&, double, double, hit_info&) override;
+    const char* GetName() const override { return "list"; }
+};
+
+// 两层 BVH：静态物体建一次，运动物体单独一棵树，换帧时 refit
+class BVHAccelerator : public Accelerator {
+    std::shared_ptr<BVH_Node> static_bvh, dynamic_bvh;
+    friend class SceneCache;
+
+    BVHAccelerator() = default;
+public:
+    BVHAccelerator(const std::vector<std::shared_ptr<Hittable>>& objs, double time0, double time1);
+
+    bool hit(const Ray&, double, double, hit_info&) override;
+    void Update(double time0, double time1, int threads_num) override;
+    const char* GetName() const override { return "bvh"; }
+};
+
+// 均匀网格，用 3D-DDA 按光线经过的顺序遍历格子（Amanatides & Woo 1987）
+// 每个格子的物体下标连续存放在 cell_objs 中，范围由 cell_start 给出
+class GridAccelerator : public Accelerator {
+    static constexpr double CELLS_PER_OBJECT = 4.;
+    static constexpr int MAX_RESOLUTION = 128;
+
+    std::vector<std::shared_ptr<Hittable>> objs;
+    point3d grid_min, grid_max;
+    vec3d cell_size;
+    int res[3];
+    std::vector<int> cell_start;
+    std::vector<int> cell_objs;
+
+    void Build(double time0, double time1, int threads_num);
+public:
+    GridAccelerator(const std::vector<std::shared_ptr<Hittable>>& objs_, double time0, double time1, int threads_num);
+
+    bool hit(const Ray&, double, double, hit_info&) override;
+    void Update(double time0, double time1, int threads_num) override { Build(time0, time1, threads_num); }
+    const char* GetName() const override { return "grid"; }
+    size_t GetCellsNum() const { return cell_start.empty() ? 0 : cell_start.size() - 1; }
+};
+
+// 惰性 BVH：构建时只算出根节点，内部节点在第一次有光线到达时才划分
+// 每个节点有一个 once 标志，抢到的线程负责划分，其余线程自旋等待，不会重复划分
+class LazyBVHAccelerator : public Accelerator {
+    static constexpr int MAX_LEAF_SIZE = 4;
+    enum NodeState { Unexpanded, Expanding, Interior, Leaf };
+
+    struct Node {
+        point3d bmin, bmax;
+        int start, end;          // 物体在 indices 中的范围
+        int left;                // 左孩子下标，右孩子紧跟其后，展开后才有效
+        std::atomic<int> state;
+    };
+
+    std::vector<std::shared_ptr<Hittable>> objs;
+    std::vector<AABB> boxes;
+    std::vector<point3d> centroids;
+    std::vector<int> indices;      // 划分时各节点只在自己的范围内重排，互不影响
+    std::unique_ptr<Node[]> nodes; // 预留 2n 个节点，展开时不会搬动已有节点
+    std::atomic<int> nodes_num;
+
+    void Build(double time0, double time1);
+    void InitNode(Node& node, int start, int end);
+    void Expand(Node& node);
+public:
+    LazyBVHAccelerator(const std::vector<std::shared_ptr<Hittable>>& objs_, double time0, double time1);
+
+    bool hit(const Ray&, double, double, hit_info&) override;
+    void Update(double time0, double time1, int) override { Build(time0, time1); }
+    const char* GetName() const override { return "lazybvh"; }
+    int GetNodesNum() const { return nodes_num.load(std::memory_order_relaxed); }
+};
+
+#endif
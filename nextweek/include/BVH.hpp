@@ -21,12 +21,22 @@ public:
     bool hit(const Ray& r, double in_t, double out_t) const;
 
     static AABB surrounding_box(const AABB&, const AABB&);
+    static AABB lerp(const AABB&, const AABB&, double);
+    static bool hit_lerp(const AABB&, const AABB&, double, const Ray& r, double in_t, double out_t);
 };
 
 class BVH_Node : public Hittable {
     std::shared_ptr<Hittable> left;
     std::shared_ptr<Hittable> right;
     AABB box;
+    bool is_dynamic = false;
+    // 含运动物体的节点另存快门开始和结束时刻的包围盒，求交时按光线时间插值
+    AABB box0, box1;
+    double time0 = 0., time1 = 0.;
+    friend class SceneCache;
+
+    AABB GetBox(double time) const;
+    double GetLerpFactor(double time) const;
 
     static bool bbcmp(const std::shared_ptr<Hittable>&, const std::shared_ptr<Hittable>&, size_t);
 public:
@@ -37,6 +47,11 @@ public:
     bool bounding_box(const double, const double, AABB& output_box) const;
 
     bool hit(const Ray&, double, double, hit_info&);
+    bool IsDynamic() const override { return is_dynamic; }
+
+    void UpdateBox(double time0, double time1);
+    void Refit(double time0, double time1) override;
+    void ParallelRefit(double time0, double time1, int threads_num);
 };
 
 #endif
\ No newline at end of file
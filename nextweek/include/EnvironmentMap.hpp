@@ -0,0 +1,41 @@
+﻿#ifndef __ENVIRONMENT_MAP_H__
+#define __ENVIRONMENT_MAP_H__
+
+#include "algebra.hpp"
+#include "Color.hpp"
+#include "PPMImage.hpp"
+#include <memory>
+#include <vector>
+
+// Walker/Vose 别名表，建表 O(n)，采样 O(1)
+class AliasTable {
+    std::vector<float> prob;
+    std::vector<int> alias;
+public:
+    AliasTable() = default;
+    void Build(const double* weights, int n);
+    int Sample(double u1, double u2) const;
+};
+
+// 经纬度映射的 HDR 环境贴图，作为光线未击中物体时的背景
+// 每个像素按 亮度 * sin(theta) 加权，先用行的别名表选行，再用该行的别名表选列
+class EnvironmentMap {
+    std::shared_ptr<PPMImage> image;
+    double scale;
+    int w, h;
+    double total_weight;
+    std::vector<double> row_weights;
+    std::vector<AliasTable> rows;
+    AliasTable marginal;
+
+    double GetWeight(int x, int y) const;
+    vec3d GetDirection(double u, double v) const;
+public:
+    EnvironmentMap(std::shared_ptr<PPMImage> image_, double scale_ = 1., int threads_num = 8);
+
+    Color Lookup(const vec3d& dir) const;
+    // 按亮度重要性采样一个方向，pdf 为立体角上的概率密度
+    Color Sample(vec3d& dir, double& pdf) const;
+};
+
+#endif
@@ -0,0 +1,46 @@
+﻿#ifndef __IRRADIANCE_CACHE_H__
+#define __IRRADIANCE_CACHE_H__
+
+#include "algebra.hpp"
+#include "Color.hpp"
+#include <atomic>
+
+// 一条缓存记录，保存某个漫反射点上方半球入射辐亮度的余弦加权均值
+// 乘上该点的反照率即为其间接光照的出射辐亮度
+struct IrradianceRecord {
+    point3d p;
+    vec3d n;
+    Color e;
+    double r; // 半球采样击中距离的调和平均，决定记录的有效范围
+    IrradianceRecord* next;
+};
+
+// 辐照度缓存（Ward 1988），记录存放在按空间网格散列的桶中，
+// 每个桶是一个只增不删的单链表，插入用 CAS 完成，查询无需加锁
+class IrradianceCache {
+    static constexpr size_t BUCKET_CNT = 1 << 18;
+
+    double a;            // 允许的插值误差，越小记录越密
+    double min_r, max_r; // 记录有效半径的上下限
+    double cell_size;    // 网格边长，不小于记录的最大影响范围 a * max_r
+    std::atomic<IrradianceRecord*>* buckets;
+    std::atomic<int> records_num;
+    friend class SceneCache;
+
+    vec3i GetCell(const point3d& p) const;
+    static size_t Hash(const vec3i& cell);
+public:
+    int samples; // 每条记录的半球采样数
+
+    IrradianceCache(int samples_ = 64, double a_ = 0.2, double min_r_ = 0.01, double max_r_ = 10.) noexcept;
+    ~IrradianceCache() noexcept;
+    IrradianceCache(const IrradianceCache&) = delete;
+    IrradianceCache& operator=(const IrradianceCache&) = delete;
+
+    bool Lookup(const point3d& p, const vec3d& n, Color& e) const;
+    void Insert(const point3d& p, const vec3d& n, const Color& e, double r);
+    void Clear();
+    int GetRecordsNum() const;
+};
+
+#endif
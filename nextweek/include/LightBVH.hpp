@@ -0,0 +1,46 @@
+﻿#ifndef __LIGHT_BVH_H__
+#define __LIGHT_BVH_H__
+
+#include "BVH.hpp"
+#include "hittable.hpp"
+#include <memory>
+#include <vector>
+#include <unordered_set>
+
+enum class LightSampling { None, Uniform, BVH };
+
+// 光源层次结构（Conty Estevez & Kulla 2018），只建立在发光物体上
+// 每个节点记录包围盒、总功率和发光方向锥，选择光源时从根节点向下按重要性随机走到叶子
+class LightBVH {
+    struct LightCone {
+        vec3d w;        // 锥的轴
+        double theta_o; // 法线方向的分布范围
+        double theta_e; // 每个法线方向上的发光范围
+    };
+    struct Node {
+        AABB box;
+        LightCone cone;
+        double power;
+        int left, right; // 内部节点的子节点下标
+        int light;       // 叶节点对应的光源下标，内部节点为 -1
+    };
+
+    std::vector<std::shared_ptr<Hittable>> lights;
+    std::vector<Node> nodes;
+    std::unordered_set<const Hittable*> light_set;
+
+    static LightCone MergeCone(const LightCone&, const LightCone&);
+    int Build(std::vector<Node>& leaves, int start, int end);
+    double Importance(const Node&, const point3d& p, const vec3d& n) const;
+public:
+    LightBVH(const std::vector<std::shared_ptr<Hittable>>& objs, double time0, double time1);
+
+    int GetLightsNum() const;
+    bool IsSampledLight(const Hittable*) const;
+
+    // pmf 返回选中该光源的概率
+    const std::shared_ptr<Hittable>& Sample(const point3d& p, const vec3d& n, double& pmf) const;
+    const std::shared_ptr<Hittable>& SampleUniform(double& pmf) const;
+};
+
+#endif
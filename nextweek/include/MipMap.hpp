@@ -0,0 +1,49 @@
+﻿#ifndef __MIPMAP_H__
+#define __MIPMAP_H__
+
+#include "Color.hpp"
+#include "PPMImage.hpp"
+#include <cstdint>
+#include <vector>
+
+// 图像纹理的 MIP 金字塔，每层是上一层 2x2 的盒式平均
+// 所有分量都能用 8 位无损表示时（8 位的 P3/P6）每个纹素存 4 字节，否则存 3 个 half，都比原来的 Color 小得多
+class MipMap {
+    struct Level {
+        int width, height;
+        size_t offset; // 该层第一个纹素在 texels8 或 texels16 中的位置
+    };
+
+    std::vector<Level> levels;
+    std::vector<uint32_t> texels8;  // R | G << 8 | B << 16，保存文件里的原值，与原来直接取 value / maxval 一致
+    std::vector<uint16_t> texels16; // 每个纹素依次是 R, G, B 三个 half
+    bool is_half = false;
+    friend class SceneCache;
+    friend class TiledImage;
+
+    MipMap() = default;
+
+    size_t AddLevel(int width, int height);
+    void SetTexel(size_t i, float r, float g, float b);
+    template<bool half>
+    void Accumulate(size_t i, float w, float* rgb) const;
+    template<bool half>
+    void Bilinear(int level, double s, double t, float weight, float* rgb) const;
+    template<bool half>
+    Color Trilinear(double s, double t, double width) const;
+public:
+    explicit MipMap(PPMImage& image);
+
+    // s, t 在 [0, 1] 内，t = 0 为图像第一行；width 为查询区域在纹理空间的宽度，按它在相邻两层间做三线性插值
+    Color Lookup(double s, double t, double width) const;
+    size_t GetMemorySize() const { return texels8.size() * sizeof(uint32_t) + texels16.size() * sizeof(uint16_t); }
+
+    // 以下供分块存储的纹理（TiledImage）使用同样的编码和过滤方式
+    static uint16_t FloatToHalf(float f);
+    static float HalfToFloat(uint16_t h);
+    static void WrapCoords(double& s, double& t);
+    static int SelectLevel(double width, int size, int levels_num, float& f);
+    static void BilinearCoords(double s, double t, int width, int height, int (&x)[2], int (&y)[2], float& dx, float& dy);
+};
+
+#endif
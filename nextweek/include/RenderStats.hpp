@@ -0,0 +1,52 @@
+﻿#ifndef __RENDER_STATS_H__
+#define __RENDER_STATS_H__
+
+#include "global.hpp"
+#include <cstdint>
+#include <string>
+
+// 渲染统计：每个线程只累加自己的计数器，渲染结束后再合并，去掉 x 启用
+// 关闭时 STATS_ADD 等宏展开为空语句，热点路径上没有任何开销
+#define RENDER_STATSx
+
+enum class StatsPrimitive { Sphere, Plane, Box, Rect, Triangle, Instance, Num };
+enum class StatsMaterial { Lambertian, Metal, Dielectrics, DiffuseLight, Num };
+
+struct RenderCounters {
+    uint64_t rays[max_depth + 1];   // 按弹射深度统计的光线数，0 为相机光线
+    uint64_t shadow_rays;
+    uint64_t max_depth_paths;       // 达到 max_depth 被截断的路径
+    uint64_t bvh_nodes;             // 访问的 BVH 节点（包括网格内部的 BVH）
+    uint64_t box_tests;             // 包围盒求交次数
+    uint64_t primitive_tests[(int)StatsPrimitive::Num];
+    uint64_t scatters[(int)StatsMaterial::Num];
+};
+
+class RenderStats {
+    static RenderCounters* Acquire();
+    static void Release(RenderCounters* counters);
+    struct LocalCounters {
+        RenderCounters* counters = Acquire();
+        ~LocalCounters() { Release(counters); }
+    };
+public:
+    // 线程第一次计数时取得一组计数器，线程退出后计数保留到合并，计数器交给之后的线程接着累加
+    static RenderCounters& Local() {
+        thread_local LocalCounters local;
+        return *local.counters;
+    }
+    static RenderCounters Merge();
+    static void Reset();
+    // 打印汇总表并把合并后的计数器写成 JSON
+    static void Report(const std::string& json_file);
+};
+
+#ifdef RENDER_STATS
+#define STATS_ADD(counter, n) (RenderStats::Local().counter += (n))
+#else
+#define STATS_ADD(counter, n) ((void)0)
+#endif
+#define STATS_PRIMITIVE(type) STATS_ADD(primitive_tests[(int)StatsPrimitive::type], 1)
+#define STATS_SCATTER(type) STATS_ADD(scatters[(int)StatsMaterial::type], 1)
+
+#endif
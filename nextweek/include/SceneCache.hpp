@@ -0,0 +1,143 @@
+﻿#ifndef __SCENE_CACHE_H__
+#define __SCENE_CACHE_H__
+
+#include "config.hpp"
+#include "Accelerator.hpp"
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// 场景缓存：把解析好的场景（图像、纹理、材质、物体）和建好的 BVH 存成一个带版本号的二进制文件
+// 文件头记录配置文件及其引用的图像、网格文件内容的 FNV-1a 哈希，哈希一致时直接映射文件恢复场景，不再解析配置和建树
+class SceneCache {
+    static constexpr uint32_t MAGIC = 0x43535452; // "RTSC"
+    static constexpr uint32_t VERSION = 5;
+    static constexpr uint32_t NONE = 0xffffffff;  // 空指针的编号
+
+    enum class NoiseType : uint32_t { Perlin, Volume };
+    enum class TextureType : uint32_t { Solid, Checker, Noise, Image, Tiled };
+    enum class MaterialType : uint32_t { Lambertian, Metal, Dielectrics, DiffuseLight };
+    enum class HittableType : uint32_t { Sphere, MovingSphere, RectX, RectY, RectZ, Plane, Box, Mesh, Instance, BVHNode };
+
+    // 一张对象表，记录依次追加，编号即记录的序号，被引用的对象总是先于引用者写入
+    struct Table {
+        std::vector<char> bytes;
+        uint32_t count = 0;
+        std::map<const void*, uint32_t> ids;
+
+        template<typename T>
+        void Put(const T& v) { PutArray(&v, 1); }
+        template<typename T>
+        void PutArray(const T* p, size_t n) {
+            static_assert(std::is_trivially_copyable<T>::value, "SceneCache can only store trivially copyable data");
+            bytes.insert(bytes.end(), (const char*)p, (const char*)(p + n));
+        }
+        template<typename T>
+        void PutVector(const std::vector<T>& v) {
+            Put((uint64_t)v.size());
+            PutArray(v.data(), v.size());
+        }
+        void PutString(const std::string& s) {
+            Put((uint32_t)s.size());
+            PutArray(s.data(), s.size());
+        }
+    };
+
+    // 在映射的文件内容上顺序读取，越界后 ok 置为 false，之后读到的都是零值
+    struct Reader {
+        const char* p;
+        const char* end;
+        bool ok = true;
+
+        template<typename T>
+        T Get() {
+            T v{};
+            GetArray(&v, 1);
+            return v;
+        }
+        template<typename T>
+        void GetArray(T* v, size_t n) {
+            static_assert(std::is_trivially_copyable<T>::value, "SceneCache can only store trivially copyable data");
+            if (!ok || (size_t)(end - p) / sizeof(T) < n) {
+                ok = false;
+                return;
+            }
+            memcpy(v, p, n * sizeof(T));
+            p += n * sizeof(T);
+        }
+        template<typename T>
+        void GetVector(std::vector<T>& v) {
+            uint64_t n = Get<uint64_t>();
+            if (!ok || (size_t)(end - p) / sizeof(T) < n) {
+                ok = false;
+                return;
+            }
+            v.resize(n);
+            GetArray(v.data(), n);
+        }
+        std::string GetString() {
+            uint32_t n = Get<uint32_t>();
+            if (!ok || (size_t)(end - p) < n) {
+                ok = false;
+                return std::string();
+            }
+            p += n;
+            return std::string(p - n, n);
+        }
+    };
+
+    template<typename T>
+    static bool GetRef(const std::vector<std::shared_ptr<T>>& table, uint32_t id, std::shared_ptr<T>& ret) {
+        if (id == NONE) ret = nullptr;
+        else if (id < table.size()) ret = table[id];
+        else return false;
+        return true;
+    }
+
+    std::string config_path;
+    std::string cache_path;
+    std::shared_ptr<Accelerator> accelerator;
+    std::shared_ptr<TextureCache> texture_cache; // 读取分块纹理时使用
+
+    Table images, noises, textures, materials, meshes, hittables;
+    bool write_failed = false; // 遇到无法保存的对象类型
+    std::vector<std::shared_ptr<PPMImage>> loaded_images;
+    std::vector<std::shared_ptr<Noise>> loaded_noises;
+    std::vector<std::shared_ptr<Texture>> loaded_textures;
+    std::vector<std::shared_ptr<Material>> loaded_materials;
+    std::vector<std::shared_ptr<MeshData>> loaded_meshes;
+    std::vector<std::shared_ptr<Hittable>> loaded_hittables;
+
+    bool HashSources(const std::vector<std::string>& files, uint64_t& hash) const;
+
+    uint32_t WriteImage(const std::shared_ptr<PPMImage>& image);
+    uint32_t WriteNoise(const std::shared_ptr<Noise>& noise);
+    uint32_t WriteTexture(const std::shared_ptr<Texture>& texture);
+    uint32_t WriteMaterial(const std::shared_ptr<Material>& material);
+    uint32_t WriteMesh(const std::shared_ptr<MeshData>& mesh);
+    uint32_t WriteHittable(const std::shared_ptr<Hittable>& obj);
+
+    bool ReadImages(Reader& in);
+    bool ReadNoises(Reader& in);
+    bool ReadTextures(Reader& in);
+    bool ReadMaterials(Reader& in);
+    bool ReadMeshes(Reader& in);
+    bool ReadHittables(Reader& in);
+public:
+    SceneCache(const ConfigManager& config);
+
+    // 缓存不存在、版本不符或源文件内容有变化时返回 false，此时应重新解析配置
+    bool Load(ConfigManager& config);
+    // objs 为最终的场景物体，accelerator 为 BVHAccelerator 时一并保存它的两棵树
+    bool Save(const ConfigManager& config, const std::vector<std::shared_ptr<Hittable>>& objs,
+        const std::shared_ptr<Accelerator>& accelerator_);
+
+    // 缓存中保存了 BVH 时返回恢复出的加速结构，否则为空
+    const std::shared_ptr<Accelerator>& GetAccelerator() const { return accelerator; }
+};
+
+#endif
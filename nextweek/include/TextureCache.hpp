@@ -0,0 +1,97 @@
+﻿#ifndef __TEXTURE_CACHE_H__
+#define __TEXTURE_CACHE_H__
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include "Color.hpp"
+#include "MipMap.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// 所有分块纹理共用的 tile 缓存，总大小固定，按 8 路组相联组织，组内淘汰最久未使用的一路
+// 命中时不加锁：每一路带一个版本号（seqlock），读完纹素后版本号不变即读到的是完整的 tile
+// 未命中时只锁住该组所在的分片，从映射的分块文件复制 tile 进来
+class TextureCache {
+public:
+    static constexpr int TILE_SIZE = 32;
+    static constexpr size_t TILE_BYTES = TILE_SIZE * TILE_SIZE * 6; // 按最大的纹素（3 个 half）分配，8 位纹理的 tile 只用前 2/3
+private:
+    static constexpr int WAYS = 8;
+    static constexpr int SHARDS_NUM = 64;
+
+    struct Set {
+        std::atomic<uint64_t> keys[WAYS];     // 0 表示空
+        std::atomic<uint32_t> versions[WAYS]; // 奇数表示正在写入
+        std::atomic<uint32_t> last_use[WAYS];
+    };
+    struct alignas(64) Shard {
+        CRITICAL_SECTION cs;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> evictions;
+    };
+
+    size_t sets_num;
+    std::unique_ptr<Set[]> sets;
+    std::unique_ptr<unsigned char[]> tiles;
+    Shard shards[SHARDS_NUM];
+    std::atomic<uint32_t> clock;    // 每次未命中加 1，作为最近使用时间
+    std::atomic<uint32_t> images_num;
+
+    unsigned char* GetTile(size_t set_index, int way) { return tiles.get() + (set_index * WAYS + way) * TILE_BYTES; }
+public:
+    explicit TextureCache(size_t capacity);
+    ~TextureCache();
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    uint32_t RegisterImage() { return ++images_num; }
+    // 从 key 对应的 tile 中取出 n 个纹素，offsets 为纹素在 tile 内的字节偏移；tile 不在缓存中时从 source 复制 tile_bytes 字节进来
+    void Read(uint64_t key, const char* source, size_t tile_bytes, const int* offsets, int n, int texel_bytes, unsigned char* out);
+
+    size_t GetCapacity() const { return sets_num * WAYS * TILE_BYTES; }
+    void PrintStatistics() const;
+};
+
+// 以分块文件保存的 MIP 金字塔，文件放在图像旁边（名字加上 .tiles），记录图像文件的大小和修改时间，两者不变时直接使用
+// 每层切成 TILE_SIZE x TILE_SIZE 的 tile，查询时只通过 TextureCache 读入用到的 tile
+class TiledImage {
+    struct Level {
+        int width, height;
+        int tiles_x, tiles_y;
+        uint64_t first_tile;
+    };
+
+    std::string file_name;
+    std::shared_ptr<TextureCache> cache;
+    std::shared_ptr<MappedFile> file;
+    const char* tiles = nullptr;
+    std::vector<Level> levels;
+    uint32_t id;
+    bool is_half = false;
+    size_t tile_bytes = 0;
+
+    template<bool half>
+    void Bilinear(int level, double s, double t, float weight, float* rgb) const;
+    template<bool half>
+    Color Trilinear(double s, double t, double width) const;
+public:
+    TiledImage(const std::string& file_name_, const std::shared_ptr<TextureCache>& cache_);
+
+    // 分块文件存在且与图像一致时打开，否则返回空
+    static std::shared_ptr<TiledImage> Open(const std::string& file_name, const std::shared_ptr<TextureCache>& cache);
+    // 把 MIP 金字塔写成分块文件后打开
+    static std::shared_ptr<TiledImage> Create(const std::string& file_name, const MipMap& mipmap, const std::shared_ptr<TextureCache>& cache);
+
+    Color Lookup(double s, double t, double width) const;
+    const std::string& GetFileName() const { return file_name; }
+};
+
+#endif
@@ -0,0 +1,52 @@
+﻿#ifndef __TEXTURE_PROGRAM_H__
+#define __TEXTURE_PROGRAM_H__
+
+#include "texture.hpp"
+#include <map>
+#include <memory>
+#include <vector>
+
+// 材质的纹理图编译成的扁平节点数组：棋盘格节点按下标跳到子节点，叶子节点直接求值，不再逐层调用 Texture 的虚函数
+// 节点只保存纹理对象内部数据的裸指针，纹理图由 Material 持有，编译后不能再修改
+class TextureProgram {
+    enum class Op : uint8_t { Solid, Checker, Perlin, NoiseVolume, MipMap, Tiled };
+    struct Node {
+        Op op;
+        int odd, even; // 棋盘格两个子节点的下标
+        Color color;   // 纯色，或噪声纹理的颜色
+        double scale;  // 噪声纹理的 scale
+        union {
+            const PerlinNoise* perlin;
+            const NoiseVolume* volume;
+            const MipMap* mipmap;
+            const TiledImage* tiled;
+        };
+    };
+    std::vector<Node> nodes;
+
+    int Compile(const Texture* texture, std::map<const Texture*, int>& ids);
+    int AddSolid(const Color& color);
+public:
+    // 遇到无法编译的纹理时返回 false，程序保持为空
+    bool Compile(const std::shared_ptr<Texture>& texture);
+    bool IsEmpty() const { return nodes.empty(); }
+    size_t GetNodesNum() const { return nodes.size(); }
+
+    Color Evaluate(const double u, const double v, const point3d& p, const double footprint) const {
+        const Node* node = nodes.data();
+        if (node->op == Op::Checker) {
+            // 所有棋盘格用同一个函数划分，嵌套时只需判断一次
+            bool is_odd = CheckerTexture::IsOdd(u, v, p);
+            while (node->op == Op::Checker) node = &nodes[is_odd ? node->odd : node->even];
+        }
+        switch (node->op) {
+        case Op::Perlin: return NoiseTexture::GetColor(node->color, node->scale, p, node->perlin->Turb(p));
+        case Op::NoiseVolume: return NoiseTexture::GetColor(node->color, node->scale, p, node->volume->Turb(p));
+        case Op::MipMap: return node->mipmap->Lookup(1 - u, v, footprint);
+        case Op::Tiled: return node->tiled->Lookup(1 - u, v, footprint);
+        default: return node->color;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,75 @@
+﻿#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// 执行时间线：记录各线程上场景加载、纹理解码、建树、线程池任务、写图像等区间，输出 Chrome trace JSON，
+// 可在 Perfetto 或 chrome://tracing 中查看负载不均和串行阶段，去掉 x 启用
+// 关闭时 TraceSpan 是空类，没有任何开销
+#define RENDER_TRACEx
+
+struct TraceEvent {
+    const char* name; // 只保存指针，必须是字符串常量
+    int64_t start, end;
+    int from, to;     // 任务参数，为 -1 时不输出
+};
+
+// 环形缓冲，同一时刻只有持有它的线程写入，满了覆盖最早的事件；所有线程结束后才读取
+// 线程池每次分发都创建新线程，线程退出时缓冲放回空闲表，之后的线程接着写，trace 中一个缓冲就是一条轨道
+struct TraceBuffer {
+    static constexpr uint64_t capacity = 1 << 16;
+    int index; // 分配顺序，作为 trace 中的 tid
+    std::atomic<uint64_t> head{ 0 };
+    TraceEvent events[capacity];
+};
+
+class Trace {
+    static TraceBuffer* Acquire();
+    static void Release(TraceBuffer* buffer);
+    struct LocalBuffer {
+        TraceBuffer* buffer = Acquire();
+        ~LocalBuffer() { Release(buffer); }
+    };
+public:
+    static TraceBuffer& Local() {
+        thread_local LocalBuffer local;
+        return *local.buffer;
+    }
+    static int64_t Now();
+    static void Record(TraceBuffer& buffer, const char* name, int64_t start, int from, int to) {
+        uint64_t head = buffer.head.load(std::memory_order_relaxed);
+        buffer.events[head & (TraceBuffer::capacity - 1)] = { name, start, Now(), from, to };
+        buffer.head.store(head + 1, std::memory_order_release);
+    }
+    // 合并所有线程的缓冲写成 JSON，调用时记录的线程都应已结束或空闲
+    static void Write(const std::string& json_file);
+};
+
+#ifdef RENDER_TRACE
+// 构造时开始，析构或 End 时结束的区间
+class TraceSpan {
+    TraceBuffer& buffer;
+    const char* name;
+    int64_t start;
+    int from, to;
+    bool ended = false;
+public:
+    TraceSpan(const char* name_, int from_ = -1, int to_ = -1) : buffer(Trace::Local()), name(name_), start(Trace::Now()), from(from_), to(to_) {}
+    ~TraceSpan() { End(); }
+    void End() {
+        if (ended) return;
+        ended = true;
+        Trace::Record(buffer, name, start, from, to);
+    }
+};
+#else
+class TraceSpan {
+public:
+    TraceSpan(const char*, int = -1, int = -1) {}
+    void End() {}
+};
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+﻿#ifndef __TRANSFORM_H__
+#define __TRANSFORM_H__
+
+#include "algebra.hpp"
+#include "global.hpp"
+#include <cmath>
+
+// 仿射变换，用 3x4 矩阵保存物体空间到世界空间的变换，同时保存它的逆
+class Transform {
+    double m[3][4];
+    double inv[3][4];
+
+    static void Multiply(const double (&a)[3][4], const double (&b)[3][4], double (&ret)[3][4]) {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                ret[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+            }
+            ret[i][3] += a[i][3];
+        }
+    }
+public:
+    Transform() noexcept {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) m[i][j] = inv[i][j] = i == j ? 1. : 0.;
+        }
+    }
+
+    static Transform Translate(const vec3d& offset) {
+        Transform t;
+        for (int i = 0; i < 3; i++) {
+            t.m[i][3] = offset[i];
+            t.inv[i][3] = -offset[i];
+        }
+        return t;
+    }
+
+    static Transform Scale(const vec3d& s) {
+        Transform t;
+        for (int i = 0; i < 3; i++) {
+            t.m[i][i] = s[i];
+            t.inv[i][i] = 1. / s[i];
+        }
+        return t;
+    }
+
+    // 绕过原点的 axis 轴旋转，角度单位为度，逆矩阵即转置
+    static Transform Rotate(const vec3d& axis, double angle) {
+        Transform t;
+        vec3d a = axis.normalize();
+        double radians = angle * PI / 180.;
+        double s = std::sin(radians), c = std::cos(radians);
+        double r[3][3] = {
+            { a.x * a.x * (1 - c) + c,       a.x * a.y * (1 - c) - a.z * s, a.x * a.z * (1 - c) + a.y * s },
+            { a.y * a.x * (1 - c) + a.z * s, a.y * a.y * (1 - c) + c,       a.y * a.z * (1 - c) - a.x * s },
+            { a.z * a.x * (1 - c) - a.y * s, a.z * a.y * (1 - c) + a.x * s, a.z * a.z * (1 - c) + c }
+        };
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                t.m[i][j] = r[i][j];
+                t.inv[j][i] = r[i][j];
+            }
+        }
+        return t;
+    }
+
+    static Transform RotateY(double angle) { return Rotate(vec3d(0, 1, 0), angle); }
+
+    // 先做 t 再做 *this
+    Transform operator*(const Transform& t) const {
+        Transform ret;
+        Multiply(m, t.m, ret.m);
+        Multiply(t.inv, inv, ret.inv);
+        return ret;
+    }
+
+    point3d PointToWorld(const point3d& p) const {
+        return point3d(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                       m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                       m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+    }
+    vec3d VectorToWorld(const vec3d& v) const {
+        return vec3d(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                     m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                     m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    }
+    // 法线要乘逆矩阵的转置，非均匀缩放时才能保持与表面垂直
+    vec3d NormalToWorld(const vec3d& n) const {
+        return vec3d(inv[0][0] * n.x + inv[1][0] * n.y + inv[2][0] * n.z,
+                     inv[0][1] * n.x + inv[1][1] * n.y + inv[2][1] * n.z,
+                     inv[0][2] * n.x + inv[1][2] * n.y + inv[2][2] * n.z).normalize();
+    }
+    point3d PointToLocal(const point3d& p) const {
+        return point3d(inv[0][0] * p.x + inv[0][1] * p.y + inv[0][2] * p.z + inv[0][3],
+                       inv[1][0] * p.x + inv[1][1] * p.y + inv[1][2] * p.z + inv[1][3],
+                       inv[2][0] * p.x + inv[2][1] * p.y + inv[2][2] * p.z + inv[2][3]);
+    }
+    vec3d VectorToLocal(const vec3d& v) const {
+        return vec3d(inv[0][0] * v.x + inv[0][1] * v.y + inv[0][2] * v.z,
+                     inv[1][0] * v.x + inv[1][1] * v.y + inv[1][2] * v.z,
+                     inv[2][0] * v.x + inv[2][1] * v.y + inv[2][2] * v.z);
+    }
+};
+
+#endif
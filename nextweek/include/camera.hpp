@@ -13,6 +13,7 @@ struct Camera
     double lens_r; // 透镜的半径
     double t1, t2; // 快门的开始/结束时间
     double aspect_ratio;
+    double pixel_spread = 0.; // 一个像素对应的视角，即主光线光锥的扩散量
     vec3d cx, cy, cz;
 
     Camera() noexcept : o(default_o), up_dir(default_up_dir), look_at(default_look_at), vfov(default_vfov), lens_r(1.), t1(0.), t2(0.)
@@ -44,7 +45,9 @@ struct Camera
         auto disk = (point3d(get_random(-1, 1), get_random(-1, 1), 0.)).normalize() * lens_r;
         vec3d offset = disk.x * cx + disk.y * cy;
         point3d ro = o + offset;
-        return Ray(ro, (vertical * u + horizontal * v + lower_left_corner - ro).normalize(), get_random(t1, t2));
+        Ray ray(ro, (vertical * u + horizontal * v + lower_left_corner - ro).normalize(), get_random(t1, t2));
+        ray.cone_spread = pixel_spread;
+        return ray;
     }
 };
 
@@ -14,9 +14,17 @@ constexpr int default_height = 400;
 constexpr int default_width = default_height * default_aspect_ratio;
 constexpr int samples_per_pixel = 300;
 constexpr int max_depth = 50;
+constexpr int thread_num = 8;
 
 constexpr double PI = 3.1415926535;
 
+inline vec3d get_random_unit_vec3d() {
+    double z = get_random(-1., 1.);
+    double r = std::sqrt(std::max(0., 1. - z * z));
+    double phi = get_random(0., 2. * PI);
+    return vec3d(r * std::cos(phi), r * std::sin(phi), z);
+}
+
 #ifdef max
 #undef max
 #endif
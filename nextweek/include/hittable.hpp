@@ -5,6 +5,7 @@
 #include "ray.hpp"
 #include "material.hpp"
 #include "texture.hpp"
+#include "Transform.hpp"
 
 class AABB;
 class Hittable;
@@ -19,6 +20,9 @@ struct hit_info{
     vec3d normal;
     vec3d cast_ray_dir;
     shared_ptr<Hittable> obj;
+    double uv_scale;    // 交点附近一个 UV 单位对应的世界空间长度，0 表示未知
+    double cone_width;  // 光锥到达交点时的宽度
+    double cone_spread; // 光锥每单位距离增加的宽度
 };
 
 class Hittable {
@@ -35,8 +39,16 @@ public:
     virtual bool scatter(Ray& ray_out, const hit_info& hit) const = 0;
     virtual bool bounding_box(const double, const double, AABB& output_box) const = 0;
     virtual void GetUV(double&, double&, const point3d&) const {}
+    // 作为面光源被采样时使用，在表面上均匀取一点，nm 返回该点朝向 ref 一侧的法线
+    virtual double GetArea() const { return 0.; }
+    virtual point3d SamplePoint(const point3d&, vec3d& nm, const double) const { nm = vec3d(); return point3d(); }
+    // 包围盒随时间变化的物体放进动态 BVH，换帧时只重算这部分
+    virtual bool IsDynamic() const { return false; }
+    // 快门区间变化后更新内部的加速结构，只有含动态物体的 BVH 和引用它的实例需要
+    virtual void Refit(double, double) {}
+    const std::shared_ptr<Material>& get_material() const { return material; }
     // Color get_material_attenuation_coef() const { return material->get_color_attenuation_coef(); }
-    virtual Color get_material_texture(const double u, const double v, const point3d& p) const { return material->get_texture(u, v, p); }
+    virtual Color get_material_texture(const double u, const double v, const point3d& p, const double footprint) const { return material->get_texture(u, v, p, footprint); }
     Color get_material_emitted(const double u, const double v, const point3d& p) const { return material->emitted(u, v, p); }
 };
 
@@ -56,12 +68,15 @@ public:
     bool bounding_box(const double, const double, AABB&) const override;
 
     void GetUV(double&, double&, const point3d&) const override;
-    Color get_material_texture(const double u, const double v, const point3d& p) const override;
+    double GetArea() const override;
+    point3d SamplePoint(const point3d&, vec3d&, const double) const override;
+    Color get_material_texture(const double u, const double v, const point3d& p, const double footprint) const override;
 };
 
 class MovingSphere : public Sphere {
     vec3d o_move_dir; // 球心移动方向
     double t1, t2; // 球心移动的开始结束时间
+    friend class SceneCache;
 public:
     MovingSphere() = default;
     MovingSphere(const double t1_, const point3d& o1, const double t2_, const point3d& o2,
@@ -72,12 +87,70 @@ public:
     double get_radius() const { return r; }
 
     bool MovingSphere::bounding_box(const double, const double, AABB&) const override;
+    bool IsDynamic() const override { return true; }
+};
+
+// 无限大平面，没有包围盒，不放进 BVH
+class Plane : public Hittable, public std::enable_shared_from_this<Plane> {
+    point3d o;
+    vec3d n;
+    vec3d tu, tv; // 平面内的两个正交方向，用于计算 UV
+    friend class SceneCache;
+public:
+    Plane() = default;
+    Plane(const point3d& o_, const vec3d& n_, std::shared_ptr<Material> m) noexcept;
+
+    bool hit(const Ray&, double, double, hit_info&) override;
+    bool scatter(Ray&, const hit_info&) const override;
+    bool bounding_box(const double, const double, AABB&) const override;
+    void GetUV(double&, double&, const point3d&) const override;
+};
+
+// 轴对齐的长方体，一次 slab 测试求交，法线和 UV 由击中面所在的轴得到
+class Box : public Hittable, public std::enable_shared_from_this<Box> {
+    point3d pmin, pmax;
+    friend class SceneCache;
+
+    int GetFaceAxis(const point3d& p) const;
+public:
+    Box() = default;
+    Box(const point3d& p1, const point3d& p2, std::shared_ptr<Material> m) noexcept;
+
+    bool hit(const Ray&, double, double, hit_info&) override;
+    bool scatter(Ray&, const hit_info&) const override;
+    bool bounding_box(const double, const double, AABB&) const override;
+    void GetUV(double&, double&, const point3d&) const override;
+    double GetArea() const override;
+    point3d SamplePoint(const point3d&, vec3d&, const double) const override;
+};
+
+// 对一个共享原型的引用，原型（自带 BVH 的物体集合或网格）只存一份，光线变换到物体空间求交后再把交点变换回来
+class Instance : public Hittable {
+    std::shared_ptr<Hittable> prototype;
+    Transform transform;
+    bool has_box;
+    point3d box_min, box_max;
+
+    bool TransformBox(const double time0, const double time1, point3d& bmin, point3d& bmax) const;
+public:
+    Instance(std::shared_ptr<Hittable> prototype_, const Transform& transform_) noexcept;
+
+    bool hit(const Ray&, double, double, hit_info&) override;
+    bool scatter(Ray&, const hit_info&) const override { return false; }
+    bool bounding_box(const double, const double, AABB&) const override;
+    bool IsDynamic() const override { return prototype->IsDynamic(); }
+    // 包围盒由 bounding_box 按原型当前的包围盒重新计算，只需 refit 原型
+    void Refit(double time0, double time1) override { prototype->Refit(time0, time1); }
+
+    const std::shared_ptr<Hittable>& GetPrototype() const { return prototype; }
+    const Transform& GetTransform() const { return transform; }
 };
 
 template<uint32_t axis>
 class Rect : public Hittable, public std::enable_shared_from_this<Rect<axis>> {
     static_assert(axis == 0 || axis == 1 || axis == 2);
     point3d p1, p2;
+    friend class SceneCache;
 
     static uint32_t GetNextAxis(uint32_t now) {
         uint32_t next = now + 1;
@@ -89,6 +162,7 @@ public:
     : p1(p1_), p2(p2_), Hittable(m) {}
     
     bool hit(const Ray& ray, double t_min, double t_max, hit_info& ret) override {
+        STATS_PRIMITIVE(Rect);
         double t = (p1[axis] - ray.o[axis]) / ray.dir[axis];
         if (t < t_min || t > t_max) return false;
         auto p = ray.at(t);
@@ -102,13 +176,15 @@ public:
             return false;
         ret.t = t;
         ret.point = p;
-        ret.normal = vec3d(0, 0, 1);
+        ret.normal = vec3d();
+        ret.normal[axis] = 1;
         if (dot(ret.normal, ray.dir) > 0.) {
             ret.normal = vec3d() - ret.normal;
             ret.inside_obj = true;
         }
         else ret.inside_obj = false;
         GetUV(ret.u, ret.v, ret.point);
+        ret.uv_scale = std::sqrt(GetArea());
         ret.obj = shared_from_this();
         return true;
     }
@@ -146,5 +222,21 @@ public:
         double h = maxy - miny;
         v = (p.y - miny) / h;
     }
+    double GetArea() const override {
+        auto t1 = GetNextAxis(axis);
+        auto t2 = GetNextAxis(t1);
+        return std::abs((p2[t1] - p1[t1]) * (p2[t2] - p1[t2]));
+    }
+    // 矩形双面发光，法线总是朝向 ref 所在一侧
+    point3d SamplePoint(const point3d& ref, vec3d& nm, const double) const override {
+        auto t1 = GetNextAxis(axis);
+        auto t2 = GetNextAxis(t1);
+        point3d p = p1;
+        p[t1] += (p2[t1] - p1[t1]) * get_random();
+        p[t2] += (p2[t2] - p1[t2]) * get_random();
+        nm = vec3d();
+        nm[axis] = ref[axis] < p1[axis] ? -1 : 1;
+        return p;
+    }
 };
 #endif
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "ray.hpp"
 #include "Color.hpp"
 #include "texture.hpp"
+#include "TextureProgram.hpp"
+#include "RenderStats.hpp"
 #include <memory>
 
 using std::shared_ptr;
@@ -30,14 +32,21 @@ struct dielectrics_scatter_info : scatter_info {
 class Material {
 protected:
     shared_ptr<Texture> texture;
+    TextureProgram program; // 纹理图编译后的节点数组，为空时仍走 Texture 的虚函数
     // Color attenuation_coef;
+    friend class SceneCache;
 public:
     Material() = default;
     Material(Color a_c) noexcept : texture(std::make_shared<SolidTexture>(a_c)) {}
     Material(shared_ptr<Texture> texture_) noexcept : texture(texture_) {}
     virtual bool scatter(shared_ptr<scatter_info>& info) const = 0;
     // Color get_color_attenuation_coef() const { return attenuation_coef; }
-    Color get_texture(const double u, const double v, const point3d& p) const { return texture->GetTexture(u, v, p); }
+    // 纹理图的数据（噪声表、图像）准备好以后才能编译，编译后纹理图不能再修改
+    void compile_texture() { if (texture != nullptr && program.IsEmpty()) program.Compile(texture); }
+    Color get_texture(const double u, const double v, const point3d& p, const double footprint) const {
+        if (!program.IsEmpty()) return program.Evaluate(u, v, p, footprint);
+        return texture->GetTexture(u, v, p, footprint);
+    }
     virtual Color emitted(double u, double v, const point3d& p) const { return Color(0,0,0); }
 };
 
@@ -46,6 +55,7 @@ public:
     Lambertian(Color a_c) noexcept : Material(a_c) {}
     Lambertian(shared_ptr<Texture> texture) noexcept : Material(texture) {}
     bool scatter(shared_ptr<scatter_info>& info) const override {
+        STATS_SCATTER(Lambertian);
         // one week 中 An Alternative Diffuse Formulation 说明正确的漫反射反射光线的方向是通过随机生成半球的方向得到，
         // 这里使用法线与随机单位球方向的向量和的方向近似，可能生成反正光线方向的概率不相同，不过个人感觉影响不大
         // vec3d diffuse_ray_dir = info->scatter_point_nm + random_unit_vector();
@@ -60,10 +70,12 @@ public:
 
 class Metal : public Material {
     double fuzz;
+    friend class SceneCache;
 public:
     Metal(Color a_c, double fuzz_ = 0.) noexcept : Material(a_c), fuzz(fuzz_) {}
     Metal(shared_ptr<Texture> texture, double fuzz_ = 0.) noexcept : Material(texture), fuzz(fuzz_) {}
     bool scatter(shared_ptr<scatter_info>& info) const override {
+        STATS_SCATTER(Metal);
         vec3d reflect_ray_dir = info->cast_ray_dir - info->scatter_point_nm * 2 * dot(info->cast_ray_dir, info->scatter_point_nm);
         vec3d fuzzy_dir = reflect_ray_dir + get_random_vec3d(-1., 1.) * fuzz;
         info->scatter_ray = Ray(info->scatter_point, fuzzy_dir.normalize(), info->ray_in_time);
@@ -83,6 +95,7 @@ public:
 
     double get_refraction_eta() const { return n; }
     bool scatter(shared_ptr<scatter_info>& tinfo) const override {
+        STATS_SCATTER(Dielectrics);
 
         auto info = std::static_pointer_cast<dielectrics_scatter_info>(tinfo);
 
@@ -109,9 +122,12 @@ class DiffuseLight : public Material {
 public:
     DiffuseLight(shared_ptr<Texture>& texture) noexcept : Material(texture) {}
     DiffuseLight(Color& color) noexcept : Material(color) {}
-    bool scatter(shared_ptr<scatter_info>& info) const { return false; }
+    bool scatter(shared_ptr<scatter_info>& info) const {
+        STATS_SCATTER(DiffuseLight);
+        return false;
+    }
     Color emitted(double u, double v, const point3d& p) const override {
-        return texture->GetTexture(u, v, p);
+        return get_texture(u, v, p, 0.);
     }
 };
 
@@ -0,0 +1,53 @@
+﻿#ifndef __MESH_H__
+#define __MESH_H__
+
+#include "hittable.hpp"
+#include "BVH.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// 三角网格的共享缓冲，位置、法线、UV 各自独立索引（与 OBJ 一致），没有的属性索引为 -1
+struct MeshData {
+    std::vector<point3d> positions;
+    std::vector<vec3d> normals;
+    std::vector<vec3d> uvs; // 只用 x, y
+    std::vector<vec3i> position_indices;
+    std::vector<vec3i> normal_indices;
+    std::vector<vec3i> uv_indices;
+
+    size_t GetTrianglesNum() const { return position_indices.size(); }
+};
+
+// 内存映射后多线程解析 OBJ 与二进制 PLY，文件名相对于 static 目录
+std::shared_ptr<MeshData> LoadMesh(const std::string& file_name, int threads_num);
+
+// 带有自己 BVH 的索引三角网格，求交使用 watertight 三角形测试（Woop et al. 2013）
+class Mesh : public Hittable, public std::enable_shared_from_this<Mesh> {
+    struct Node {
+        point3d bmin, bmax;
+        int offset; // 叶节点为三角形在 triangles 中的起始位置，内部节点为右孩子下标，左孩子紧跟在自己后面
+        int count;  // 叶节点的三角形数，内部节点为 0
+        int axis;   // 内部节点的划分轴
+    };
+
+    std::shared_ptr<MeshData> data;
+    std::vector<Node> nodes;
+    std::vector<int> triangles; // 按 BVH 叶节点顺序排列的三角形编号
+    friend class SceneCache;
+
+    Mesh() = default;
+
+    int Build(int start, int end, int depth, const std::vector<point3d>& tri_min, const std::vector<point3d>& tri_max, const std::vector<point3d>& centroids);
+    bool CheckTree() const;
+public:
+    Mesh(std::shared_ptr<MeshData> data_, std::shared_ptr<Material> m);
+
+    bool hit(const Ray&, double, double, hit_info&) override;
+    bool scatter(Ray&, const hit_info&) const override;
+    bool bounding_box(const double, const double, AABB&) const override;
+
+    size_t GetTrianglesNum() const { return data->GetTrianglesNum(); }
+};
+
+#endif
@@ -2,34 +2,53 @@
 #define __NOISE_H__
 
 #include "algebra.hpp"
+#include <memory>
+#include <random>
+#include <vector>
+
+// x64 上 SSE2 总是可用，其他平台退回到逐个角点计算的版本
+#if defined(_M_X64) || defined(__SSE2__)
+#define PERLIN_SSE
+#endif
 
 class Noise {
 public:
     virtual double Turb(const point3d&) const = 0;
 };
 
-class PerlinNoise : public Noise {
+class PerlinNoise final : public Noise {
     static constexpr int CNT = 256;
     static constexpr int TURB_DEPTH = 7;
     vec3d* rand_vec;
     int* permutation_x;
     int* permutation_y;
     int* permutation_z;
-    static int* GetPermutation() {
-        int* p = new int[CNT];
+    float (*gradients)[4]; // rand_vec 的 float 副本，第 4 个分量为 0，SSE 版本一次读入 4 个角点后转置
+    // 种子在构造时从创建线程的 rand() 取得，Generate 在加载线程池里执行时结果也只由主线程的种子决定
+    std::mt19937 engine;
+    friend class SceneCache;
+    void InitPermutation(int* p) {
         for (int i = 0; i < CNT; i++) p[i] = i;
         Shuffle(p, CNT);
-        return p;
     }
-    static void Shuffle(int* a, int cnt) {
+    void Shuffle(int* a, int cnt) {
         for (int i = cnt - 1; i > 0; i--) {
-            int t = get_random_int(0, i);
+            int t = std::uniform_int_distribution<int>(0, i)(engine);
             std::swap(a[i], a[t]);
         }
     }
     static double SmoothStep(double x) {
         return x * x * (3. - 2. * x);
     }
+    void UpdateGradients() {
+        for (int i = 0; i < CNT; i++) {
+            gradients[i][0] = (float)rand_vec[i].x;
+            gradients[i][1] = (float)rand_vec[i].y;
+            gradients[i][2] = (float)rand_vec[i].z;
+            gradients[i][3] = 0.f;
+        }
+    }
+    double TurbSSE(const point3d& p) const;
     double TrilinearInterp(vec3d c[8], double x, double y, double z) const {
         double ret = 0.;
         double xx = SmoothStep(x);
@@ -67,20 +86,34 @@ class PerlinNoise : public Noise {
         return TrilinearInterp(c, u, v, w);
     }
 public:
-    PerlinNoise() noexcept {
+    PerlinNoise(bool generate = true) noexcept : engine((unsigned)rand()) {
         rand_vec = new vec3d[CNT];
-        for (int i = 0; i < CNT; i++) rand_vec[i] = get_random_vec3d(-1, 1).normalize();
-        permutation_x = GetPermutation();
-        permutation_y = GetPermutation();
-        permutation_z = GetPermutation();
+        permutation_x = new int[CNT];
+        permutation_y = new int[CNT];
+        permutation_z = new int[CNT];
+        gradients = new float[CNT][4];
+        if (generate) Generate();
+    }
+    void Generate() {
+        std::uniform_real_distribution<double> dist(-1., 1.);
+        for (int i = 0; i < CNT; i++) {
+            double x = dist(engine), y = dist(engine), z = dist(engine);
+            rand_vec[i] = vec3d(x, y, z).normalize();
+        }
+        InitPermutation(permutation_x);
+        InitPermutation(permutation_y);
+        InitPermutation(permutation_z);
+        UpdateGradients();
     }
     ~PerlinNoise() noexcept {
         delete[] rand_vec;
         delete[] permutation_x;
         delete[] permutation_y;
         delete[] permutation_z;
+        delete[] gradients;
     }
-    double Turb(const point3d& p) const override {
+    // 逐个倍频、逐个角点用 double 计算的原始版本，作为 SSE 版本的参照
+    double TurbReference(const point3d& p) const {
         auto accum = 0.0;
         auto temp_p = p;
         auto weight = 1.0;
@@ -93,6 +126,39 @@ public:
 
         return fabs(accum);
     }
+    double Turb(const point3d& p) const override {
+#ifdef PERLIN_SSE
+        return TurbSSE(p);
+#else
+        return TurbReference(p);
+#endif
+    }
+};
+
+// 静态噪声在包围盒内预先采样成三维网格，查询时做三线性插值，盒外仍由原来的噪声计算
+// 网格比最高倍频粗时会抹掉细节，可用 NoiseBench 比较误差和速度
+class NoiseVolume final : public Noise {
+    std::shared_ptr<Noise> source;
+    point3d min_p, max_p;
+    int nx = 0, ny = 0, nz = 0;
+    vec3d inv_cell;
+    std::vector<float> samples;
+    friend class SceneCache;
+
+    NoiseVolume() = default;
+    void UpdateCell();
+public:
+    NoiseVolume(const std::shared_ptr<Noise>& source_, const point3d& p1, const point3d& p2, double cell_size);
+
+    // source 准备好后才能采样，采样按 z 切片分给 threads_num 个线程
+    void Build(int threads_num);
+    double Turb(const point3d& p) const override;
+
+    const std::shared_ptr<Noise>& GetSource() const { return source; }
+    size_t GetSamplesNum() const { return (size_t)nx * ny * nz; }
+    size_t GetMemorySize() const { return samples.size() * sizeof(float); }
+    void GetBounds(point3d& p1, point3d& p2) const { p1 = min_p, p2 = max_p; }
+    void GetResolution(int& x, int& y, int& z) const { x = nx, y = ny, z = nz; }
 };
 
 #endif
\ No newline at end of file
@@ -8,6 +8,8 @@ struct Ray
     point3d o; // 光源
     vec3d dir; // 方向
     double time;  // 时间
+    double cone_width = 0.;  // 光锥在起点处的宽度
+    double cone_spread = 0.; // 光锥每单位距离增加的宽度，用于选择纹理的 MIP 层级
     Ray() = default;
     Ray(const point3d& o_, const vec3d& dir_, const double t_ = 0.) noexcept : o(o_), dir(dir_), time(t_) {}
 
@@ -6,21 +6,26 @@
 #include "global.hpp"
 #include "noise.hpp"
 #include "PPMImage.hpp"
+#include "MipMap.hpp"
+#include "TextureCache.hpp"
 
 class Texture
 {
 public:
     Texture() = default;
     ~Texture() = default;
-    virtual Color GetTexture(const double u, const double v, const point3d&) const = 0;
+    // footprint 为交点处光锥在 UV 空间的宽度，只有图像纹理用它选择 MIP 层级，为 0 时取最精细的一层
+    virtual Color GetTexture(const double u, const double v, const point3d&, const double footprint) const = 0;
 };
 
 class SolidTexture : public Texture {
     Color texture_color;
+    friend class SceneCache;
+    friend class TextureProgram;
 public:
     SolidTexture(Color c = Color(0, 0, 0)) : texture_color(c) {}
 
-    Color GetTexture(const double u, const double v, const point3d&) const override {
+    Color GetTexture(const double u, const double v, const point3d&, const double) const override {
         return texture_color;
     }
 };
@@ -31,54 +36,87 @@ public:
 class CheckerTexture : public Texture {
     std::shared_ptr<Texture> odd;
     std::shared_ptr<Texture> even;
+    friend class SceneCache;
+    friend class TextureProgram;
 public:
     CheckerTexture(Color even_ = Color(0, 0, 0), Color odd_ = Color(1, 1, 1)) noexcept
     : even(std::make_shared<SolidTexture>(even_)), odd(std::make_shared<SolidTexture>(odd_)) {}
     CheckerTexture(std::shared_ptr<Texture> even_, std::shared_ptr<Texture> odd_) noexcept
     : even(even_), odd(odd_) {}
 
-    Color GetTexture(const double u, const double v, const point3d& p) const override {
+    // 交点落在哪一格，TextureProgram 与 GetTexture 共用
+    static bool IsOdd(const double u, const double v, const point3d& p) {
         #if defined(MAP_SPHERE_TO_CUBE)
-        auto sines = sin(p.x) * sin(p.y) * sin(p.z);
-        return sines < 0 ? odd->GetTexture(u, v, p) : even->GetTexture(u, v, p);
+        return sin(p.x) * sin(p.y) * sin(p.z) < 0;
         #elif defined(TEXTURE_WITH_UV)
         // double tu = u * 10;
         // double tv = v * 10;
         // tu = tu - (int)tu;
         // tv = tv - (int)tv;
-        // return (tu + tv < 0.5 || tu + tv > 1.5 || tv - tu > 0.5 || tv - tu < -0.5) ? odd->GetTexture(u, v, p) : even->GetTexture(u, v, p);
-        return sin(u) * sin(v) < 0 ? odd->GetTexture(u, v, p) : even->GetTexture(u, v, p);
+        // return tu + tv < 0.5 || tu + tv > 1.5 || tv - tu > 0.5 || tv - tu < -0.5;
+        return sin(u) * sin(v) < 0;
         #else 
-        auto sines = sin(p.x * 10) * sin(p.y * 10) * sin(p.z * 10);
-        return sines < 0 ? odd->GetTexture(u, v, p) : even->GetTexture(u, v, p);
+        return sin(p.x * 10) * sin(p.y * 10) * sin(p.z * 10) < 0;
         #endif
     }
+    Color GetTexture(const double u, const double v, const point3d& p, const double footprint) const override {
+        return IsOdd(u, v, p) ? odd->GetTexture(u, v, p, footprint) : even->GetTexture(u, v, p, footprint);
+    }
 };
 
 class NoiseTexture : public Texture {
     std::shared_ptr<Noise> noise;
     Color color;
     double scale;
+    friend class SceneCache;
+    friend class TextureProgram;
 public:
     NoiseTexture() = delete;
     NoiseTexture(std::shared_ptr<Noise> n, Color c = Color(1, 1, 1), double s = 1.) noexcept 
     : noise(n), color(c), scale(s) {}
-    Color GetTexture(const double u, const double v, const point3d& p) const override {
-        return color * 0.5 * (1 + sin(scale * p.z + 10. * noise->Turb(p)));
+    const std::shared_ptr<Noise>& GetNoise() const { return noise; }
+    void SetNoise(const std::shared_ptr<Noise>& n) { noise = n; }
+    static Color GetColor(const Color& color, const double scale, const point3d& p, const double turb) {
+        return color * 0.5 * (1 + sin(scale * p.z + 10. * turb));
+    }
+    Color GetTexture(const double u, const double v, const point3d& p, const double) const override {
+        return GetColor(color, scale, p, noise->Turb(p));
     }
 };
 
+// 图像解码后由 BuildMipMap 生成 MIP 金字塔，之后只保留紧凑的金字塔，原图随之释放
 class ImageTexture : public Texture {
     std::shared_ptr<PPMImage> image;
-    int h, w;
+    std::shared_ptr<MipMap> mipmap;
+    std::shared_ptr<TiledImage> tiled;
+    friend class SceneCache;
+    friend class TextureProgram;
 public:
     ImageTexture() = delete;
-    ImageTexture(std::shared_ptr<PPMImage>& i) noexcept : image(i) {
-        w = image->get_width();
-        h = image->get_height();
+    ImageTexture(std::shared_ptr<PPMImage>& i) noexcept : image(i) {}
+    ImageTexture(std::shared_ptr<MipMap> m) noexcept : mipmap(m) {}
+    ImageTexture(std::shared_ptr<TiledImage> t) noexcept : tiled(t) {}
+    void BuildMipMap() {
+        mipmap = std::make_shared<MipMap>(*image);
+        image = nullptr;
+    }
+    // 使用纹理缓存时只保留分块文件，分块文件有效则不再解码图像，生成分块文件失败时退回到内存中的 MIP 金字塔
+    void BuildTiled(const std::string& file_name, const std::shared_ptr<TextureCache>& cache, int threads_num = 0) {
+        tiled = TiledImage::Open(file_name, cache);
+        if (tiled != nullptr) {
+            image = nullptr;
+            return;
+        }
+        image->read_from_file(file_name, threads_num);
+        BuildMipMap();
+        tiled = TiledImage::Create(file_name, *mipmap, cache);
+        if (tiled != nullptr) mipmap = nullptr;
     }
-    Color GetTexture(const double u, const double v, const point3d& p) const override {
-        return image->get_color((1 - u) * w, v * h);
+    size_t GetMemorySize() const { return mipmap != nullptr ? mipmap->GetMemorySize() : 0; }
+    Color GetTexture(const double u, const double v, const point3d& p, const double footprint) const override {
+        if (tiled != nullptr) return tiled->Lookup(1 - u, v, footprint);
+        if (mipmap == nullptr) return Color();
+        return mipmap->Lookup(1 - u, v, footprint);
     }
 };
 
@@ -0,0 +1,312 @@
+﻿#include "Accelerator.hpp"
+#include "RenderThreadPool.hpp"
+#include <atomic>
+#include <cmath>
+#include <numeric>
+#include <thread>
+
+std::shared_ptr<Accelerator> CreateAccelerator(AcceleratorType type, const std::vector<std::shared_ptr<Hittable>>& objs,
+    double time0, double time1, int threads_num) {
+    if (type == AcceleratorType::BVH) return std::make_shared<BVHAccelerator>(objs, time0, time1);
+    if (type == AcceleratorType::Grid) return std::make_shared<GridAccelerator>(objs, time0, time1, threads_num);
+    if (type == AcceleratorType::LazyBVH) return std::make_shared<LazyBVHAccelerator>(objs, time0, time1);
+    return std::make_shared<ListAccelerator>(objs);
+}
+
+#pragma region List
+bool ListAccelerator::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
+    bool hit_flag = false;
+    for (auto& obj : objs) {
+        if (obj->hit(ray, t_min, t_max, ret)) {
+            t_max = ret.t;
+            hit_flag = true;
+        }
+    }
+    return hit_flag;
+}
+#pragma endregion List
+
+#pragma region BVH
+BVHAccelerator::BVHAccelerator(const std::vector<std::shared_ptr<Hittable>>& objs, double time0, double time1) {
+    std::vector<std::shared_ptr<Hittable>> static_objs, dynamic_objs;
+    for (auto& obj : objs) {
+        if (obj->IsDynamic()) dynamic_objs.push_back(obj);
+        else static_objs.push_back(obj);
+    }
+    if (!static_objs.empty()) static_bvh = std::make_shared<BVH_Node>(static_objs, 0, static_objs.size(), 0, 1);
+    if (!dynamic_objs.empty()) dynamic_bvh = std::make_shared<BVH_Node>(dynamic_objs, 0, dynamic_objs.size(), time0, time1);
+}
+
+bool BVHAccelerator::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
+    bool hit_flag = false;
+    if (static_bvh != nullptr && static_bvh->hit(ray, t_min, t_max, ret)) {
+        t_max = ret.t;
+        hit_flag = true;
+    }
+    if (dynamic_bvh != nullptr && dynamic_bvh->hit(ray, t_min, t_max, ret)) hit_flag = true;
+    return hit_flag;
+}
+
+void BVHAccelerator::Update(double time0, double time1, int threads_num) {
+    if (dynamic_bvh != nullptr) dynamic_bvh->ParallelRefit(time0, time1, threads_num);
+}
+#pragma endregion BVH
+
+#pragma region Grid
+GridAccelerator::GridAccelerator(const std::vector<std::shared_ptr<Hittable>>& objs_, double time0, double time1, int threads_num)
+: objs(objs_) {
+    Build(time0, time1, threads_num);
+}
+
+// 先并行统计每个格子的物体数，前缀和得到各格子的起始位置后再并行填入物体下标
+void GridAccelerator::Build(double time0, double time1, int threads_num) {
+    int n = (int)objs.size();
+    cell_start.clear();
+    cell_objs.clear();
+    if (n == 0) return;
+
+    std::vector<AABB> boxes(n);
+    for (int i = 0; i < n; i++) objs[i]->bounding_box(time0, time1, boxes[i]);
+    double inf = std::numeric_limits<double>::infinity();
+    grid_min = point3d(inf, inf, inf);
+    grid_max = point3d(-inf, -inf, -inf);
+    for (auto& box : boxes) {
+        auto bmin = box.get_min_point();
+        auto bmax = box.get_max_point();
+        grid_min = point3d(std::min(grid_min.x, bmin.x), std::min(grid_min.y, bmin.y), std::min(grid_min.z, bmin.z));
+        grid_max = point3d(std::max(grid_max.x, bmax.x), std::max(grid_max.y, bmax.y), std::max(grid_max.z, bmax.z));
+    }
+
+    // 格子数约为物体数的 CELLS_PER_OBJECT 倍，各轴分辨率与边长成正比
+    vec3d extent = grid_max - grid_min;
+    double max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+    for (int i = 0; i < 3; i++) extent[i] = std::max(extent[i], max_extent * 1e-3 + EPS);
+    grid_max = grid_min + extent;
+    double k = std::cbrt(CELLS_PER_OBJECT * n / (extent.x * extent.y * extent.z));
+    for (int i = 0; i < 3; i++) {
+        res[i] = std::max(1, std::min(MAX_RESOLUTION, (int)std::round(extent[i] * k)));
+        cell_size[i] = extent[i] / res[i];
+    }
+    int cells_num = res[0] * res[1] * res[2];
+
+    auto get_cell_range = [this](const AABB& box, int lo[3], int hi[3]) {
+        auto bmin = box.get_min_point();
+        auto bmax = box.get_max_point();
+        for (int i = 0; i < 3; i++) {
+            lo[i] = std::max(0, std::min(res[i] - 1, (int)((bmin[i] - grid_min[i]) / cell_size[i])));
+            hi[i] = std::max(0, std::min(res[i] - 1, (int)((bmax[i] - grid_min[i]) / cell_size[i])));
+        }
+    };
+
+    std::unique_ptr<std::atomic<int>[]> counts(new std::atomic<int>[cells_num]());
+    int chunk = std::max(1024, n / (threads_num * 4) + 1);
+    auto parallel_for_objects = [&](std::function<void(int)> f) {
+        RenderThreadPool pool(threads_num);
+        for (int from = 0; from < n; from += chunk) {
+            pool.AddTask([&f](RenderTaskParam param) {
+                for (int i = param.from; i < param.to; i++) f(i);
+            }, { from, std::min(n, from + chunk) });
+        }
+        pool.Dispatch();
+        pool.WaitForTaskEnding();
+    };
+
+    parallel_for_objects([&](int i) {
+        int lo[3], hi[3];
+        get_cell_range(boxes[i], lo, hi);
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    counts[(z * res[1] + y) * res[0] + x].fetch_add(1, std::memory_order_relaxed);
+    });
+
+    cell_start.resize(cells_num + 1);
+    cell_start[0] = 0;
+    for (int c = 0; c < cells_num; c++) {
+        cell_start[c + 1] = cell_start[c] + counts[c].load(std::memory_order_relaxed);
+        counts[c].store(cell_start[c], std::memory_order_relaxed);
+    }
+    cell_objs.resize(cell_start[cells_num]);
+
+    parallel_for_objects([&](int i) {
+        int lo[3], hi[3];
+        get_cell_range(boxes[i], lo, hi);
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    cell_objs[counts[(z * res[1] + y) * res[0] + x].fetch_add(1, std::memory_order_relaxed)] = i;
+    });
+}
+
+bool GridAccelerator::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
+    if (cell_start.empty()) return false;
+
+    // 光线进入和离开整个网格的 t
+    double o[3] = { ray.o.x, ray.o.y, ray.o.z };
+    double d[3] = { ray.dir.x, ray.dir.y, ray.dir.z };
+    double t_enter = t_min, t_exit = t_max;
+    for (int i = 0; i < 3; i++) {
+        double inv = 1. / d[i];
+        double t0 = (grid_min[i] - o[i]) * inv;
+        double t1 = (grid_max[i] - o[i]) * inv;
+        if (t0 > t1) std::swap(t0, t1);
+        if (t0 > t_enter) t_enter = t0;
+        if (t1 < t_exit) t_exit = t1;
+        if (t_enter > t_exit) return false;
+    }
+
+    int cell[3], step[3], out[3];
+    double next_t[3], delta_t[3];
+    for (int i = 0; i < 3; i++) {
+        double p = o[i] + d[i] * t_enter;
+        cell[i] = std::max(0, std::min(res[i] - 1, (int)((p - grid_min[i]) / cell_size[i])));
+        if (d[i] > 0.) {
+            step[i] = 1, out[i] = res[i];
+            next_t[i] = (grid_min[i] + (cell[i] + 1) * cell_size[i] - o[i]) / d[i];
+            delta_t[i] = cell_size[i] / d[i];
+        }
+        else if (d[i] < 0.) {
+            step[i] = -1, out[i] = -1;
+            next_t[i] = (grid_min[i] + cell[i] * cell_size[i] - o[i]) / d[i];
+            delta_t[i] = -cell_size[i] / d[i];
+        }
+        else {
+            step[i] = 0, out[i] = -1;
+            next_t[i] = std::numeric_limits<double>::infinity();
+            delta_t[i] = 0.;
+        }
+    }
+
+    bool hit_flag = false;
+    while (true) {
+        int c = (cell[2] * res[1] + cell[1]) * res[0] + cell[0];
+        for (int k = cell_start[c]; k < cell_start[c + 1]; k++) {
+            if (objs[cell_objs[k]]->hit(ray, t_min, t_max, ret)) {
+                t_max = ret.t;
+                hit_flag = true;
+            }
+        }
+        int axis = next_t[0] < next_t[1] ? (next_t[0] < next_t[2] ? 0 : 2) : (next_t[1] < next_t[2] ? 1 : 2);
+        // 跨格子的物体可能在后面的格子里被击中，只有交点在当前格子内时才能提前结束
+        if (next_t[axis] > t_max || next_t[axis] > t_exit) return hit_flag;
+        cell[axis] += step[axis];
+        if (cell[axis] == out[axis]) return hit_flag;
+        next_t[axis] += delta_t[axis];
+    }
+}
+#pragma endregion Grid
+
+#pragma region LazyBVH
+LazyBVHAccelerator::LazyBVHAccelerator(const std::vector<std::shared_ptr<Hittable>>& objs_, double time0, double time1)
+: objs(objs_), nodes_num(0) {
+    Build(time0, time1);
+}
+
+// 只计算每个物体的包围盒和根节点，时间与物体数成线性
+void LazyBVHAccelerator::Build(double time0, double time1) {
+    int n = (int)objs.size();
+    boxes.resize(n);
+    centroids.resize(n);
+    for (int i = 0; i < n; i++) {
+        objs[i]->bounding_box(time0, time1, boxes[i]);
+        centroids[i] = (boxes[i].get_min_point() + boxes[i].get_max_point()) * 0.5;
+    }
+    indices.resize(n);
+    std::iota(indices.begin(), indices.end(), 0);
+    nodes.reset(new Node[std::max(1, 2 * n)]);
+    nodes_num.store(n > 0 ? 1 : 0, std::memory_order_relaxed);
+    if (n > 0) InitNode(nodes[0], 0, n);
+}
+
+void LazyBVHAccelerator::InitNode(Node& node, int start, int end) {
+    double inf = std::numeric_limits<double>::infinity();
+    node.bmin = point3d(inf, inf, inf);
+    node.bmax = point3d(-inf, -inf, -inf);
+    for (int i = start; i < end; i++) {
+        auto bmin = boxes[indices[i]].get_min_point();
+        auto bmax = boxes[indices[i]].get_max_point();
+        node.bmin = point3d(std::min(node.bmin.x, bmin.x), std::min(node.bmin.y, bmin.y), std::min(node.bmin.z, bmin.z));
+        node.bmax = point3d(std::max(node.bmax.x, bmax.x), std::max(node.bmax.y, bmax.y), std::max(node.bmax.z, bmax.z));
+    }
+    node.start = start;
+    node.end = end;
+    node.left = -1;
+    node.state.store(end - start <= MAX_LEAF_SIZE ? Leaf : Unexpanded, std::memory_order_relaxed);
+}
+
+// 按质心包围盒最长轴的中位数划分，子节点写好后再以 release 发布状态
+void LazyBVHAccelerator::Expand(Node& node) {
+    int expected = Unexpanded;
+    if (node.state.compare_exchange_strong(expected, Expanding, std::memory_order_acquire)) {
+        double inf = std::numeric_limits<double>::infinity();
+        point3d cmin(inf, inf, inf), cmax(-inf, -inf, -inf);
+        for (int i = node.start; i < node.end; i++) {
+            auto& c = centroids[indices[i]];
+            cmin = point3d(std::min(cmin.x, c.x), std::min(cmin.y, c.y), std::min(cmin.z, c.z));
+            cmax = point3d(std::max(cmax.x, c.x), std::max(cmax.y, c.y), std::max(cmax.z, c.z));
+        }
+        vec3d extent = cmax - cmin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        int mid = (node.start + node.end) / 2;
+        std::nth_element(indices.begin() + node.start, indices.begin() + mid, indices.begin() + node.end,
+            [this, axis](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+        int left = nodes_num.fetch_add(2, std::memory_order_relaxed);
+        InitNode(nodes[left], node.start, mid);
+        InitNode(nodes[left + 1], mid, node.end);
+        node.left = left;
+        node.state.store(Interior, std::memory_order_release);
+        return;
+    }
+    while (node.state.load(std::memory_order_acquire) == Expanding) std::this_thread::yield();
+}
+
+bool LazyBVHAccelerator::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
+    if (nodes_num.load(std::memory_order_relaxed) == 0) return false;
+    double o[3] = { ray.o.x, ray.o.y, ray.o.z };
+    double inv_dir[3] = { 1. / ray.dir.x, 1. / ray.dir.y, 1. / ray.dir.z };
+    auto box_hit = [&](const Node& node, double t_max) {
+        double t_in = t_min, t_out = t_max;
+        double bmin[3] = { node.bmin.x, node.bmin.y, node.bmin.z };
+        double bmax[3] = { node.bmax.x, node.bmax.y, node.bmax.z };
+        for (int i = 0; i < 3; i++) {
+            double t0 = (bmin[i] - o[i]) * inv_dir[i];
+            double t1 = (bmax[i] - o[i]) * inv_dir[i];
+            if (t0 > t1) std::swap(t0, t1);
+            if (t0 > t_in) t_in = t0;
+            if (t1 < t_out) t_out = t1;
+            if (t_in > t_out) return false;
+        }
+        return true;
+    };
+
+    int stack[128];
+    int sp = 0;
+    stack[sp++] = 0;
+    bool hit_flag = false;
+    while (sp > 0) {
+        Node& node = nodes[stack[--sp]];
+        STATS_ADD(bvh_nodes, 1);
+        STATS_ADD(box_tests, 1);
+        if (!box_hit(node, t_max)) continue;
+        int state = node.state.load(std::memory_order_acquire);
+        if (state != Interior && state != Leaf) {
+            Expand(node);
+            state = Interior;
+        }
+        if (state == Leaf) {
+            for (int i = node.start; i < node.end; i++) {
+                if (objs[indices[i]]->hit(ray, t_min, t_max, ret)) {
+                    t_max = ret.t;
+                    hit_flag = true;
+                }
+            }
+        }
+        else {
+            stack[sp++] = node.left + 1;
+            stack[sp++] = node.left;
+        }
+    }
+    return hit_flag;
+}
+#pragma endregion LazyBVH
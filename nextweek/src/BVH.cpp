@@ -1,5 +1,6 @@
 ﻿#include "BVH.hpp"
 #include "hittable.hpp"
+#include "RenderThreadPool.hpp"
 
 AABB::AABB(const point3d& a, const point3d& b) noexcept {
     // 保证所有 max_point - min_point 向量的方向夹角是锐角，以确保 BVH 构建时排序的正确性
@@ -21,6 +22,7 @@ point3d AABB::get_min_point() const { return min_point; }
 point3d AABB::get_max_point() const { return max_point; }
 
 bool AABB::hit(const Ray& r, double in_t, double out_t) const {
+    STATS_ADD(box_tests, 1);
     for (int i = 0; i < 3; i++) {
         double invD = 1. / r.dir[i];
         double t0 = (min_point[i] - r.o[i]) * invD;
@@ -43,8 +45,47 @@ AABB AABB::surrounding_box(const AABB& box1, const AABB& box2) {
     return AABB(bmin, bmax);
 }
 
+// 两个线性运动的包围盒之间插值，得到的盒子总能包住该时刻的物体
+AABB AABB::lerp(const AABB& box1, const AABB& box2, double t) {
+    return AABB(box1.min_point + (box2.min_point - box1.min_point) * t, box1.max_point + (box2.max_point - box1.max_point) * t);
+}
+
+// 与 hit 相同，但 slab 的边界按 t 在两个盒子之间插值，不构造中间的 AABB
+bool AABB::hit_lerp(const AABB& box1, const AABB& box2, double t, const Ray& r, double in_t, double out_t) {
+    STATS_ADD(box_tests, 1);
+    const point3d& min1 = box1.min_point;
+    const point3d& max1 = box1.max_point;
+    const point3d& min2 = box2.min_point;
+    const point3d& max2 = box2.max_point;
+    double o[3] = { r.o.x, r.o.y, r.o.z };
+    double d[3] = { r.dir.x, r.dir.y, r.dir.z };
+    double bmin[3] = { min1.x + (min2.x - min1.x) * t, min1.y + (min2.y - min1.y) * t, min1.z + (min2.z - min1.z) * t };
+    double bmax[3] = { max1.x + (max2.x - max1.x) * t, max1.y + (max2.y - max1.y) * t, max1.z + (max2.z - max1.z) * t };
+    for (int i = 0; i < 3; i++) {
+        double invD = 1. / d[i];
+        double t0 = (bmin[i] - o[i]) * invD;
+        double t1 = (bmax[i] - o[i]) * invD;
+        if (t0 > t1) std::swap(t0, t1);
+        if (in_t < t0) in_t = t0;
+        if (out_t > t1) out_t = t1;
+        if (in_t >= out_t) return false;
+    }
+    return true;
+}
+
 bool BVH_Node::scatter(Ray& ray_out, const hit_info& hit) const { return false; }
-bool BVH_Node::bounding_box(const double, const double, AABB& output_box) const { output_box = box; return true; }
+bool BVH_Node::bounding_box(const double t0, const double t1, AABB& output_box) const {
+    output_box = is_dynamic ? AABB::surrounding_box(GetBox(t0), GetBox(t1)) : box;
+    return true;
+}
+
+double BVH_Node::GetLerpFactor(double time) const {
+    if (time1 <= time0) return 0.;
+    double t = (time - time0) / (time1 - time0);
+    return t < 0. ? 0. : (t > 1. ? 1. : t);
+}
+
+AABB BVH_Node::GetBox(double time) const { return AABB::lerp(box0, box1, GetLerpFactor(time)); }
 
 bool BVH_Node::bbcmp(const std::shared_ptr<Hittable>& a, const std::shared_ptr<Hittable>& b, size_t axis) {
     AABB b1, b2;
@@ -53,7 +94,8 @@ bool BVH_Node::bbcmp(const std::shared_ptr<Hittable>& a, const std::shared_ptr<H
 }
 
 bool BVH_Node::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
-    if (!box.hit(ray, t_min, t_max)) return false;
+    STATS_ADD(bvh_nodes, 1);
+    if (is_dynamic ? !AABB::hit_lerp(box0, box1, GetLerpFactor(ray.time), ray, t_min, t_max) : !box.hit(ray, t_min, t_max)) return false;
     bool hit_left = left->hit(ray, t_min, t_max, ret);
     bool hit_right = right->hit(ray, t_min, hit_left && ret.t < t_max ? ret.t : t_max, ret);
 
@@ -89,4 +131,54 @@ BVH_Node::BVH_Node(const std::vector<std::shared_ptr<Hittable>>& src_objects, si
         std::cerr << "No bounding box in bvh_node constructor.\n";
 
     box = AABB::surrounding_box(box_left, box_right);
-}
\ No newline at end of file
+    is_dynamic = left->IsDynamic() || right->IsDynamic();
+    if (is_dynamic) UpdateBox(time0, time1);
+}
+
+void BVH_Node::UpdateBox(double time0_, double time1_) {
+    AABB box_left, box_right;
+    time0 = time0_;
+    time1 = time1_;
+    left->bounding_box(time0, time0, box_left);
+    right->bounding_box(time0, time0, box_right);
+    box0 = AABB::surrounding_box(box_left, box_right);
+    left->bounding_box(time1, time1, box_left);
+    right->bounding_box(time1, time1, box_right);
+    box1 = AABB::surrounding_box(box_left, box_right);
+    box = AABB::surrounding_box(box0, box1);
+}
+
+// 只进入含动态物体的子树，自底向上重算包围盒，树的结构不变
+// 子节点也可能是实例，经由它进入原型的 BVH；多个实例共享的原型已是这个区间时不再重复计算
+void BVH_Node::Refit(double time0_, double time1_) {
+    if (!is_dynamic || (time0 == time0_ && time1 == time1_)) return;
+    left->Refit(time0_, time1_);
+    if (right != left) right->Refit(time0_, time1_);
+    UpdateBox(time0_, time1_);
+}
+
+// 按层序收集上面几层节点，其下的子树交给线程池各自 Refit，最后倒序更新收集到的上层节点
+void BVH_Node::ParallelRefit(double time0, double time1, int threads_num) {
+    if (!is_dynamic) return;
+    std::vector<BVH_Node*> top{ this };
+    std::vector<BVH_Node*> subtrees;
+    for (size_t i = 0; i < top.size(); i++) {
+        for (auto child : { top[i]->left, top[i]->right }) {
+            auto node = dynamic_cast<BVH_Node*>(child.get());
+            if (node == nullptr || !node->is_dynamic || (child == top[i]->right && top[i]->right == top[i]->left)) continue;
+            if (top.size() < (size_t)threads_num * 2) top.push_back(node);
+            else subtrees.push_back(node);
+        }
+    }
+
+    RenderThreadPool pool(threads_num);
+    for (int i = 0; i < (int)subtrees.size(); i++) {
+        pool.AddTask([&subtrees, time0, time1](RenderTaskParam param) {
+            subtrees[param.from]->Refit(time0, time1);
+        }, { i, i + 1 });
+    }
+    pool.Dispatch();
+    pool.WaitForTaskEnding();
+
+    for (auto it = top.rbegin(); it != top.rend(); ++it) (*it)->UpdateBox(time0, time1);
+}
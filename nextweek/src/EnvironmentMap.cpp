@@ -0,0 +1,114 @@
+﻿#include "EnvironmentMap.hpp"
+#include "RenderThreadPool.hpp"
+#include "global.hpp"
+
+void AliasTable::Build(const double* weights, int n) {
+    prob.assign(n, 0.f);
+    alias.assign(n, 0);
+    double sum = 0.;
+    for (int i = 0; i < n; i++) sum += weights[i];
+    if (sum <= 0.) {
+        for (int i = 0; i < n; i++) prob[i] = 1.f, alias[i] = i;
+        return;
+    }
+
+    std::vector<double> p(n);
+    std::vector<int> small, large;
+    for (int i = 0; i < n; i++) {
+        p[i] = weights[i] * n / sum;
+        (p[i] < 1. ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        int s = small.back(); small.pop_back();
+        int l = large.back();
+        prob[s] = (float)p[s];
+        alias[s] = l;
+        p[l] = p[l] + p[s] - 1.;
+        if (p[l] < 1.) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // 剩下的都是浮点误差导致的接近 1 的项
+    for (int i : large) prob[i] = 1.f, alias[i] = i;
+    for (int i : small) prob[i] = 1.f, alias[i] = i;
+}
+
+int AliasTable::Sample(double u1, double u2) const {
+    int n = (int)prob.size();
+    int i = std::min((int)(u1 * n), n - 1);
+    return u2 < prob[i] ? i : alias[i];
+}
+
+EnvironmentMap::EnvironmentMap(std::shared_ptr<PPMImage> image_, double scale_, int threads_num)
+: image(image_), scale(scale_), total_weight(0.) {
+    w = image->get_width();
+    h = image->get_height();
+    row_weights.assign(h, 0.);
+    rows.resize(h);
+
+    DWORD t1 = GetTickCount();
+    // 每一行的别名表相互独立，按行分块交给线程池
+    RenderThreadPool pool(threads_num);
+    int step = std::max(1, h / (threads_num * 4));
+    for (int from = 0; from < h; from += step) {
+        pool.AddTask([this](RenderTaskParam param) {
+            std::vector<double> weights(w);
+            for (int y = param.from; y < param.to; y++) {
+                double sum = 0.;
+                for (int x = 0; x < w; x++) sum += weights[x] = GetWeight(x, y);
+                row_weights[y] = sum;
+                rows[y].Build(weights.data(), w);
+            }
+        }, { from, std::min(from + step, h) });
+    }
+    pool.Dispatch();
+    pool.WaitForTaskEnding();
+
+    for (int y = 0; y < h; y++) total_weight += row_weights[y];
+    marginal.Build(row_weights.data(), h);
+    DWORD t2 = GetTickCount();
+    std::cout << "environment map " << w << "x" << h << " sampling table: " << ((t2 - t1) * 1.0 / 1000) << "s\n";
+}
+
+double EnvironmentMap::GetWeight(int x, int y) const {
+    auto c = image->get_color(x, y);
+    double sin_theta = std::sin((y + 0.5) / h * PI);
+    return std::max(0., 0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b) * sin_theta;
+}
+
+// 与 Sphere::GetUV 的映射一致：v = theta / PI，u = (phi + PI) / (2 * PI)
+vec3d EnvironmentMap::GetDirection(double u, double v) const {
+    double theta = v * PI;
+    double phi = u * 2. * PI - PI;
+    return vec3d(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+}
+
+Color EnvironmentMap::Lookup(const vec3d& dir) const {
+    double theta = std::acos(std::min(1., std::max(-1., dir.y)));
+    double phi = std::atan2(dir.z, dir.x) + PI;
+    int x = std::min((int)(phi / (2. * PI) * w), w - 1);
+    int y = std::min((int)(theta / PI * h), h - 1);
+    return image->get_color(x, y) * scale;
+}
+
+Color EnvironmentMap::Sample(vec3d& dir, double& pdf) const {
+    if (total_weight <= 0.) {
+        pdf = 0.;
+        return Color();
+    }
+    int y = marginal.Sample(get_random(), get_random());
+    int x = rows[y].Sample(get_random(), get_random());
+    double u = (x + get_random()) / w;
+    double v = (y + get_random()) / h;
+    dir = GetDirection(u, v);
+
+    // 像素内在 (u, v) 上均匀分布，dω = 2 * PI^2 * sin(theta) du dv
+    double sin_theta = std::sin(v * PI);
+    if (sin_theta <= 0.) {
+        pdf = 0.;
+        return Color();
+    }
+    pdf = GetWeight(x, y) / total_weight * w * h / (2. * PI * PI * sin_theta);
+    return image->get_color(x, y) * scale;
+}
@@ -0,0 +1,81 @@
+﻿#include "IrradianceCache.hpp"
+#include <cmath>
+
+IrradianceCache::IrradianceCache(int samples_, double a_, double min_r_, double max_r_) noexcept
+: a(a_), min_r(min_r_), max_r(max_r_), records_num(0), samples(samples_) {
+    if (max_r < min_r) std::swap(min_r, max_r);
+    cell_size = a * max_r;
+    buckets = new std::atomic<IrradianceRecord*>[BUCKET_CNT];
+    for (size_t i = 0; i < BUCKET_CNT; i++) buckets[i].store(nullptr, std::memory_order_relaxed);
+}
+
+IrradianceCache::~IrradianceCache() noexcept {
+    Clear();
+    delete[] buckets;
+}
+
+// 场景变化后旧记录失效，只能在没有线程查询时调用
+void IrradianceCache::Clear() {
+    for (size_t i = 0; i < BUCKET_CNT; i++) {
+        auto record = buckets[i].exchange(nullptr, std::memory_order_relaxed);
+        while (record != nullptr) {
+            auto next = record->next;
+            delete record;
+            record = next;
+        }
+    }
+    records_num.store(0, std::memory_order_relaxed);
+}
+
+vec3i IrradianceCache::GetCell(const point3d& p) const {
+    return vec3i(static_cast<int>(std::floor(p.x / cell_size)),
+                 static_cast<int>(std::floor(p.y / cell_size)),
+                 static_cast<int>(std::floor(p.z / cell_size)));
+}
+
+size_t IrradianceCache::Hash(const vec3i& cell) {
+    size_t h = static_cast<size_t>(cell.x) * 73856093u
+             ^ static_cast<size_t>(cell.y) * 19349663u
+             ^ static_cast<size_t>(cell.z) * 83492791u;
+    return h & (BUCKET_CNT - 1);
+}
+
+// 对周围 27 个网格中的记录按 Ward 的误差估计加权插值
+// w_i = 1 / (|p - p_i| / R_i + sqrt(1 - n·n_i))，只使用 w_i > 1/a 的记录
+bool IrradianceCache::Lookup(const point3d& p, const vec3d& n, Color& e) const {
+    auto cell = GetCell(p);
+    Color sum;
+    double weight_sum = 0.;
+    for (int dx = -1; dx <= 1; dx++)
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dz = -1; dz <= 1; dz++) {
+                auto record = buckets[Hash(vec3i(cell.x + dx, cell.y + dy, cell.z + dz))].load(std::memory_order_acquire);
+                for (; record != nullptr; record = record->next) {
+                    double n_dot = dot(n, record->n);
+                    if (n_dot <= 0.) continue;
+                    vec3d d = p - record->p;
+                    double dist = d.length();
+                    if (dist > a * record->r) continue;
+                    // 记录位于 p 的前方时，两者之间可能存在遮挡，不能使用
+                    if (dot(d, n + record->n) < -0.02 * record->r) continue;
+                    double err = dist / record->r + std::sqrt(std::max(0., 1. - n_dot));
+                    if (err >= a) continue;
+                    double w = err < EPS ? 1. / EPS : 1. / err;
+                    sum = sum + record->e * w;
+                    weight_sum += w;
+                }
+            }
+    if (weight_sum <= 0.) return false;
+    e = sum / weight_sum;
+    return true;
+}
+
+void IrradianceCache::Insert(const point3d& p, const vec3d& n, const Color& e, double r) {
+    auto record = new IrradianceRecord{ p, n, e, std::min(std::max(r, min_r), max_r), nullptr };
+    auto& head = buckets[Hash(GetCell(p))];
+    record->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(record->next, record, std::memory_order_release, std::memory_order_relaxed));
+    records_num.fetch_add(1, std::memory_order_relaxed);
+}
+
+int IrradianceCache::GetRecordsNum() const { return records_num.load(std::memory_order_relaxed); }
@@ -0,0 +1,144 @@
+﻿#include "LightBVH.hpp"
+#include "global.hpp"
+
+static double luminance(const Color& c) { return 0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b; }
+
+static double angle_between(const vec3d& a, const vec3d& b) {
+    return std::acos(std::min(1., std::max(-1., dot(a, b))));
+}
+
+LightBVH::LightBVH(const std::vector<std::shared_ptr<Hittable>>& objs, double time0, double time1) {
+    std::vector<Node> leaves;
+    for (auto& obj : objs) {
+        if (!dynamic_cast<DiffuseLight*>(obj->get_material().get())) continue;
+        AABB box;
+        if (obj->GetArea() <= 0. || !obj->bounding_box(time0, time1, box)) continue;
+
+        auto c = (box.get_min_point() + box.get_max_point()) * 0.5;
+        double u, v;
+        obj->GetUV(u, v, c);
+        double power = luminance(obj->get_material_emitted(u, v, c)) * obj->GetArea() * PI;
+        if (power <= 0.) continue;
+
+        // 球面和双面发光的矩形向所有方向发光
+        LightCone cone{ vec3d(0, 1, 0), PI, PI / 2 };
+        leaves.push_back(Node{ box, cone, power, -1, -1, (int)lights.size() });
+        lights.push_back(obj);
+        light_set.insert(obj.get());
+    }
+    if (!leaves.empty()) {
+        nodes.reserve(leaves.size() * 2);
+        Build(leaves, 0, (int)leaves.size());
+    }
+}
+
+LightBVH::LightCone LightBVH::MergeCone(const LightCone& a_, const LightCone& b_) {
+    const LightCone& a = a_.theta_o >= b_.theta_o ? a_ : b_;
+    const LightCone& b = a_.theta_o >= b_.theta_o ? b_ : a_;
+    double theta_d = angle_between(a.w, b.w);
+    double theta_e = std::max(a.theta_e, b.theta_e);
+    if (std::min(theta_d + b.theta_o, PI) <= a.theta_o) return LightCone{ a.w, a.theta_o, theta_e };
+
+    double theta_o = (a.theta_o + theta_d + b.theta_o) / 2;
+    vec3d ortho = b.w - a.w * std::cos(theta_d);
+    if (theta_o >= PI || ortho.length2() < EPS) return LightCone{ a.w, PI, theta_e };
+
+    // 将 a 的轴向 b 旋转 theta_o - a.theta_o
+    double theta_r = theta_o - a.theta_o;
+    vec3d w = a.w * std::cos(theta_r) + ortho.normalize() * std::sin(theta_r);
+    return LightCone{ w.normalize(), theta_o, theta_e };
+}
+
+// 按质心最长轴的中位数划分，返回子树根节点下标
+int LightBVH::Build(std::vector<Node>& leaves, int start, int end) {
+    if (end - start == 1) {
+        nodes.push_back(leaves[start]);
+        return (int)nodes.size() - 1;
+    }
+
+    auto centroid = [](const Node& node) { return (node.box.get_min_point() + node.box.get_max_point()) * 0.5; };
+    auto cmin = centroid(leaves[start]), cmax = cmin;
+    for (int i = start + 1; i < end; i++) {
+        auto c = centroid(leaves[i]);
+        cmin = point3d(std::min(cmin.x, c.x), std::min(cmin.y, c.y), std::min(cmin.z, c.z));
+        cmax = point3d(std::max(cmax.x, c.x), std::max(cmax.y, c.y), std::max(cmax.z, c.z));
+    }
+    auto extent = cmax - cmin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int mid = (start + end) / 2;
+    std::nth_element(leaves.begin() + start, leaves.begin() + mid, leaves.begin() + end,
+        [axis, &centroid](const Node& a, const Node& b) { return centroid(a)[axis] < centroid(b)[axis]; });
+
+    int index = (int)nodes.size();
+    nodes.emplace_back();
+    int left = Build(leaves, start, mid);
+    int right = Build(leaves, mid, end);
+
+    auto& l = nodes[left];
+    auto& r = nodes[right];
+    nodes[index] = Node{ AABB::surrounding_box(l.box, r.box), MergeCone(l.cone, r.cone), l.power + r.power, left, right, -1 };
+    return index;
+}
+
+// 重要性 = 功率 * 发光方向项 * 接收点法线项 / 距离平方，两个角度项都按包围球张角放宽，保证是上界
+double LightBVH::Importance(const Node& node, const point3d& p, const vec3d& n) const {
+    auto pmin = node.box.get_min_point();
+    auto pmax = node.box.get_max_point();
+    auto c = (pmin + pmax) * 0.5;
+    double r2 = (pmax - pmin).length2() * 0.25;
+    vec3d d = c - p;
+    double dist2 = d.length2();
+    // 着色点在包围球内时无法界定角度
+    if (dist2 <= r2) return node.power / std::max(r2, EPS);
+
+    double dist = std::sqrt(dist2);
+    vec3d to_light = d / dist;
+    double theta_u = std::asin(std::sqrt(r2) / dist);
+
+    double theta_i = std::max(0., angle_between(n, to_light) - theta_u);
+    if (theta_i >= PI / 2) return 0.;
+
+    double theta = std::max(0., angle_between(node.cone.w, vec3d() - to_light) - node.cone.theta_o - theta_u);
+    if (theta >= node.cone.theta_e) return 0.;
+
+    return node.power * std::cos(theta) * std::cos(theta_i) / dist2;
+}
+
+int LightBVH::GetLightsNum() const { return (int)lights.size(); }
+
+bool LightBVH::IsSampledLight(const Hittable* obj) const { return light_set.count(obj) > 0; }
+
+// 场景中没有可采样的光源时返回空指针，pmf 为 0
+static const std::shared_ptr<Hittable> no_light;
+
+const std::shared_ptr<Hittable>& LightBVH::Sample(const point3d& p, const vec3d& n, double& pmf) const {
+    if (nodes.empty()) {
+        pmf = 0.;
+        return no_light;
+    }
+    int index = 0;
+    pmf = 1.;
+    while (nodes[index].light < 0) {
+        auto& node = nodes[index];
+        double il = Importance(nodes[node.left], p, n);
+        double ir = Importance(nodes[node.right], p, n);
+        if (il + ir <= 0.) {
+            // 两侧都不可能照亮该点时退化为按功率选择
+            il = nodes[node.left].power;
+            ir = nodes[node.right].power;
+        }
+        double pl = il + ir > 0. ? il / (il + ir) : 0.5;
+        if (get_random() < pl) index = node.left, pmf *= pl;
+        else index = node.right, pmf *= 1. - pl;
+    }
+    return lights[nodes[index].light];
+}
+
+const std::shared_ptr<Hittable>& LightBVH::SampleUniform(double& pmf) const {
+    if (lights.empty()) {
+        pmf = 0.;
+        return no_light;
+    }
+    pmf = 1. / lights.size();
+    return lights[std::min((int)(get_random() * lights.size()), (int)lights.size() - 1)];
+}
@@ -0,0 +1,43 @@
+#include "MappedFile.hpp"
+
+MappedFile::MappedFile() noexcept : file(INVALID_HANDLE_VALUE), mapping(NULL), data(nullptr), size(0) {}
+MappedFile::~MappedFile() noexcept { Close(); }
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        Close();
+        return false;
+    }
+    size = (size_t)file_size.QuadPart;
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        Close();
+        return false;
+    }
+    data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data != nullptr) UnmapViewOfFile(data);
+    if (mapping != NULL) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+    data = nullptr;
+    size = 0;
+}
+
+bool MappedFile::IsOpen() const { return data != nullptr; }
+const char* MappedFile::GetData() const { return data; }
+size_t MappedFile::GetSize() const { return size; }
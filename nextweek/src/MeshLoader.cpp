@@ -0,0 +1,473 @@
+﻿#include "mesh.hpp"
+#include "MappedFile.hpp"
+#include "RenderThreadPool.hpp"
+#include "project_path.hpp"
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#pragma region OBJ
+// 一个分块的解析结果，负数（相对）索引先按块内计数解析，合并时再加上之前各块的数量
+struct ObjChunk {
+    std::vector<point3d> positions;
+    std::vector<vec3d> normals;
+    std::vector<vec3d> uvs;
+    std::vector<vec3i> position_indices;
+    std::vector<vec3i> normal_indices;
+    std::vector<vec3i> uv_indices;
+    std::vector<unsigned short> relative; // 每个三角形 9 位：位置、UV、法线各 3 个角是否为相对索引
+    bool has_normals = false;
+    bool has_uvs = false;
+    bool error = false;
+};
+
+struct ObjCorner { int p, t, n; unsigned short relative; };
+
+static const char* skip_spaces(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    return p;
+}
+
+static const char* next_line(const char* p, const char* end) {
+    const char* q = (const char*)memchr(p, '\n', end - p);
+    return q ? q + 1 : end;
+}
+
+static const char* parse_vec(const char* p, const char* end, int n, vec3d& ret) {
+    for (int i = 0; i < n; i++) {
+        p = skip_spaces(p, end);
+        auto r = std::from_chars(p, end, ret[i]);
+        if (r.ec != std::errc()) return nullptr;
+        p = r.ptr;
+    }
+    return p;
+}
+
+// OBJ 索引从 1 开始，负数表示从当前已读到的末尾往前数
+static const char* parse_index(const char* p, const char* end, int count, int& index, bool& relative) {
+    int x;
+    auto r = std::from_chars(p, end, x);
+    if (r.ec != std::errc() || x == 0) return nullptr;
+    relative = x < 0;
+    index = x < 0 ? count + x : x - 1;
+    return r.ptr;
+}
+
+static void parse_obj_chunk(const char* p, const char* end, ObjChunk& chunk) {
+    std::vector<ObjCorner> corners;
+    while (p < end) {
+        const char* line_end = next_line(p, end);
+        p = skip_spaces(p, line_end);
+        const char* q = nullptr;
+        if (p + 1 < line_end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            vec3d v;
+            if ((q = parse_vec(p + 1, line_end, 3, v))) chunk.positions.push_back(v);
+        }
+        else if (p + 2 < line_end && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+            vec3d v;
+            if ((q = parse_vec(p + 2, line_end, 3, v))) chunk.normals.push_back(v);
+        }
+        else if (p + 2 < line_end && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) {
+            vec3d v;
+            if ((q = parse_vec(p + 2, line_end, 2, v))) chunk.uvs.push_back(v);
+        }
+        else if (p + 1 < line_end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            // 支持 v、v/vt、v//vn、v/vt/vn 四种写法，多边形按扇形拆成三角形
+            corners.clear();
+            q = p + 1;
+            while (q) {
+                q = skip_spaces(q, line_end);
+                if (q >= line_end || *q == '\n' || *q == '#') break;
+                ObjCorner c{ -1, -1, -1, 0 };
+                bool relative;
+                q = parse_index(q, line_end, (int)chunk.positions.size(), c.p, relative);
+                if (!q) break;
+                if (relative) c.relative |= 1;
+                if (q < line_end && *q == '/') {
+                    ++q;
+                    if (q < line_end && *q != '/') {
+                        q = parse_index(q, line_end, (int)chunk.uvs.size(), c.t, relative);
+                        if (!q) break;
+                        if (relative) c.relative |= 2;
+                    }
+                    if (q < line_end && *q == '/') {
+                        q = parse_index(q + 1, line_end, (int)chunk.normals.size(), c.n, relative);
+                        if (!q) break;
+                        if (relative) c.relative |= 4;
+                    }
+                }
+                corners.push_back(c);
+            }
+            if (q && corners.size() >= 3) {
+                for (size_t i = 1; i + 1 < corners.size(); i++) {
+                    const ObjCorner* tri[3] = { &corners[0], &corners[i], &corners[i + 1] };
+                    unsigned short relative = 0;
+                    for (int k = 0; k < 3; k++) {
+                        relative |= (tri[k]->relative & 1) << k;
+                        relative |= ((tri[k]->relative >> 1) & 1) << (k + 3);
+                        relative |= ((tri[k]->relative >> 2) & 1) << (k + 6);
+                    }
+                    chunk.position_indices.emplace_back(tri[0]->p, tri[1]->p, tri[2]->p);
+                    chunk.uv_indices.emplace_back(tri[0]->t, tri[1]->t, tri[2]->t);
+                    chunk.normal_indices.emplace_back(tri[0]->n, tri[1]->n, tri[2]->n);
+                    chunk.relative.push_back(relative);
+                    chunk.has_uvs |= tri[0]->t >= 0 && tri[1]->t >= 0 && tri[2]->t >= 0;
+                    chunk.has_normals |= tri[0]->n >= 0 && tri[1]->n >= 0 && tri[2]->n >= 0;
+                }
+            }
+            else q = nullptr;
+        }
+        else q = p; // 注释、空行以及 o/g/s/usemtl 等不关心的行
+        if (!q) chunk.error = true;
+        p = line_end;
+    }
+}
+
+// 按换行把文件切成若干块并行解析，再按块的顺序合并
+static bool load_obj(const char* data, size_t size, int threads_num, MeshData& mesh) {
+    int chunks_num = std::max(1, std::min(threads_num * 4, (int)(size >> 16) + 1));
+    std::vector<const char*> bounds(chunks_num + 1);
+    bounds[0] = data;
+    bounds[chunks_num] = data + size;
+    for (int i = 1; i < chunks_num; i++) {
+        const char* p = std::max(bounds[i - 1], data + size / chunks_num * i);
+        bounds[i] = p == data ? p : next_line(p - 1, data + size);
+    }
+
+    std::vector<ObjChunk> chunks(chunks_num);
+    RenderThreadPool pool(threads_num);
+    for (int i = 0; i < chunks_num; i++) {
+        pool.AddTask([&](RenderTaskParam param) {
+            parse_obj_chunk(bounds[param.from], bounds[param.to], chunks[param.from]);
+        }, { i, i + 1 });
+    }
+    pool.Dispatch();
+    pool.WaitForTaskEnding();
+
+    size_t positions_num = 0, normals_num = 0, uvs_num = 0, triangles_num = 0;
+    bool has_normals = false, has_uvs = false;
+    for (auto& chunk : chunks) {
+        if (chunk.error) std::cerr << "obj: some lines could not be parsed and were skipped" << std::endl;
+        chunk.error = false;
+        positions_num += chunk.positions.size();
+        normals_num += chunk.normals.size();
+        uvs_num += chunk.uvs.size();
+        triangles_num += chunk.position_indices.size();
+        has_normals |= chunk.has_normals;
+        has_uvs |= chunk.has_uvs;
+    }
+    mesh.positions.resize(positions_num);
+    mesh.normals.resize(normals_num);
+    mesh.uvs.resize(uvs_num);
+    mesh.position_indices.resize(triangles_num);
+    if (has_normals) mesh.normal_indices.resize(triangles_num);
+    if (has_uvs) mesh.uv_indices.resize(triangles_num);
+
+    // 前缀和得到每块在合并结果中的起始位置，拷贝和索引修正同样并行
+    struct Base { int p, n, t; size_t tri; };
+    std::vector<Base> bases(chunks_num);
+    Base base{ 0, 0, 0, 0 };
+    for (int i = 0; i < chunks_num; i++) {
+        bases[i] = base;
+        base.p += (int)chunks[i].positions.size();
+        base.n += (int)chunks[i].normals.size();
+        base.t += (int)chunks[i].uvs.size();
+        base.tri += chunks[i].position_indices.size();
+    }
+    std::atomic<bool> out_of_range(false);
+    for (int i = 0; i < chunks_num; i++) {
+        pool.AddTask([&](RenderTaskParam param) {
+            auto& chunk = chunks[param.from];
+            auto& b = bases[param.from];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.positions.begin() + b.p);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), mesh.normals.begin() + b.n);
+            std::copy(chunk.uvs.begin(), chunk.uvs.end(), mesh.uvs.begin() + b.t);
+            auto fix = [](vec3i idx, int rel, int base, int count) {
+                for (int k = 0; k < 3; k++) if (rel >> k & 1) idx[k] += base;
+                bool valid = idx.x >= 0 && idx.y >= 0 && idx.z >= 0 && idx.x < count && idx.y < count && idx.z < count;
+                return valid ? idx : vec3i(-1, -1, -1);
+            };
+            for (size_t j = 0; j < chunk.position_indices.size(); j++) {
+                int rel = chunk.relative[j];
+                vec3i p = fix(chunk.position_indices[j], rel, b.p, (int)positions_num);
+                if (p.x < 0) {
+                    out_of_range = true;
+                    p = vec3i(0, 0, 0); // 退化三角形，求交时不会命中
+                }
+                mesh.position_indices[b.tri + j] = p;
+                if (has_uvs) mesh.uv_indices[b.tri + j] = fix(chunk.uv_indices[j], rel >> 3, b.t, (int)uvs_num);
+                if (has_normals) mesh.normal_indices[b.tri + j] = fix(chunk.normal_indices[j], rel >> 6, b.n, (int)normals_num);
+            }
+            chunk = ObjChunk();
+        }, { i, i + 1 });
+    }
+    pool.Dispatch();
+    pool.WaitForTaskEnding();
+    if (out_of_range) std::cerr << "obj: face index out of range" << std::endl;
+    return positions_num > 0 && triangles_num > 0;
+}
+#pragma endregion OBJ
+
+#pragma region PLY
+enum class PlyType { None, Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    PlyType count_type; // 不是 list 时为 None
+    int offset;         // 定长元素中的字节偏移
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+    int stride; // 含 list 属性时为 -1
+};
+
+static PlyType ply_type(const std::string& s) {
+    if (s == "char" || s == "int8") return PlyType::Int8;
+    if (s == "uchar" || s == "uint8") return PlyType::UInt8;
+    if (s == "short" || s == "int16") return PlyType::Int16;
+    if (s == "ushort" || s == "uint16") return PlyType::UInt16;
+    if (s == "int" || s == "int32") return PlyType::Int32;
+    if (s == "uint" || s == "uint32") return PlyType::UInt32;
+    if (s == "float" || s == "float32") return PlyType::Float32;
+    if (s == "double" || s == "float64") return PlyType::Float64;
+    return PlyType::None;
+}
+
+static int ply_size(PlyType t) {
+    switch (t) {
+    case PlyType::Int8: case PlyType::UInt8: return 1;
+    case PlyType::Int16: case PlyType::UInt16: return 2;
+    case PlyType::Int32: case PlyType::UInt32: case PlyType::Float32: return 4;
+    case PlyType::Float64: return 8;
+    default: return 0;
+    }
+}
+
+template<typename T>
+static T ply_load(const char* p, bool swap) {
+    unsigned char bytes[sizeof(T)];
+    memcpy(bytes, p, sizeof(T));
+    if (swap) std::reverse(bytes, bytes + sizeof(T));
+    T x;
+    memcpy(&x, bytes, sizeof(T));
+    return x;
+}
+
+static double ply_read(const char* p, PlyType t, bool swap) {
+    switch (t) {
+    case PlyType::Int8: return (double)*(const signed char*)p;
+    case PlyType::UInt8: return (double)*(const unsigned char*)p;
+    case PlyType::Int16: return (double)ply_load<int16_t>(p, swap);
+    case PlyType::UInt16: return (double)ply_load<uint16_t>(p, swap);
+    case PlyType::Int32: return (double)ply_load<int32_t>(p, swap);
+    case PlyType::UInt32: return (double)ply_load<uint32_t>(p, swap);
+    case PlyType::Float32: return (double)ply_load<float>(p, swap);
+    case PlyType::Float64: return ply_load<double>(p, swap);
+    default: return 0.;
+    }
+}
+
+static bool load_ply(const char* data, size_t size, int threads_num, MeshData& mesh) {
+    const char* end = data + size;
+    const char* p = data;
+    std::vector<PlyElement> elements;
+    bool little_endian = true, header_ended = false;
+    while (p < end && !header_ended) {
+        const char* line_end = next_line(p, end);
+        std::istringstream line(std::string(p, line_end));
+        std::string keyword;
+        line >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            line >> format;
+            if (format == "binary_little_endian") little_endian = true;
+            else if (format == "binary_big_endian") little_endian = false;
+            else {
+                std::cerr << "ply: only binary format is supported" << std::endl;
+                return false;
+            }
+        }
+        else if (keyword == "element") {
+            PlyElement e;
+            line >> e.name >> e.count;
+            e.stride = 0;
+            elements.push_back(e);
+        }
+        else if (keyword == "property" && !elements.empty()) {
+            auto& e = elements.back();
+            PlyProperty prop{ "", PlyType::None, PlyType::None, e.stride };
+            std::string type;
+            line >> type;
+            if (type == "list") {
+                std::string count_type, item_type;
+                line >> count_type >> item_type;
+                prop.count_type = ply_type(count_type);
+                prop.type = ply_type(item_type);
+                e.stride = -1;
+            }
+            else {
+                prop.type = ply_type(type);
+                if (e.stride >= 0) e.stride += ply_size(prop.type);
+            }
+            line >> prop.name;
+            if (prop.type == PlyType::None) {
+                std::cerr << "ply: unknown property type " << type << std::endl;
+                return false;
+            }
+            e.properties.push_back(prop);
+        }
+        else if (keyword == "end_header") header_ended = true;
+        p = line_end;
+    }
+    if (!header_ended) return false;
+
+    const uint32_t one = 1;
+    bool swap = little_endian != (*reinterpret_cast<const unsigned char*>(&one) == 1);
+    RenderThreadPool pool(threads_num);
+    auto parallel_for = [&](size_t n, std::function<void(size_t, size_t)> f) {
+        size_t block = std::max<size_t>(4096, n / (threads_num * 4) + 1);
+        for (size_t i = 0; i < n; i += block) {
+            pool.AddTask([&f, block, n](RenderTaskParam param) {
+                size_t from = (size_t)param.from * block;
+                f(from, std::min(n, from + block));
+            }, { (int)(i / block), 0 });
+        }
+        pool.Dispatch();
+        pool.WaitForTaskEnding();
+    };
+
+    for (auto& e : elements) {
+        if (e.name == "vertex") {
+            if (e.stride < 0 || p + e.stride * e.count > end) return false;
+            const PlyProperty* attrs[8] = {};
+            const char* names[8] = { "x", "y", "z", "nx", "ny", "nz", "u", "v" };
+            for (auto& prop : e.properties) {
+                for (int k = 0; k < 8; k++) if (prop.name == names[k]) attrs[k] = &prop;
+                if (prop.name == "s" || prop.name == "texture_u") attrs[6] = &prop;
+                if (prop.name == "t" || prop.name == "texture_v") attrs[7] = &prop;
+            }
+            if (!attrs[0] || !attrs[1] || !attrs[2]) return false;
+            bool has_normals = attrs[3] && attrs[4] && attrs[5];
+            bool has_uvs = attrs[6] && attrs[7];
+            mesh.positions.resize(e.count);
+            if (has_normals) mesh.normals.resize(e.count);
+            if (has_uvs) mesh.uvs.resize(e.count);
+            const char* base = p;
+            int stride = e.stride;
+            parallel_for(e.count, [&](size_t from, size_t to) {
+                for (size_t i = from; i < to; i++) {
+                    const char* v = base + i * stride;
+                    for (int k = 0; k < 3; k++) mesh.positions[i][k] = ply_read(v + attrs[k]->offset, attrs[k]->type, swap);
+                    if (has_normals) for (int k = 0; k < 3; k++) mesh.normals[i][k] = ply_read(v + attrs[k + 3]->offset, attrs[k + 3]->type, swap);
+                    if (has_uvs) for (int k = 0; k < 2; k++) mesh.uvs[i][k] = ply_read(v + attrs[k + 6]->offset, attrs[k + 6]->type, swap);
+                }
+            });
+            p += (size_t)stride * e.count;
+        }
+        else if (e.name == "face") {
+            const PlyProperty* list = nullptr;
+            for (auto& prop : e.properties) {
+                if (prop.count_type != PlyType::None) {
+                    if (list) {
+                        std::cerr << "ply: faces with more than one list property are not supported" << std::endl;
+                        return false;
+                    }
+                    list = &prop;
+                }
+            }
+            if (!list) return false;
+            int count_size = ply_size(list->count_type);
+            int item_size = ply_size(list->type);
+            int before = 0, after = 0;
+            for (auto& prop : e.properties) {
+                if (&prop < list) before += ply_size(prop.type);
+                else if (&prop > list) after += ply_size(prop.type);
+            }
+
+            // 全是三角形时每个面定长，可以直接按下标并行读取；先并行检查一遍
+            size_t stride = before + count_size + 3 * item_size + after;
+            const char* base = p;
+            std::atomic<bool> all_triangles(base + stride * e.count <= end);
+            if (all_triangles) {
+                parallel_for(e.count, [&](size_t from, size_t to) {
+                    for (size_t i = from; i < to && all_triangles; i++) {
+                        if (ply_read(base + i * stride + before, list->count_type, swap) != 3.) all_triangles = false;
+                    }
+                });
+            }
+            if (all_triangles) {
+                mesh.position_indices.resize(e.count);
+                parallel_for(e.count, [&](size_t from, size_t to) {
+                    for (size_t i = from; i < to; i++) {
+                        const char* f = base + i * stride + before + count_size;
+                        for (int k = 0; k < 3; k++) mesh.position_indices[i][k] = (int)ply_read(f + k * item_size, list->type, swap);
+                    }
+                });
+                p += stride * e.count;
+            }
+            else {
+                // 含多边形时只能顺序扫描，按扇形拆成三角形
+                mesh.position_indices.reserve(e.count * 2);
+                for (size_t i = 0; i < e.count; i++) {
+                    if (p + before + count_size > end) return false;
+                    int n = (int)ply_read(p + before, list->count_type, swap);
+                    const char* f = p + before + count_size;
+                    if (n < 0 || f + (size_t)n * item_size + after > end) return false;
+                    for (int k = 1; k + 1 < n; k++) {
+                        mesh.position_indices.emplace_back((int)ply_read(f, list->type, swap),
+                            (int)ply_read(f + k * item_size, list->type, swap),
+                            (int)ply_read(f + (k + 1) * item_size, list->type, swap));
+                    }
+                    p = f + (size_t)n * item_size + after;
+                }
+            }
+        }
+        else if (e.stride >= 0) p += (size_t)e.stride * e.count;
+        else {
+            std::cerr << "ply: cannot skip element " << e.name << std::endl;
+            break;
+        }
+    }
+
+    int vertices_num = (int)mesh.positions.size();
+    for (auto& idx : mesh.position_indices) {
+        if (idx.x < 0 || idx.y < 0 || idx.z < 0 || idx.x >= vertices_num || idx.y >= vertices_num || idx.z >= vertices_num) {
+            std::cerr << "ply: face index out of range" << std::endl;
+            idx = vec3i(0, 0, 0);
+        }
+    }
+    // PLY 的法线和 UV 与位置共用索引
+    if (!mesh.normals.empty()) mesh.normal_indices = mesh.position_indices;
+    if (!mesh.uvs.empty()) mesh.uv_indices = mesh.position_indices;
+    return vertices_num > 0 && !mesh.position_indices.empty();
+}
+#pragma endregion PLY
+
+std::shared_ptr<MeshData> LoadMesh(const std::string& file_name, int threads_num) {
+    DWORD start_time = GetTickCount();
+    std::stringstream ss;
+    ss << source_path << file_name;
+    MappedFile file;
+    if (!file.Open(ss.str())) {
+        std::cerr << "can not open mesh file " << file_name << std::endl;
+        return nullptr;
+    }
+
+    auto mesh = std::make_shared<MeshData>();
+    bool ok;
+    if (file.GetSize() >= 3 && memcmp(file.GetData(), "ply", 3) == 0) ok = load_ply(file.GetData(), file.GetSize(), threads_num, *mesh);
+    else ok = load_obj(file.GetData(), file.GetSize(), threads_num, *mesh);
+    if (!ok) {
+        std::cerr << "failed to load mesh " << file_name << std::endl;
+        return nullptr;
+    }
+    std::cout << "load mesh " << file_name << ": " << mesh->GetTrianglesNum() << " triangles in "
+        << GetTickCount() - start_time << "ms" << std::endl;
+    return mesh;
+}
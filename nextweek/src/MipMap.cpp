@@ -0,0 +1,215 @@
+﻿#include "MipMap.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static constexpr double INV_255 = 1. / 255.;
+
+// IEEE 754 binary16，就近舍入到偶数，超出范围的值截断到最大的有限值 65504
+uint16_t MipMap::FloatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7fffff;
+    int exp = (int)((x >> 23) & 0xff);
+    if (exp == 0xff) return (uint16_t)(sign | 0x7c00 | (mant != 0 ? 0x200 : 0));
+    exp = exp - 127 + 15;
+    if (exp >= 31) return (uint16_t)(sign | 0x7bff);
+    if (exp <= 0) {
+        // 非规格化数，太小的直接为 0
+        if (exp < -10) return (uint16_t)sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1), mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (h & 1))) h++;
+        return (uint16_t)(sign | h);
+    }
+    uint32_t h = ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return (uint16_t)(sign | std::min(h, 0x7bffu));
+}
+
+float MipMap::HalfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if (exp == 0) {
+        float v = std::ldexp((float)mant, -24);
+        return sign != 0 ? -v : v;
+    }
+    uint32_t x = exp == 31 ? (sign | 0x7f800000 | (mant << 13)) : (sign | ((exp + 112) << 23) | (mant << 13));
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static uint32_t pack_unorm8(float v) {
+    return (uint32_t)std::clamp((int)(v * 255.f + 0.5f), 0, 255);
+}
+
+static bool is_unorm8(double v) {
+    double k = v * 255.;
+    return v >= 0. && v <= 1. && std::abs(k - (double)(int)(k + 0.5)) <= 1e-3;
+}
+
+// 把 w x h 的一层缩小一半写入 next，fetch(x, y, c) 取出该层一个纹素的三个分量，奇数边长时最后一行/列重复取边上的纹素
+template<typename Fetch>
+static void downsample(int w, int h, std::vector<float>& next, Fetch fetch) {
+    int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+    next.assign((size_t)nw * nh * 3, 0.f);
+    float c[3];
+    for (int y = 0; y < nh; y++) {
+        int ys[2] = { std::min(2 * y, h - 1), std::min(2 * y + 1, h - 1) };
+        for (int x = 0; x < nw; x++) {
+            int xs[2] = { std::min(2 * x, w - 1), std::min(2 * x + 1, w - 1) };
+            float* p = &next[((size_t)y * nw + x) * 3];
+            for (int j = 0; j < 4; j++) {
+                fetch(xs[j & 1], ys[j >> 1], c);
+                p[0] += 0.25f * c[0], p[1] += 0.25f * c[1], p[2] += 0.25f * c[2];
+            }
+        }
+    }
+}
+
+MipMap::MipMap(PPMImage& image) {
+    int w = image.get_width(), h = image.get_height();
+    if (w <= 0 || h <= 0) return;
+
+    // 8 位存储只在不丢失精度时使用，HDR 或更高位深的图像改用 half
+    for (int y = 0; y < h && !is_half; y++) {
+        for (int x = 0; x < w && !is_half; x++) {
+            Color c = image.get_color(x, y);
+            is_half = !is_unorm8(c.r) || !is_unorm8(c.g) || !is_unorm8(c.b);
+        }
+    }
+    // 整个金字塔的纹素数不超过第 0 层的 4 / 3
+    size_t total = (size_t)w * h * 4 / 3 + 16;
+    if (is_half) texels16.reserve(total * 3);
+    else texels8.reserve(total);
+
+    // 第 0 层直接由原图写入，不再额外展开一份 float 副本，从第 1 层起在 float 缓冲上逐层缩小
+    AddLevel(w, h);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            Color c = image.get_color(x, y);
+            SetTexel((size_t)y * w + x, (float)c.r, (float)c.g, (float)c.b);
+        }
+    }
+    if (w == 1 && h == 1) return;
+    std::vector<float> rgb, next;
+    downsample(w, h, rgb, [&image](int x, int y, float* c) {
+        Color t = image.get_color(x, y);
+        c[0] = (float)t.r, c[1] = (float)t.g, c[2] = (float)t.b;
+    });
+    w = std::max(1, w / 2), h = std::max(1, h / 2);
+    while (true) {
+        size_t offset = AddLevel(w, h);
+        for (size_t i = 0; i < (size_t)w * h; i++) SetTexel(offset + i, rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]);
+        if (w == 1 && h == 1) break;
+        downsample(w, h, next, [&rgb, w](int x, int y, float* c) {
+            const float* p = &rgb[((size_t)y * w + x) * 3];
+            c[0] = p[0], c[1] = p[1], c[2] = p[2];
+        });
+        rgb.swap(next);
+        w = std::max(1, w / 2), h = std::max(1, h / 2);
+    }
+}
+
+size_t MipMap::AddLevel(int width, int height) {
+    size_t offset = is_half ? texels16.size() / 3 : texels8.size();
+    size_t n = (size_t)width * height;
+    levels.push_back({ width, height, offset });
+    if (is_half) texels16.resize(texels16.size() + n * 3);
+    else texels8.resize(texels8.size() + n);
+    return offset;
+}
+
+void MipMap::SetTexel(size_t i, float r, float g, float b) {
+    if (is_half) {
+        uint16_t* p = &texels16[i * 3];
+        p[0] = FloatToHalf(r), p[1] = FloatToHalf(g), p[2] = FloatToHalf(b);
+    }
+    else texels8[i] = pack_unorm8(r) | pack_unorm8(g) << 8 | pack_unorm8(b) << 16;
+}
+
+// 8 位纹素的分量先按 0~255 累加，最后统一乘 1 / 255
+template<>
+inline void MipMap::Accumulate<false>(size_t i, float w, float* rgb) const {
+    uint32_t t = texels8[i];
+    rgb[0] += w * (float)(t & 0xff);
+    rgb[1] += w * (float)((t >> 8) & 0xff);
+    rgb[2] += w * (float)((t >> 16) & 0xff);
+}
+
+template<>
+inline void MipMap::Accumulate<true>(size_t i, float w, float* rgb) const {
+    const uint16_t* p = &texels16[i * 3];
+    rgb[0] += w * HalfToFloat(p[0]);
+    rgb[1] += w * HalfToFloat(p[1]);
+    rgb[2] += w * HalfToFloat(p[2]);
+}
+
+// 纹素中心在 (x + 0.5, y + 0.5)，超出边界的纹素按重复寻址取对边
+void MipMap::BilinearCoords(double s, double t, int width, int height, int (&x)[2], int (&y)[2], float& dx, float& dy) {
+    // s, t 在 [0, 1) 内，fx, fy 不小于 0.5，截断即可向下取整
+    double fx = s * width + 0.5, fy = t * height + 0.5;
+    x[1] = (int)fx, y[1] = (int)fy;
+    dx = (float)(fx - x[1]), dy = (float)(fy - y[1]);
+    x[0] = x[1] - 1, y[0] = y[1] - 1;
+    if (x[0] < 0) x[0] += width;
+    if (y[0] < 0) y[0] += height;
+    if (x[1] >= width) x[1] -= width;
+    if (y[1] >= height) y[1] -= height;
+}
+
+// width 覆盖第 0 层的纹素数取 log2 即为层级，不足一个纹素时只取第 0 层
+int MipMap::SelectLevel(double width, int size, int levels_num, float& f) {
+    f = 0.f;
+    double texels = width * size;
+    if (!(texels > 1.)) return 0;
+    double lod = std::log2(texels);
+    if (lod >= levels_num - 1) return levels_num - 1;
+    int level = (int)lod;
+    f = (float)(lod - level);
+    return level;
+}
+
+void MipMap::WrapCoords(double& s, double& t) {
+    s -= std::floor(s);
+    t -= std::floor(t);
+    if (!(s >= 0. && s < 1.)) s = 0.;
+    if (!(t >= 0. && t < 1.)) t = 0.;
+}
+
+// 结果按 weight 加到 rgb 上
+template<bool half>
+inline void MipMap::Bilinear(int level, double s, double t, float weight, float* rgb) const {
+    const Level& l = levels[level];
+    int x[2], y[2];
+    float dx, dy;
+    BilinearCoords(s, t, l.width, l.height, x, y, dx, dy);
+    size_t row0 = l.offset + (size_t)y[0] * l.width, row1 = l.offset + (size_t)y[1] * l.width;
+    Accumulate<half>(row0 + x[0], weight * (1.f - dx) * (1.f - dy), rgb);
+    Accumulate<half>(row0 + x[1], weight * dx * (1.f - dy), rgb);
+    Accumulate<half>(row1 + x[0], weight * (1.f - dx) * dy, rgb);
+    Accumulate<half>(row1 + x[1], weight * dx * dy, rgb);
+}
+
+template<bool half>
+Color MipMap::Trilinear(double s, double t, double width) const {
+    float rgb[3] = { 0.f, 0.f, 0.f };
+    float f;
+    int level = SelectLevel(width, std::max(levels[0].width, levels[0].height), (int)levels.size(), f);
+    Bilinear<half>(level, s, t, 1.f - f, rgb);
+    if (f > 0.f) Bilinear<half>(level + 1, s, t, f, rgb);
+    double scale = half ? 1. : INV_255;
+    return Color(rgb[0] * scale, rgb[1] * scale, rgb[2] * scale);
+}
+
+Color MipMap::Lookup(double s, double t, double width) const {
+    if (levels.empty()) return Color();
+    WrapCoords(s, t);
+    return is_half ? Trilinear<true>(s, t, width) : Trilinear<false>(s, t, width);
+}
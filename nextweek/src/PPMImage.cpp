@@ -1,8 +1,16 @@
 #include "PPMImage.hpp"
+#include "MappedFile.hpp"
+#include "RenderThreadPool.hpp"
 #include "project_path.hpp"
+#include "global.hpp"
 #include <string>
 #include <sstream>
-#include <queue>
+#include <vector>
+#include <charconv>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
 
 Color operator*(const Color& c, double x) { return Color(c.r * x, c.g * x, c.b * x); }
 Color operator*(double x, const Color& c) { return Color(c.r * x, c.g * x, c.b * x); }
@@ -21,112 +29,269 @@ PPMImage::PPMImage(PPMImage&& other) noexcept {
     other.image = nullptr;
     height = other.height;
     width = other.width;
+    mapped_file = std::move(other.mapped_file);
+    texels = other.texels;
+    texel_scale = other.texel_scale;
+    other.texels = nullptr;
 }
 PPMImage& PPMImage::operator=(PPMImage&& other) noexcept {
+    if (image != nullptr) delete[] image;
     image = other.image;
     other.image = nullptr;
     height = other.height;
     width = other.width;
+    mapped_file = std::move(other.mapped_file);
+    texels = other.texels;
+    texel_scale = other.texel_scale;
+    other.texels = nullptr;
     return *this;
 }
 
 void PPMImage::set_pixel(const int u, const int v, const Color& c) {
-    if(u < 0 || u >= width || v < 0 || v >= height) return;
+    if(u < 0 || u >= width || v < 0 || v >= height || image == nullptr) return;
     image[u + v*width] = c;
 }
 
 Color PPMImage::get_color(const int u, const int v) {
     if(u < 0 || u >= width || v < 0 || v >= height) return Color();
+    if (texels != nullptr) {
+        const unsigned char* p = texels + ((size_t)u + (size_t)v * width) * 3;
+        return Color(p[0] * texel_scale, p[1] * texel_scale, p[2] * texel_scale);
+    }
     return image[u + v*width];
 }
 
 int PPMImage::get_height() const { return height; }
 int PPMImage::get_width() const { return width; }
 
+// 8 位输出的 gamma 校正表，GAMMA_THRESHOLDS[k] 是输出值达到 k 所需的最小线性值
+// 每个分量用固定 8 步的二分查找代替 std::pow，循环里没有分支，结果与 (int)(pow(x, 0.45) * 255) 截断一致
+static const std::vector<double> GAMMA_THRESHOLDS = [] {
+    std::vector<double> thresholds(256, 0.);
+    for (int k = 1; k < 256; k++) thresholds[k] = std::pow(k / 255., 1. / 0.45);
+    return thresholds;
+}();
+
+static inline unsigned char gamma_encode(double x) {
+    const double* t = GAMMA_THRESHOLDS.data();
+    int k = 0;
+    for (int step = 128; step > 0; step >>= 1) k += t[k + step] <= x ? step : 0;
+    return (unsigned char)k;
+}
+
+// 帧缓冲中保存的是线性值，写 P6 时才做 gamma 校正，图片左下角为(0,0)
+void PPMImage::write_p6(std::vector<char>& buffer) const {
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    buffer.resize(header.size() + (size_t)width * height * 3);
+    memcpy(buffer.data(), header.data(), header.size());
+    unsigned char* out = (unsigned char*)buffer.data() + header.size();
+    for (int y = height - 1; y >= 0; y--) {
+        const Color* row = image + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            *out++ = gamma_encode(row[x].r);
+            *out++ = gamma_encode(row[x].g);
+            *out++ = gamma_encode(row[x].b);
+        }
+    }
+}
+
+// PFM 保存未经处理的线性值，行从下到上，比例为负表示小端
+void PPMImage::write_pfm(std::vector<char>& buffer) const {
+    const uint32_t one = 1;
+    bool host_little_endian = *reinterpret_cast<const unsigned char*>(&one) == 1;
+    std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + (host_little_endian ? "\n-1.0\n" : "\n1.0\n");
+    buffer.resize(header.size() + (size_t)width * height * 3 * sizeof(float));
+    memcpy(buffer.data(), header.data(), header.size());
+    float* out = (float*)(buffer.data() + header.size());
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        *out++ = (float)image[i].r;
+        *out++ = (float)image[i].g;
+        *out++ = (float)image[i].b;
+    }
+}
+
+// 按扩展名选择格式，.pfm 写 32 位浮点 HDR，其余写 8 位 P6，整幅图在内存中编码好后一次写出
 void PPMImage::write_to_file(const char* file_name) {
-    std::ofstream f;
-    f.open(file_name);
+    std::string name(file_name);
+    bool is_pfm = name.size() >= 4 && name.compare(name.size() - 4, 4, ".pfm") == 0;
+    std::vector<char> buffer;
+    if (is_pfm) write_pfm(buffer);
+    else write_p6(buffer);
+
+    std::ofstream f(file_name, std::ios::binary);
     if(!f.is_open()) {
         std::cerr << file_name << " cannot be open.\n";
-        f.close();
         return;
     }
-    f << "P3\n" << width << ' ' << height << "\n255\n";
-    // 图片左下角为(0,0)
-    for(int y = height-1; y >= 0; y--) {
-        for(int x = 0; x < width; x++) {
-            f << image[x + y*width] << "\n";
-        }
-    }
+    f.write(buffer.data(), buffer.size());
     f.close();
 
     std::cout << file_name <<" has been saved.\n";
 }
 
-static int get_int(std::string line, int& index) {
-    if (index >= line.length()) {
-        std::cerr << "get_int error!\n";
-        return 0;
-    }
-    int ans = 0;
-    while (index < line.length()) {
-        if (line[index] >= '0' && line[index] <= '9') {
-            ans = ans * 10 + line[index] - '0';
-        }
-        else if (line[index] == ' ') break;
-        else std::cerr << "GetDouble error!\n";
-        ++index;
-    }
-    ++index;
-    return ans;
-}
-
 static std::string GetFullPath(std::string fileName) {
     std::stringstream ss;
     ss << source_path << fileName;
     return ss.str();
 }
 
-void PPMImage::read_from_file(std::string file_name) {
-    std::ifstream f;
-    f.open(GetFullPath(file_name));
-    if(!f.is_open()) {
-        std::cerr << file_name << " cannot be open.\n";
-        f.close();
-        return;
+// 跳过空白和 # 注释后读一个整数，失败返回空
+static const char* read_header_int(const char* p, const char* end, int& value) {
+    while (p < end) {
+        if (*p == '#') while (p < end && *p != '\n') ++p;
+        else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') ++p;
+        else break;
     }
-    
-    std::string line;
-    int color_scale = -1;
-    int pixel_i = 0;
-    while (std::getline(f, line)) {
-        if (line[0] == 'P') {
-            if (line[1] != '3') {
-                std::cerr << file_name << " cannot be read.\n";
-                f.close();
-                return;
+    auto result = std::from_chars(p, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+// 解析 P3 像素部分 [p, end) 中的整数，# 到行尾为注释，image 为空时只计数
+// first 为这一块第一个整数在整幅图中的序号，每三个整数组成一个像素
+static size_t parse_p3_chunk(const char* p, const char* end, size_t first, Color* image, size_t values_num, double scale) {
+    size_t n = 0;
+    while (p < end) {
+        if (*p >= '0' && *p <= '9') {
+            int v = 0;
+            while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+            size_t k = first + n++;
+            if (image != nullptr && k < values_num) {
+                Color& c = image[k / 3];
+                (k % 3 == 0 ? c.r : k % 3 == 1 ? c.g : c.b) = v * scale;
             }
         }
-        else if (line[0] == '#') continue;
-        else {
-            int index = 0;
-            std::queue<int> nums;
-            while(index < line.length()) nums.push(get_int(line, index));
-            while(!nums.empty()) {
-                if (width == -1) width = nums.front(), nums.pop();
-                else if (height == -1) height = nums.front(), nums.pop();
-                else if (color_scale == -1) color_scale = nums.front(), nums.pop();
-                else {
-                    if (image == nullptr) image = new Color[height * width];
-                    double r = (double)nums.front() / color_scale; nums.pop();
-                    double g = (double)nums.front() / color_scale; nums.pop();
-                    double b = (double)nums.front() / color_scale; nums.pop();
-                    image[pixel_i++] = Color(r, g, b);
-                }
-            }
+        else if (*p == '#') while (p < end && *p != '\n') ++p;
+        else ++p;
+    }
+    return n;
+}
+
+// 按行把像素部分切块，先并行数出每块的整数个数，前缀和得到各块的起始序号后再并行写入
+bool PPMImage::read_p3(const char* p, const char* end, int maxval, int threads_num) {
+    int chunks_num = std::max(1, std::min(threads_num * 4, (int)((end - p) >> 16) + 1));
+    std::vector<const char*> bounds(chunks_num + 1);
+    bounds[0] = p;
+    bounds[chunks_num] = end;
+    for (int i = 1; i < chunks_num; i++) {
+        const char* q = std::max(bounds[i - 1], p + (end - p) / chunks_num * i);
+        while (q < end && *q != '\n') ++q;
+        bounds[i] = q;
+    }
+
+    size_t values_num = (size_t)width * height * 3;
+    image = new Color[(size_t)width * height];
+    std::vector<size_t> counts(chunks_num + 1, 0);
+    for (int pass = 0; pass < 2; pass++) {
+        RenderThreadPool pool(std::min(threads_num, chunks_num));
+        for (int i = 0; i < chunks_num; i++) {
+            pool.AddTask([&, pass](RenderTaskParam param) {
+                int c = param.from;
+                if (pass == 0) counts[c + 1] = parse_p3_chunk(bounds[c], bounds[c + 1], 0, nullptr, 0, 0.);
+                else parse_p3_chunk(bounds[c], bounds[c + 1], counts[c], image, values_num, 1. / maxval);
+            }, { i, i + 1 });
         }
+        pool.Dispatch();
+        pool.WaitForTaskEnding();
+        if (pass == 0) for (int i = 0; i < chunks_num; i++) counts[i + 1] += counts[i];
     }
-    f.close();
+    return counts[chunks_num] >= values_num;
+}
+
+// P6 的 8 位像素直接使用映射的文件内容，16 位的按大端展开成 Color
+bool PPMImage::read_pnm(const std::shared_ptr<MappedFile>& file, int threads_num) {
+    const char* data = file->GetData();
+    const char* end = data + file->GetSize();
+    int w, h, maxval;
+    const char* p = read_header_int(data + 2, end, w);
+    if (p != nullptr) p = read_header_int(p, end, h);
+    if (p != nullptr) p = read_header_int(p, end, maxval);
+    if (p == nullptr || p >= end || w <= 0 || h <= 0 || maxval <= 0 || maxval > 65535) return false;
+    ++p; // 头部之后恰好一个空白字符
+    width = w;
+    height = h;
+
+    if (data[1] == '3') return read_p3(p, end, maxval, threads_num);
+    size_t values_num = (size_t)w * h * 3;
+    if ((size_t)(end - p) < values_num * (maxval < 256 ? 1 : 2)) return false;
+    if (maxval < 256) {
+        mapped_file = file;
+        texels = (const unsigned char*)p;
+        texel_scale = 1. / maxval;
+        return true;
+    }
+    image = new Color[(size_t)w * h];
+    const unsigned char* q = (const unsigned char*)p;
+    for (size_t i = 0; i < (size_t)w * h; i++, q += 6) {
+        image[i] = Color(((q[0] << 8) | q[1]) / (double)maxval, ((q[2] << 8) | q[3]) / (double)maxval, ((q[4] << 8) | q[5]) / (double)maxval);
+    }
+    return true;
+}
+
+// PFM 为 32 位浮点的 HDR 图像，头部之后是按从下到上存放的二进制像素
+bool PPMImage::read_pfm(const char* data, size_t size) {
+    const char* end = data + size;
+    int channels = data[1] == 'F' ? 3 : 1;
+    int w, h;
+    const char* p = read_header_int(data + 2, end, w);
+    if (p != nullptr) p = read_header_int(p, end, h);
+    if (p == nullptr || w <= 0 || h <= 0) return false;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p;
+    double scale;
+    auto result = std::from_chars(p, end, scale);
+    if (result.ec != std::errc() || result.ptr >= end) return false;
+    p = result.ptr + 1;
+    bool little_endian = scale < 0;
 
+    size_t floats_num = (size_t)w * h * channels;
+    if ((size_t)(end - p) < floats_num * sizeof(float)) return false;
+    std::vector<float> buffer(floats_num);
+    memcpy(buffer.data(), p, floats_num * sizeof(float));
+
+    const uint32_t one = 1;
+    bool host_little_endian = *reinterpret_cast<const unsigned char*>(&one) == 1;
+    if (little_endian != host_little_endian) {
+        for (auto& x : buffer) {
+            auto bytes = reinterpret_cast<unsigned char*>(&x);
+            std::swap(bytes[0], bytes[3]);
+            std::swap(bytes[1], bytes[2]);
+        }
+    }
+
+    width = w;
+    height = h;
+    image = new Color[(size_t)h * w];
+    for (int y = 0; y < height; y++) {
+        // 与 P3 一致，第 0 行为图片的最上面一行
+        const float* row = buffer.data() + (size_t)(height - 1 - y) * width * channels;
+        for (int x = 0; x < width; x++) {
+            const float* p = row + x * channels;
+            image[x + y * width] = channels == 3 ? Color(p[0], p[1], p[2]) : Color(p[0], p[0], p[0]);
+        }
+    }
+    return true;
+}
+
+void PPMImage::read_from_file(std::string file_name, int threads_num) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(GetFullPath(file_name))) {
+        std::cerr << file_name << " cannot be open.\n";
+        return;
+    }
+
+    const char* data = file->GetData();
+    bool ok = false;
+    if (file->GetSize() >= 2 && data[0] == 'P') {
+        if (data[1] == 'F' || data[1] == 'f') ok = read_pfm(data, file->GetSize());
+        else if (data[1] == '3' || data[1] == '6') ok = read_pnm(file, threads_num > 0 ? threads_num : thread_num);
+    }
+    if (!ok) {
+        if (image != nullptr) delete[] image;
+        image = nullptr;
+        texels = nullptr;
+        mapped_file = nullptr;
+        height = width = -1;
+        std::cerr << file_name << " cannot be read.\n";
+        return;
+    }
     std::cout << "get texture " << file_name << ".\n";
-}
\ No newline at end of file
+}
@@ -0,0 +1,122 @@
+﻿#include "RenderStats.hpp"
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace {
+    const char* primitive_names[] = { "sphere", "plane", "box", "rect", "triangle", "instance" };
+    const char* material_names[] = { "lambertian", "metal", "dielectrics", "diffuse_light" };
+
+    struct Registry {
+        CRITICAL_SECTION cs;
+        std::vector<std::unique_ptr<RenderCounters>> counters;
+        std::vector<RenderCounters*> free_counters;
+        Registry() { InitializeCriticalSection(&cs); }
+        ~Registry() { DeleteCriticalSection(&cs); }
+    };
+    Registry& GetRegistry() {
+        static Registry registry;
+        return registry;
+    }
+}
+
+// 优先复用已退出线程的计数器，线程池每次分发都创建新线程，计数器总数仍不超过同时计数的线程数
+RenderCounters* RenderStats::Acquire() {
+    auto& registry = GetRegistry();
+    RenderCounters* counters;
+    EnterCriticalSection(&registry.cs);
+    if (!registry.free_counters.empty()) {
+        counters = registry.free_counters.back();
+        registry.free_counters.pop_back();
+    }
+    else {
+        counters = new RenderCounters();
+        registry.counters.emplace_back(counters);
+    }
+    LeaveCriticalSection(&registry.cs);
+    return counters;
+}
+
+void RenderStats::Release(RenderCounters* counters) {
+    auto& registry = GetRegistry();
+    EnterCriticalSection(&registry.cs);
+    registry.free_counters.push_back(counters);
+    LeaveCriticalSection(&registry.cs);
+}
+
+RenderCounters RenderStats::Merge() {
+    auto& registry = GetRegistry();
+    RenderCounters total{};
+    EnterCriticalSection(&registry.cs);
+    for (auto& c : registry.counters) {
+        for (int i = 0; i <= max_depth; i++) total.rays[i] += c->rays[i];
+        total.shadow_rays += c->shadow_rays;
+        total.max_depth_paths += c->max_depth_paths;
+        total.bvh_nodes += c->bvh_nodes;
+        total.box_tests += c->box_tests;
+        for (int i = 0; i < (int)StatsPrimitive::Num; i++) total.primitive_tests[i] += c->primitive_tests[i];
+        for (int i = 0; i < (int)StatsMaterial::Num; i++) total.scatters[i] += c->scatters[i];
+    }
+    LeaveCriticalSection(&registry.cs);
+    return total;
+}
+
+void RenderStats::Reset() {
+    auto& registry = GetRegistry();
+    EnterCriticalSection(&registry.cs);
+    for (auto& c : registry.counters) *c = RenderCounters();
+    LeaveCriticalSection(&registry.cs);
+}
+
+void RenderStats::Report(const std::string& json_file) {
+    RenderCounters total = Merge();
+    uint64_t rays = total.shadow_rays, primitive_tests = 0, scatters = 0;
+    int depth_num = 0;
+    double depth_sum = 0.;
+    for (int i = 0; i <= max_depth; i++) {
+        rays += total.rays[i];
+        depth_sum += (double)i * total.rays[i];
+        if (total.rays[i] > 0) depth_num = i + 1;
+    }
+    for (auto n : total.primitive_tests) primitive_tests += n;
+    for (auto n : total.scatters) scatters += n;
+    uint64_t path_rays = rays - total.shadow_rays;
+    auto per_ray = [rays](uint64_t n) { return rays > 0 ? (double)n / rays : 0.; };
+
+    // 每条光线的节点数和求交次数高说明瓶颈在遍历，散射次数多、平均深度大说明瓶颈在着色或路径过长
+    std::cout << "render stats: " << rays << " rays (" << total.shadow_rays << " shadow), mean depth = "
+              << (path_rays > 0 ? depth_sum / path_rays : 0.) << ", killed by max_depth = " << total.max_depth_paths << "\n";
+    std::cout << "  per ray: bvh nodes = " << per_ray(total.bvh_nodes) << ", box tests = " << per_ray(total.box_tests)
+              << ", primitive tests = " << per_ray(primitive_tests) << ", scatters = " << per_ray(scatters) << "\n";
+    std::cout << "  rays by depth:";
+    for (int i = 0; i < depth_num; i++) std::cout << " " << total.rays[i];
+    std::cout << "\n  primitive tests:";
+    for (int i = 0; i < (int)StatsPrimitive::Num; i++) {
+        if (total.primitive_tests[i] > 0) std::cout << " " << primitive_names[i] << " = " << total.primitive_tests[i];
+    }
+    std::cout << "\n  scatter calls:";
+    for (int i = 0; i < (int)StatsMaterial::Num; i++) {
+        if (total.scatters[i] > 0) std::cout << " " << material_names[i] << " = " << total.scatters[i];
+    }
+    std::cout << std::endl;
+
+    std::ofstream out(json_file);
+    if (!out) {
+        std::cerr << json_file << " cannot be open.\n";
+        return;
+    }
+    out << "{\n  \"rays\": " << rays << ",\n  \"shadow_rays\": " << total.shadow_rays << ",\n  \"max_depth_paths\": " << total.max_depth_paths
+        << ",\n  \"bvh_nodes\": " << total.bvh_nodes << ",\n  \"box_tests\": " << total.box_tests << ",\n  \"rays_by_depth\": [";
+    for (int i = 0; i < depth_num; i++) out << (i > 0 ? ", " : "") << total.rays[i];
+    out << "],\n  \"primitive_tests\": {";
+    for (int i = 0; i < (int)StatsPrimitive::Num; i++) out << (i > 0 ? ", " : " ") << "\"" << primitive_names[i] << "\": " << total.primitive_tests[i];
+    out << " },\n  \"scatters\": {";
+    for (int i = 0; i < (int)StatsMaterial::Num; i++) out << (i > 0 ? ", " : " ") << "\"" << material_names[i] << "\": " << total.scatters[i];
+    out << " }\n}\n";
+    std::cout << json_file << " has been saved.\n";
+}
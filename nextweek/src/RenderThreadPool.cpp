@@ -1,4 +1,5 @@
 #include "RenderThreadPool.hpp"
+#include "Trace.hpp"
 
 DWORD WINAPI DispatchTask(LPVOID pool_) {
     RenderThreadPool* pool = (RenderThreadPool*) pool_;
@@ -12,7 +13,8 @@ DWORD WINAPI DispatchTask(LPVOID pool_) {
         
         auto [task, param] = pool->GetTask();
         pool->UnLock();
-        (*task)(param);
+        TraceSpan span("task", param.from, param.to);
+        task(param);
     }
     return 0L;
 }
@@ -26,12 +28,22 @@ void RenderThreadPool::CreateThreads() {
 RenderThreadPool::RenderThreadPool(int num) noexcept {
     InitializeCriticalSection(&cs);
     threads_num = num;
-    threads_handle = new HANDLE[num];
+    threads_handle = new HANDLE[num]();
 }
 
 RenderThreadPool::~RenderThreadPool() noexcept {
     DeleteCriticalSection(&cs);
-    if (threads_handle != nullptr) delete[] threads_handle;
+    if (threads_handle != nullptr) {
+        CloseHandles();
+        delete[] threads_handle;
+    }
+}
+
+void RenderThreadPool::CloseHandles() {
+    for (int i = 0; i < threads_num; i++) {
+        if (threads_handle[i] != NULL) CloseHandle(threads_handle[i]);
+        threads_handle[i] = NULL;
+    }
 }
 
 void RenderThreadPool::Lock() { EnterCriticalSection(&cs); }
@@ -47,7 +59,10 @@ std::pair<RenderTask, RenderTaskParam> RenderThreadPool::GetTask() {
 }
 
 void RenderThreadPool::WaitForTaskEnding() {
+    TraceSpan span("wait for tasks");
     WaitForMultipleObjects(threads_num, threads_handle, TRUE, INFINITE);
+    // 线程已经退出，关闭句柄后系统才会回收线程对象
+    CloseHandles();
 }
 
 void RenderThreadPool::Dispatch() {
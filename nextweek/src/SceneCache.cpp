@@ -0,0 +1,652 @@
+﻿#include "SceneCache.hpp"
+#include "MappedFile.hpp"
+#include <fstream>
+#include <sstream>
+
+// FNV-1a 64 位哈希，每次并入 8 个字节，几百 MB 的网格文件也只需几十毫秒
+static uint64_t hash_bytes(const char* data, size_t size, uint64_t hash) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash ^= word;
+        hash *= 0x100000001b3ULL;
+    }
+    for (; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// 每个三角形的三个下标都要落在顶点数组内；法线和 UV 下标可以整体缺省，x 为负表示该三角形没有
+static bool check_indices(const std::vector<vec3i>& indices, size_t triangles_num, size_t vertices_num, bool optional) {
+    if (optional && indices.empty()) return true;
+    if (indices.size() != triangles_num) return false;
+    for (auto& idx : indices) {
+        if (optional && idx.x < 0) continue;
+        if (idx.x < 0 || idx.y < 0 || idx.z < 0 || (size_t)idx.x >= vertices_num || (size_t)idx.y >= vertices_num || (size_t)idx.z >= vertices_num) return false;
+    }
+    return true;
+}
+
+SceneCache::SceneCache(const ConfigManager& config) : config_path(config.config_path) {
+    cache_path = config_path + ".cache";
+}
+
+bool SceneCache::HashSources(const std::vector<std::string>& files, uint64_t& hash) const {
+    hash = 0xcbf29ce484222325ULL;
+    MappedFile file;
+    if (!file.Open(config_path)) return false;
+    hash = hash_bytes(file.GetData(), file.GetSize(), hash);
+    for (auto& name : files) {
+        std::stringstream ss;
+        ss << source_path << name;
+        if (!file.Open(ss.str())) return false;
+        hash = hash_bytes(name.data(), name.size(), hash);
+        hash = hash_bytes(file.GetData(), file.GetSize(), hash);
+    }
+    return true;
+}
+
+#pragma region Write
+uint32_t SceneCache::WriteImage(const std::shared_ptr<PPMImage>& image) {
+    if (image == nullptr) return NONE;
+    auto it = images.ids.find(image.get());
+    if (it != images.ids.end()) return it->second;
+
+    bool has_pixels = (image->image != nullptr || image->texels != nullptr) && image->height > 0 && image->width > 0;
+    images.Put(has_pixels ? image->height : 0);
+    images.Put(has_pixels ? image->width : 0);
+    if (has_pixels && image->image != nullptr) images.PutArray(image->image, (size_t)image->height * image->width);
+    else if (has_pixels) {
+        // 直接映射的 P6 图像没有展开的像素，逐个转换后保存
+        for (int v = 0; v < image->height; v++)
+            for (int u = 0; u < image->width; u++) images.Put(image->get_color(u, v));
+    }
+    return images.ids[image.get()] = images.count++;
+}
+
+uint32_t SceneCache::WriteNoise(const std::shared_ptr<Noise>& noise) {
+    if (noise == nullptr) return NONE;
+    auto it = noises.ids.find(noise.get());
+    if (it != noises.ids.end()) return it->second;
+
+    // 预采样网格连同采样值一起保存，恢复时不必重新采样
+    if (auto volume = std::dynamic_pointer_cast<NoiseVolume>(noise)) {
+        uint32_t source_id = WriteNoise(volume->source);
+        if (source_id == NONE || volume->samples.size() != volume->GetSamplesNum()) {
+            write_failed = true;
+            return NONE;
+        }
+        noises.Put(NoiseType::Volume);
+        noises.Put(source_id);
+        noises.Put(volume->min_p);
+        noises.Put(volume->max_p);
+        noises.Put(volume->nx);
+        noises.Put(volume->ny);
+        noises.Put(volume->nz);
+        noises.PutVector(volume->samples);
+        return noises.ids[noise.get()] = noises.count++;
+    }
+    auto perlin = std::dynamic_pointer_cast<PerlinNoise>(noise);
+    if (perlin == nullptr) {
+        write_failed = true;
+        return NONE;
+    }
+    noises.Put(NoiseType::Perlin);
+    noises.PutArray(perlin->rand_vec, PerlinNoise::CNT);
+    noises.PutArray(perlin->permutation_x, PerlinNoise::CNT);
+    noises.PutArray(perlin->permutation_y, PerlinNoise::CNT);
+    noises.PutArray(perlin->permutation_z, PerlinNoise::CNT);
+    return noises.ids[noise.get()] = noises.count++;
+}
+
+uint32_t SceneCache::WriteTexture(const std::shared_ptr<Texture>& texture) {
+    if (texture == nullptr) return NONE;
+    auto it = textures.ids.find(texture.get());
+    if (it != textures.ids.end()) return it->second;
+
+    // 先写被引用的对象，读取时按顺序恢复即可
+    if (auto solid = std::dynamic_pointer_cast<SolidTexture>(texture)) {
+        textures.Put(TextureType::Solid);
+        textures.Put(solid->texture_color);
+    }
+    else if (auto checker = std::dynamic_pointer_cast<CheckerTexture>(texture)) {
+        uint32_t even = WriteTexture(checker->even);
+        uint32_t odd = WriteTexture(checker->odd);
+        textures.Put(TextureType::Checker);
+        textures.Put(even);
+        textures.Put(odd);
+    }
+    else if (auto noise = std::dynamic_pointer_cast<NoiseTexture>(texture)) {
+        uint32_t noise_id = WriteNoise(noise->noise);
+        textures.Put(TextureType::Noise);
+        textures.Put(noise_id);
+        textures.Put(noise->color);
+        textures.Put(noise->scale);
+    }
+    else if (auto image = std::dynamic_pointer_cast<ImageTexture>(texture)) {
+        // 分块纹理只记录文件名，恢复时重新打开分块文件
+        if (image->tiled != nullptr) {
+            textures.Put(TextureType::Tiled);
+            textures.PutString(image->tiled->GetFileName());
+            return textures.ids[texture.get()] = textures.count++;
+        }
+        // 图像纹理只保留了 MIP 金字塔，按原样保存，恢复时不必重新生成
+        auto& mipmap = image->mipmap;
+        if (mipmap == nullptr) {
+            write_failed = true;
+            return NONE;
+        }
+        textures.Put(TextureType::Image);
+        textures.Put((uint8_t)mipmap->is_half);
+        textures.PutVector(mipmap->levels);
+        textures.PutVector(mipmap->texels8);
+        textures.PutVector(mipmap->texels16);
+    }
+    else {
+        write_failed = true;
+        return NONE;
+    }
+    return textures.ids[texture.get()] = textures.count++;
+}
+
+uint32_t SceneCache::WriteMaterial(const std::shared_ptr<Material>& material) {
+    if (material == nullptr) return NONE;
+    auto it = materials.ids.find(material.get());
+    if (it != materials.ids.end()) return it->second;
+
+    uint32_t texture_id = WriteTexture(material->texture);
+    if (std::dynamic_pointer_cast<Lambertian>(material)) {
+        materials.Put(MaterialType::Lambertian);
+        materials.Put(texture_id);
+    }
+    else if (auto metal = std::dynamic_pointer_cast<Metal>(material)) {
+        materials.Put(MaterialType::Metal);
+        materials.Put(texture_id);
+        materials.Put(metal->fuzz);
+    }
+    else if (auto dielectrics = std::dynamic_pointer_cast<Dielectrics>(material)) {
+        materials.Put(MaterialType::Dielectrics);
+        materials.Put(dielectrics->get_refraction_eta());
+    }
+    else if (std::dynamic_pointer_cast<DiffuseLight>(material)) {
+        materials.Put(MaterialType::DiffuseLight);
+        materials.Put(texture_id);
+    }
+    else {
+        write_failed = true;
+        return NONE;
+    }
+    return materials.ids[material.get()] = materials.count++;
+}
+
+uint32_t SceneCache::WriteMesh(const std::shared_ptr<MeshData>& mesh) {
+    if (mesh == nullptr) return NONE;
+    auto it = meshes.ids.find(mesh.get());
+    if (it != meshes.ids.end()) return it->second;
+
+    meshes.PutVector(mesh->positions);
+    meshes.PutVector(mesh->normals);
+    meshes.PutVector(mesh->uvs);
+    meshes.PutVector(mesh->position_indices);
+    meshes.PutVector(mesh->normal_indices);
+    meshes.PutVector(mesh->uv_indices);
+    return meshes.ids[mesh.get()] = meshes.count++;
+}
+
+uint32_t SceneCache::WriteHittable(const std::shared_ptr<Hittable>& obj) {
+    if (obj == nullptr) return NONE;
+    auto it = hittables.ids.find(obj.get());
+    if (it != hittables.ids.end()) return it->second;
+
+    uint32_t material_id = WriteMaterial(obj->get_material());
+    if (auto node = std::dynamic_pointer_cast<BVH_Node>(obj)) {
+        uint32_t left = WriteHittable(node->left);
+        uint32_t right = WriteHittable(node->right);
+        hittables.Put(HittableType::BVHNode);
+        hittables.Put(left);
+        hittables.Put(right);
+        hittables.Put(node->box.get_min_point());
+        hittables.Put(node->box.get_max_point());
+        hittables.Put((uint8_t)node->is_dynamic);
+        hittables.Put(node->box0.get_min_point());
+        hittables.Put(node->box0.get_max_point());
+        hittables.Put(node->box1.get_min_point());
+        hittables.Put(node->box1.get_max_point());
+        hittables.Put(node->time0);
+        hittables.Put(node->time1);
+    }
+    else if (auto instance = std::dynamic_pointer_cast<Instance>(obj)) {
+        uint32_t prototype = WriteHittable(instance->GetPrototype());
+        hittables.Put(HittableType::Instance);
+        hittables.Put(prototype);
+        hittables.Put(instance->GetTransform());
+    }
+    else if (auto mesh = std::dynamic_pointer_cast<Mesh>(obj)) {
+        uint32_t data = WriteMesh(mesh->data);
+        hittables.Put(HittableType::Mesh);
+        hittables.Put(material_id);
+        hittables.Put(data);
+        hittables.PutVector(mesh->nodes);
+        hittables.PutVector(mesh->triangles);
+    }
+    else if (auto moving_sphere = std::dynamic_pointer_cast<MovingSphere>(obj)) {
+        hittables.Put(HittableType::MovingSphere);
+        hittables.Put(material_id);
+        hittables.Put(moving_sphere->o);
+        hittables.Put(moving_sphere->o_move_dir);
+        hittables.Put(moving_sphere->get_radius());
+        hittables.Put(moving_sphere->t1);
+        hittables.Put(moving_sphere->t2);
+    }
+    else if (auto sphere = std::dynamic_pointer_cast<Sphere>(obj)) {
+        hittables.Put(HittableType::Sphere);
+        hittables.Put(material_id);
+        hittables.Put(sphere->get_origin(0.));
+        hittables.Put(sphere->get_radius());
+    }
+    else if (auto plane = std::dynamic_pointer_cast<Plane>(obj)) {
+        hittables.Put(HittableType::Plane);
+        hittables.Put(material_id);
+        hittables.Put(plane->o);
+        hittables.Put(plane->n);
+    }
+    else if (auto box = std::dynamic_pointer_cast<Box>(obj)) {
+        hittables.Put(HittableType::Box);
+        hittables.Put(material_id);
+        hittables.Put(box->pmin);
+        hittables.Put(box->pmax);
+    }
+    else if (auto rect = std::dynamic_pointer_cast<Rect<0>>(obj)) {
+        hittables.Put(HittableType::RectX);
+        hittables.Put(material_id);
+        hittables.Put(rect->p1);
+        hittables.Put(rect->p2);
+    }
+    else if (auto rect = std::dynamic_pointer_cast<Rect<1>>(obj)) {
+        hittables.Put(HittableType::RectY);
+        hittables.Put(material_id);
+        hittables.Put(rect->p1);
+        hittables.Put(rect->p2);
+    }
+    else if (auto rect = std::dynamic_pointer_cast<Rect<2>>(obj)) {
+        hittables.Put(HittableType::RectZ);
+        hittables.Put(material_id);
+        hittables.Put(rect->p1);
+        hittables.Put(rect->p2);
+    }
+    else {
+        write_failed = true;
+        return NONE;
+    }
+    return hittables.ids[obj.get()] = hittables.count++;
+}
+
+bool SceneCache::Save(const ConfigManager& config, const std::vector<std::shared_ptr<Hittable>>& objs,
+    const std::shared_ptr<Accelerator>& accelerator_) {
+    DWORD start_time = GetTickCount();
+    uint64_t hash;
+    if (!HashSources(config.referenced_files, hash)) {
+        std::cerr << "scene cache: cannot read source files of " << config_path << std::endl;
+        return false;
+    }
+    images = noises = textures = materials = meshes = hittables = Table();
+    write_failed = false;
+
+    Table scene;
+    scene.Put(config.window_ar);
+    scene.Put(config.window_w);
+    scene.Put(config.window_h);
+    scene.Put(config.bgcolor);
+    scene.Put(config.env_scale);
+    scene.Put(config.frames_num);
+    scene.Put(config.frame_time);
+    scene.PutString(config.output_file);
+    scene.Put(config.accelerator_type);
+    scene.Put(config.light_sampling);
+    scene.Put((uint8_t)config.light_bench);
+    scene.Put((uint8_t)config.accel_bench);
+    scene.Put((uint8_t)config.noise_bench);
+    scene.Put((uint8_t)(config.camera != nullptr));
+    if (config.camera != nullptr) scene.Put(*config.camera);
+    scene.Put(WriteImage(config.env_image));
+    auto& irradiance_cache = config.irradiance_cache;
+    scene.Put((uint8_t)(irradiance_cache != nullptr));
+    if (irradiance_cache != nullptr) {
+        scene.Put(irradiance_cache->samples);
+        scene.Put(irradiance_cache->a);
+        scene.Put(irradiance_cache->min_r);
+        scene.Put(irradiance_cache->max_r);
+    }
+    scene.Put((uint32_t)objs.size());
+    for (auto& obj : objs) scene.Put(WriteHittable(obj));
+    // 只有 BVH 的构建耗时值得保存，其余加速结构读取后重新构建
+    auto bvh = std::dynamic_pointer_cast<BVHAccelerator>(accelerator_);
+    scene.Put((uint8_t)(bvh != nullptr));
+    if (bvh != nullptr) {
+        scene.Put(WriteHittable(bvh->static_bvh));
+        scene.Put(WriteHittable(bvh->dynamic_bvh));
+    }
+    if (write_failed) {
+        std::cerr << "scene cache: the scene contains objects that cannot be cached\n";
+        return false;
+    }
+
+    Table header;
+    header.Put(MAGIC);
+    header.Put(VERSION);
+    header.Put(hash);
+    header.Put((uint32_t)config.referenced_files.size());
+    for (auto& name : config.referenced_files) header.PutString(name);
+    header.Put((uint64_t)config.texture_cache_size);
+
+    std::ofstream f(cache_path, std::ios::binary);
+    if (!f.is_open()) {
+        std::cerr << cache_path << " cannot be open.\n";
+        return false;
+    }
+    f.write(header.bytes.data(), header.bytes.size());
+    for (auto table : { &images, &noises, &textures, &materials, &meshes, &hittables }) {
+        f.write((const char*)&table->count, sizeof(table->count));
+        f.write(table->bytes.data(), table->bytes.size());
+    }
+    f.write(scene.bytes.data(), scene.bytes.size());
+    f.close();
+    std::cout << "scene cache: save " << hittables.count << " objects in " << (GetTickCount() - start_time) * 1.0 / 1000 << "s" << std::endl;
+
+    images = noises = textures = materials = meshes = hittables = Table();
+    return !f.fail();
+}
+#pragma endregion Write
+
+#pragma region Read
+bool SceneCache::ReadImages(Reader& in) {
+    uint32_t count = in.Get<uint32_t>();
+    for (uint32_t i = 0; i < count && in.ok; i++) {
+        int h = in.Get<int>();
+        int w = in.Get<int>();
+        if (h > 0 && w > 0) {
+            if ((size_t)(in.end - in.p) / sizeof(Color) < (size_t)h * w) return false;
+            auto image = std::make_shared<PPMImage>(h, w);
+            in.GetArray(image->image, (size_t)h * w);
+            loaded_images.push_back(image);
+        }
+        else loaded_images.push_back(std::make_shared<PPMImage>());
+    }
+    return in.ok;
+}
+
+bool SceneCache::ReadNoises(Reader& in) {
+    uint32_t count = in.Get<uint32_t>();
+    for (uint32_t i = 0; i < count && in.ok; i++) {
+        auto type = in.Get<NoiseType>();
+        if (type == NoiseType::Volume) {
+            auto volume = std::shared_ptr<NoiseVolume>(new NoiseVolume());
+            if (!GetRef(loaded_noises, in.Get<uint32_t>(), volume->source) || volume->source == nullptr) return false;
+            volume->min_p = in.Get<point3d>();
+            volume->max_p = in.Get<point3d>();
+            volume->nx = in.Get<int>();
+            volume->ny = in.Get<int>();
+            volume->nz = in.Get<int>();
+            in.GetVector(volume->samples);
+            if (volume->nx < 2 || volume->ny < 2 || volume->nz < 2 || volume->samples.size() != volume->GetSamplesNum()) return false;
+            volume->UpdateCell();
+            loaded_noises.push_back(volume);
+            continue;
+        }
+        if (type != NoiseType::Perlin) return false;
+        auto perlin = std::make_shared<PerlinNoise>(false);
+        in.GetArray(perlin->rand_vec, PerlinNoise::CNT);
+        in.GetArray(perlin->permutation_x, PerlinNoise::CNT);
+        in.GetArray(perlin->permutation_y, PerlinNoise::CNT);
+        in.GetArray(perlin->permutation_z, PerlinNoise::CNT);
+        perlin->UpdateGradients();
+        loaded_noises.push_back(perlin);
+    }
+    return in.ok;
+}
+
+bool SceneCache::ReadTextures(Reader& in) {
+    uint32_t count = in.Get<uint32_t>();
+    for (uint32_t i = 0; i < count && in.ok; i++) {
+        auto type = in.Get<TextureType>();
+        std::shared_ptr<Texture> texture;
+        if (type == TextureType::Solid) texture = std::make_shared<SolidTexture>(in.Get<Color>());
+        else if (type == TextureType::Checker) {
+            std::shared_ptr<Texture> even, odd;
+            if (!GetRef(loaded_textures, in.Get<uint32_t>(), even) || !GetRef(loaded_textures, in.Get<uint32_t>(), odd)) return false;
+            texture = std::make_shared<CheckerTexture>(even, odd);
+        }
+        else if (type == TextureType::Noise) {
+            std::shared_ptr<Noise> noise;
+            if (!GetRef(loaded_noises, in.Get<uint32_t>(), noise)) return false;
+            Color color = in.Get<Color>();
+            double scale = in.Get<double>();
+            texture = std::make_shared<NoiseTexture>(noise, color, scale);
+        }
+        else if (type == TextureType::Image) {
+            auto mipmap = std::shared_ptr<MipMap>(new MipMap());
+            mipmap->is_half = in.Get<uint8_t>() != 0;
+            in.GetVector(mipmap->levels);
+            in.GetVector(mipmap->texels8);
+            in.GetVector(mipmap->texels16);
+            // 检查每一层都落在纹素数组内，避免损坏的缓存导致越界读取
+            size_t texels_num = mipmap->is_half ? mipmap->texels16.size() / 3 : mipmap->texels8.size();
+            for (auto& level : mipmap->levels) {
+                if (level.width <= 0 || level.height <= 0 || level.offset > texels_num
+                    || (size_t)level.width * level.height > texels_num - level.offset) return false;
+            }
+            texture = std::make_shared<ImageTexture>(mipmap);
+        }
+        else if (type == TextureType::Tiled) {
+            auto tiled = TiledImage::Open(in.GetString(), texture_cache);
+            if (tiled == nullptr) return false;
+            texture = std::make_shared<ImageTexture>(tiled);
+        }
+        else return false;
+        loaded_textures.push_back(texture);
+    }
+    return in.ok;
+}
+
+bool SceneCache::ReadMaterials(Reader& in) {
+    uint32_t count = in.Get<uint32_t>();
+    for (uint32_t i = 0; i < count && in.ok; i++) {
+        auto type = in.Get<MaterialType>();
+        std::shared_ptr<Material> material;
+        std::shared_ptr<Texture> texture;
+        if (type == MaterialType::Dielectrics) material = std::make_shared<Dielectrics>(in.Get<double>());
+        else if (!GetRef(loaded_textures, in.Get<uint32_t>(), texture) || texture == nullptr) return false;
+        else if (type == MaterialType::Lambertian) material = std::make_shared<Lambertian>(texture);
+        else if (type == MaterialType::Metal) material = std::make_shared<Metal>(texture, in.Get<double>());
+        else if (type == MaterialType::DiffuseLight) material = std::make_shared<DiffuseLight>(texture);
+        else return false;
+        loaded_materials.push_back(material);
+    }
+    return in.ok;
+}
+
+bool SceneCache::ReadMeshes(Reader& in) {
+    uint32_t count = in.Get<uint32_t>();
+    for (uint32_t i = 0; i < count && in.ok; i++) {
+        auto mesh = std::make_shared<MeshData>();
+        in.GetVector(mesh->positions);
+        in.GetVector(mesh->normals);
+        in.GetVector(mesh->uvs);
+        in.GetVector(mesh->position_indices);
+        in.GetVector(mesh->normal_indices);
+        in.GetVector(mesh->uv_indices);
+        size_t triangles_num = mesh->position_indices.size();
+        if (!check_indices(mesh->position_indices, triangles_num, mesh->positions.size(), false)
+            || !check_indices(mesh->normal_indices, triangles_num, mesh->normals.size(), true)
+            || !check_indices(mesh->uv_indices, triangles_num, mesh->uvs.size(), true)) return false;
+        loaded_meshes.push_back(mesh);
+    }
+    return in.ok;
+}
+
+bool SceneCache::ReadHittables(Reader& in) {
+    uint32_t count = in.Get<uint32_t>();
+    for (uint32_t i = 0; i < count && in.ok; i++) {
+        auto type = in.Get<HittableType>();
+        std::shared_ptr<Hittable> obj;
+        if (type == HittableType::BVHNode) {
+            auto node = std::make_shared<BVH_Node>();
+            if (!GetRef(loaded_hittables, in.Get<uint32_t>(), node->left) || !GetRef(loaded_hittables, in.Get<uint32_t>(), node->right)) return false;
+            if (node->left == nullptr || node->right == nullptr) return false;
+            point3d bmin = in.Get<point3d>();
+            node->box = AABB(bmin, in.Get<point3d>());
+            node->is_dynamic = in.Get<uint8_t>() != 0;
+            bmin = in.Get<point3d>();
+            node->box0 = AABB(bmin, in.Get<point3d>());
+            bmin = in.Get<point3d>();
+            node->box1 = AABB(bmin, in.Get<point3d>());
+            node->time0 = in.Get<double>();
+            node->time1 = in.Get<double>();
+            obj = node;
+        }
+        else if (type == HittableType::Instance) {
+            std::shared_ptr<Hittable> prototype;
+            if (!GetRef(loaded_hittables, in.Get<uint32_t>(), prototype) || prototype == nullptr) return false;
+            obj = std::make_shared<Instance>(prototype, in.Get<Transform>());
+        }
+        else {
+            std::shared_ptr<Material> material;
+            if (!GetRef(loaded_materials, in.Get<uint32_t>(), material) || material == nullptr) return false;
+            if (type == HittableType::Mesh) {
+                auto mesh = std::shared_ptr<Mesh>(new Mesh());
+                if (!GetRef(loaded_meshes, in.Get<uint32_t>(), mesh->data) || mesh->data == nullptr) return false;
+                mesh->material = material;
+                in.GetVector(mesh->nodes);
+                in.GetVector(mesh->triangles);
+                if (!in.ok || !mesh->CheckTree()) return false;
+                obj = mesh;
+            }
+            else if (type == HittableType::MovingSphere) {
+                point3d o = in.Get<point3d>();
+                vec3d move_dir = in.Get<vec3d>();
+                double r = in.Get<double>();
+                double t1 = in.Get<double>();
+                double t2 = in.Get<double>();
+                auto moving_sphere = std::make_shared<MovingSphere>(t1, o, t2, o + move_dir, r, material);
+                moving_sphere->o_move_dir = move_dir;
+                obj = moving_sphere;
+            }
+            else if (type == HittableType::Sphere) {
+                point3d o = in.Get<point3d>();
+                obj = std::make_shared<Sphere>(o, in.Get<double>(), material);
+            }
+            else if (type == HittableType::Plane) {
+                point3d o = in.Get<point3d>();
+                obj = std::make_shared<Plane>(o, in.Get<vec3d>(), material);
+            }
+            else if (type == HittableType::Box) {
+                point3d p1 = in.Get<point3d>();
+                obj = std::make_shared<Box>(p1, in.Get<point3d>(), material);
+            }
+            else if (type == HittableType::RectX || type == HittableType::RectY || type == HittableType::RectZ) {
+                point3d p1 = in.Get<point3d>();
+                point3d p2 = in.Get<point3d>();
+                if (type == HittableType::RectX) obj = std::make_shared<Rect<0>>(p1, p2, material);
+                else if (type == HittableType::RectY) obj = std::make_shared<Rect<1>>(p1, p2, material);
+                else obj = std::make_shared<Rect<2>>(p1, p2, material);
+            }
+            else return false;
+        }
+        loaded_hittables.push_back(obj);
+    }
+    return in.ok;
+}
+
+bool SceneCache::Load(ConfigManager& config) {
+    MappedFile file;
+    if (!file.Open(cache_path)) return false;
+    DWORD start_time = GetTickCount();
+
+    Reader in{ file.GetData(), file.GetData() + file.GetSize() };
+    if (in.Get<uint32_t>() != MAGIC || in.Get<uint32_t>() != VERSION) {
+        std::cout << "scene cache: " << cache_path << " version mismatch, rebuild.\n";
+        return false;
+    }
+    uint64_t hash = in.Get<uint64_t>();
+    std::vector<std::string> files;
+    uint32_t files_num = in.Get<uint32_t>();
+    for (uint32_t i = 0; i < files_num && in.ok; i++) files.push_back(in.GetString());
+    uint64_t source_hash;
+    if (!in.ok || !HashSources(files, source_hash) || source_hash != hash) {
+        std::cout << "scene cache: " << cache_path << " is out of date, rebuild.\n";
+        return false;
+    }
+    // 纹理缓存要在读取纹理之前建立
+    uint64_t texture_cache_size = in.Get<uint64_t>();
+    texture_cache = texture_cache_size > 0 ? std::make_shared<TextureCache>((size_t)texture_cache_size) : nullptr;
+
+    bool ok = ReadImages(in) && ReadNoises(in) && ReadTextures(in) && ReadMaterials(in) && ReadMeshes(in) && ReadHittables(in);
+    ConfigManager loaded;
+    if (ok) {
+        loaded.window_ar = in.Get<double>();
+        loaded.window_w = in.Get<double>();
+        loaded.window_h = in.Get<double>();
+        loaded.bgcolor = in.Get<Color>();
+        loaded.env_scale = in.Get<double>();
+        loaded.frames_num = in.Get<int>();
+        loaded.frame_time = in.Get<double>();
+        loaded.output_file = in.GetString();
+        loaded.accelerator_type = in.Get<AcceleratorType>();
+        loaded.light_sampling = in.Get<LightSampling>();
+        loaded.light_bench = in.Get<uint8_t>() != 0;
+        loaded.accel_bench = in.Get<uint8_t>() != 0;
+        loaded.noise_bench = in.Get<uint8_t>() != 0;
+        if (in.Get<uint8_t>() != 0) loaded.camera = std::make_shared<Camera>(in.Get<Camera>());
+        ok = GetRef(loaded_images, in.Get<uint32_t>(), loaded.env_image);
+        if (in.Get<uint8_t>() != 0) {
+            int samples = in.Get<int>();
+            double a = in.Get<double>();
+            double min_r = in.Get<double>();
+            double max_r = in.Get<double>();
+            loaded.irradiance_cache = std::make_shared<IrradianceCache>(samples, a, min_r, max_r);
+        }
+        uint32_t objs_num = in.Get<uint32_t>();
+        for (uint32_t i = 0; i < objs_num && ok && in.ok; i++) {
+            std::shared_ptr<Hittable> obj;
+            ok = GetRef(loaded_hittables, in.Get<uint32_t>(), obj) && obj != nullptr;
+            loaded.objs.push_back(obj);
+        }
+        if (ok && in.Get<uint8_t>() != 0) {
+            std::shared_ptr<Hittable> static_bvh, dynamic_bvh;
+            ok = GetRef(loaded_hittables, in.Get<uint32_t>(), static_bvh) && GetRef(loaded_hittables, in.Get<uint32_t>(), dynamic_bvh);
+            auto bvh = std::shared_ptr<BVHAccelerator>(new BVHAccelerator());
+            bvh->static_bvh = std::dynamic_pointer_cast<BVH_Node>(static_bvh);
+            bvh->dynamic_bvh = std::dynamic_pointer_cast<BVH_Node>(dynamic_bvh);
+            accelerator = bvh;
+        }
+        ok = ok && in.ok && loaded.camera != nullptr;
+    }
+    size_t objs_num = loaded_hittables.size();
+    loaded_images.clear();
+    loaded_noises.clear();
+    loaded.textures = loaded_textures;
+    loaded_textures.clear();
+    loaded.materials = loaded_materials;
+    loaded_materials.clear();
+    loaded_meshes.clear();
+    loaded_hittables.clear();
+    loaded.texture_cache_size = (size_t)texture_cache_size;
+    loaded.texture_cache = texture_cache;
+    texture_cache = nullptr;
+    if (!ok) {
+        accelerator = nullptr;
+        std::cerr << "scene cache: " << cache_path << " is corrupted, rebuild.\n";
+        return false;
+    }
+
+    loaded.config_path = config.config_path;
+    loaded.referenced_files = files;
+    loaded.scene_cache = true;
+    config = std::move(loaded);
+    std::cout << "scene cache: load " << objs_num << " objects in " << (GetTickCount() - start_time) * 1.0 / 1000 << "s" << std::endl;
+    return true;
+}
+#pragma endregion Read
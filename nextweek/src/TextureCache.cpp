@@ -0,0 +1,314 @@
+﻿#include "TextureCache.hpp"
+#include "MappedFile.hpp"
+#include "project_path.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+static constexpr double INV_255 = 1. / 255.;
+static constexpr int TILE_SIZE = TextureCache::TILE_SIZE;
+
+#pragma region TextureCache
+// 纹素只有 4 字节和 6 字节两种，分开写让 memcpy 的长度是常量
+static inline void copy_texels(const unsigned char* tile, const int* offsets, int n, int texel_bytes, unsigned char* out) {
+    if (texel_bytes == 4) {
+        for (int i = 0; i < n; i++) memcpy(out + i * 4, tile + offsets[i], 4);
+    }
+    else {
+        for (int i = 0; i < n; i++) memcpy(out + i * 6, tile + offsets[i], 6);
+    }
+}
+
+TextureCache::TextureCache(size_t capacity) : clock(0), images_num(0) {
+    // 组数取 2 的幂，组号用位与求得
+    sets_num = 1;
+    while (sets_num * 2 * WAYS * TILE_BYTES <= capacity) sets_num *= 2;
+    sets.reset(new Set[sets_num]);
+    tiles.reset(new unsigned char[sets_num * WAYS * TILE_BYTES]);
+    for (size_t i = 0; i < sets_num; i++) {
+        for (int w = 0; w < WAYS; w++) {
+            sets[i].keys[w].store(0, std::memory_order_relaxed);
+            sets[i].versions[w].store(0, std::memory_order_relaxed);
+            sets[i].last_use[w].store(0, std::memory_order_relaxed);
+        }
+    }
+    for (auto& shard : shards) {
+        InitializeCriticalSection(&shard.cs);
+        shard.hits.store(0, std::memory_order_relaxed);
+        shard.misses.store(0, std::memory_order_relaxed);
+        shard.evictions.store(0, std::memory_order_relaxed);
+    }
+}
+
+TextureCache::~TextureCache() {
+    for (auto& shard : shards) DeleteCriticalSection(&shard.cs);
+}
+
+void TextureCache::Read(uint64_t key, const char* source, size_t tile_bytes, const int* offsets, int n, int texel_bytes, unsigned char* out) {
+    // 相邻的 tile 编号相近，乘一个奇数打散后再取组号
+    size_t set_index = (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 20) & (sets_num - 1);
+    Set& set = sets[set_index];
+    Shard& shard = shards[set_index % SHARDS_NUM];
+
+    // 命中：版本号为偶数且前后一致时，读到的纹素属于 key 对应的 tile
+    for (int w = 0; w < WAYS; w++) {
+        uint32_t version = set.versions[w].load(std::memory_order_acquire);
+        if ((version & 1) != 0 || set.keys[w].load(std::memory_order_relaxed) != key) continue;
+        const unsigned char* tile = GetTile(set_index, w);
+        copy_texels(tile, offsets, n, texel_bytes, out);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (set.versions[w].load(std::memory_order_relaxed) != version) break;
+        uint32_t now = clock.load(std::memory_order_relaxed);
+        if (set.last_use[w].load(std::memory_order_relaxed) != now) set.last_use[w].store(now, std::memory_order_relaxed);
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // 未命中：加锁后重新查找一次，其他线程可能刚把同一个 tile 读进来
+    EnterCriticalSection(&shard.cs);
+    int way = -1;
+    for (int w = 0; w < WAYS && way < 0; w++) {
+        if (set.keys[w].load(std::memory_order_relaxed) == key) way = w;
+    }
+    if (way >= 0) shard.hits.fetch_add(1, std::memory_order_relaxed);
+    else {
+        // 优先使用空位，否则淘汰距上次使用最久的一路
+        uint32_t now = clock.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint32_t oldest = 0;
+        for (int w = 0; w < WAYS; w++) {
+            if (set.keys[w].load(std::memory_order_relaxed) == 0) {
+                way = w;
+                break;
+            }
+            uint32_t age = now - set.last_use[w].load(std::memory_order_relaxed);
+            if (way < 0 || age > oldest) way = w, oldest = age;
+        }
+        if (set.keys[way].load(std::memory_order_relaxed) != 0) shard.evictions.fetch_add(1, std::memory_order_relaxed);
+        uint32_t version = set.versions[way].load(std::memory_order_relaxed);
+        set.versions[way].store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        set.keys[way].store(key, std::memory_order_relaxed);
+        memcpy(GetTile(set_index, way), source, tile_bytes);
+        set.versions[way].store(version + 2, std::memory_order_release);
+        set.last_use[way].store(now, std::memory_order_relaxed);
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    // 持有锁时没有其他线程写入这一组，可以直接读
+    copy_texels(GetTile(set_index, way), offsets, n, texel_bytes, out);
+    LeaveCriticalSection(&shard.cs);
+}
+
+void TextureCache::PrintStatistics() const {
+    uint64_t hits = 0, misses = 0, evictions = 0;
+    for (auto& shard : shards) {
+        hits += shard.hits.load(std::memory_order_relaxed);
+        misses += shard.misses.load(std::memory_order_relaxed);
+        evictions += shard.evictions.load(std::memory_order_relaxed);
+    }
+    uint64_t total = hits + misses;
+    std::cout << "texture cache: " << images_num.load() << " images, " << sets_num * WAYS << " tiles (" << GetCapacity() / 1024
+              << " KB), hits = " << hits << ", misses = " << misses << ", hit rate = " << (total > 0 ? hits * 100.0 / total : 0.)
+              << "%, evictions = " << evictions << std::endl;
+}
+#pragma endregion TextureCache
+
+#pragma region TiledImage
+// 分块文件：文件头、每层的描述，之后依次是各层的 tile，每个 tile 固定 TILE_SIZE x TILE_SIZE 个纹素，超出图像的部分补 0
+static constexpr uint32_t TILES_MAGIC = 0x4c495452; // "RTIL"
+static constexpr uint32_t TILES_VERSION = 1;
+
+struct TilesHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_size;
+    int64_t source_time;
+    uint32_t is_half;
+    uint32_t levels_num;
+};
+
+struct TilesLevel {
+    int32_t width, height;
+    int32_t tiles_x, tiles_y;
+    uint64_t first_tile;
+};
+
+static std::string get_tiles_path(const std::string& path) {
+    return path + ".tiles";
+}
+
+// 用图像文件的大小和修改时间判断分块文件是否过期
+static bool get_source_stamp(const std::string& path, uint64_t& size, int64_t& time) {
+    std::error_code ec;
+    size = std::filesystem::file_size(path, ec);
+    if (ec) return false;
+    auto t = std::filesystem::last_write_time(path, ec);
+    if (ec) return false;
+    time = (int64_t)t.time_since_epoch().count();
+    return true;
+}
+
+TiledImage::TiledImage(const std::string& file_name_, const std::shared_ptr<TextureCache>& cache_) : file_name(file_name_), cache(cache_) {
+    id = cache->RegisterImage();
+}
+
+std::shared_ptr<TiledImage> TiledImage::Open(const std::string& file_name, const std::shared_ptr<TextureCache>& cache) {
+    std::string path = source_path + file_name;
+    uint64_t source_size;
+    int64_t source_time;
+    if (cache == nullptr || !get_source_stamp(path, source_size, source_time)) return nullptr;
+
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(get_tiles_path(path))) return nullptr;
+    const char* data = file->GetData();
+    size_t size = file->GetSize();
+    TilesHeader header;
+    if (size < sizeof(header)) return nullptr;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != TILES_MAGIC || header.version != TILES_VERSION || header.source_size != source_size
+        || header.source_time != source_time || header.levels_num == 0 || header.levels_num > 32) return nullptr;
+    size_t levels_end = sizeof(header) + header.levels_num * sizeof(TilesLevel);
+    if (size < levels_end) return nullptr;
+
+    auto tiled = std::make_shared<TiledImage>(file_name, cache);
+    tiled->is_half = header.is_half != 0;
+    tiled->tile_bytes = (size_t)TILE_SIZE * TILE_SIZE * (tiled->is_half ? 6 : 4);
+    // 检查每一层的 tile 都在文件内，避免损坏的文件导致越界读取
+    size_t tiles_num = (size - levels_end) / tiled->tile_bytes;
+    for (uint32_t i = 0; i < header.levels_num; i++) {
+        TilesLevel l;
+        memcpy(&l, data + sizeof(header) + i * sizeof(l), sizeof(l));
+        if (l.width <= 0 || l.height <= 0 || l.tiles_x != (l.width + TILE_SIZE - 1) / TILE_SIZE
+            || l.tiles_y != (l.height + TILE_SIZE - 1) / TILE_SIZE || l.first_tile > tiles_num
+            || (uint64_t)l.tiles_x * l.tiles_y > tiles_num - l.first_tile) return nullptr;
+        tiled->levels.push_back({ l.width, l.height, l.tiles_x, l.tiles_y, l.first_tile });
+    }
+    tiled->tiles = data + levels_end;
+    tiled->file = file;
+    return tiled;
+}
+
+std::shared_ptr<TiledImage> TiledImage::Create(const std::string& file_name, const MipMap& mipmap, const std::shared_ptr<TextureCache>& cache) {
+    std::string path = source_path + file_name;
+    TilesHeader header = { TILES_MAGIC, TILES_VERSION, 0, 0, (uint32_t)mipmap.is_half, (uint32_t)mipmap.levels.size() };
+    if (cache == nullptr || mipmap.levels.empty() || !get_source_stamp(path, header.source_size, header.source_time)) return nullptr;
+
+    // 先写到临时文件再改名，同一张图像被多次引用时不会读到写了一半的文件
+    std::string tiles_path = get_tiles_path(path);
+    std::string temp_path = tiles_path + "." + std::to_string(GetCurrentThreadId());
+    std::ofstream f(temp_path, std::ios::binary);
+    if (!f.is_open()) {
+        std::cerr << temp_path << " cannot be open.\n";
+        return nullptr;
+    }
+    f.write((const char*)&header, sizeof(header));
+    uint64_t first_tile = 0;
+    for (auto& level : mipmap.levels) {
+        TilesLevel l = { level.width, level.height, (level.width + TILE_SIZE - 1) / TILE_SIZE, (level.height + TILE_SIZE - 1) / TILE_SIZE, first_tile };
+        f.write((const char*)&l, sizeof(l));
+        first_tile += (uint64_t)l.tiles_x * l.tiles_y;
+    }
+    int texel_bytes = mipmap.is_half ? 6 : 4;
+    std::vector<char> tile((size_t)TILE_SIZE * TILE_SIZE * texel_bytes);
+    for (auto& level : mipmap.levels) {
+        for (int ty = 0; ty < level.height; ty += TILE_SIZE) {
+            for (int tx = 0; tx < level.width; tx += TILE_SIZE) {
+                std::fill(tile.begin(), tile.end(), 0);
+                int w = std::min(TILE_SIZE, level.width - tx), h = std::min(TILE_SIZE, level.height - ty);
+                for (int y = 0; y < h; y++) {
+                    size_t src = level.offset + (size_t)(ty + y) * level.width + tx;
+                    char* dst = &tile[(size_t)y * TILE_SIZE * texel_bytes];
+                    if (mipmap.is_half) memcpy(dst, &mipmap.texels16[src * 3], (size_t)w * texel_bytes);
+                    else memcpy(dst, &mipmap.texels8[src], (size_t)w * texel_bytes);
+                }
+                f.write(tile.data(), tile.size());
+            }
+        }
+    }
+    f.close();
+    std::error_code ec;
+    if (f.fail()) {
+        std::cerr << temp_path << " write failed.\n";
+        std::filesystem::remove(temp_path, ec);
+        return nullptr;
+    }
+    // 目标文件已被其他线程生成并映射时改名会失败，直接使用已有的文件
+    std::filesystem::rename(temp_path, tiles_path, ec);
+    if (ec) std::filesystem::remove(temp_path, ec);
+    return Open(file_name, cache);
+}
+
+// 8 位纹素的分量先按 0~255 累加，最后统一乘 1 / 255
+template<bool half>
+static inline void accumulate(const unsigned char* texel, float w, float* rgb);
+
+template<>
+inline void accumulate<false>(const unsigned char* texel, float w, float* rgb) {
+    uint32_t t;
+    memcpy(&t, texel, sizeof(t));
+    rgb[0] += w * (float)(t & 0xff);
+    rgb[1] += w * (float)((t >> 8) & 0xff);
+    rgb[2] += w * (float)((t >> 16) & 0xff);
+}
+
+template<>
+inline void accumulate<true>(const unsigned char* texel, float w, float* rgb) {
+    uint16_t p[3];
+    memcpy(p, texel, sizeof(p));
+    rgb[0] += w * MipMap::HalfToFloat(p[0]);
+    rgb[1] += w * MipMap::HalfToFloat(p[1]);
+    rgb[2] += w * MipMap::HalfToFloat(p[2]);
+}
+
+// 与 MipMap::Bilinear 相同，四个纹素中落在同一个 tile 里的一次读出
+template<bool half>
+inline void TiledImage::Bilinear(int level, double s, double t, float weight, float* rgb) const {
+    const Level& l = levels[level];
+    int x[2], y[2];
+    float dx, dy;
+    MipMap::BilinearCoords(s, t, l.width, l.height, x, y, dx, dy);
+    float w[4] = { weight * (1.f - dx) * (1.f - dy), weight * dx * (1.f - dy), weight * (1.f - dx) * dy, weight * dx * dy };
+    constexpr int bytes = half ? 6 : 4;
+    int tile[4], offsets[4];
+    for (int j = 0; j < 4; j++) {
+        int tx = x[j & 1], ty = y[j >> 1];
+        tile[j] = (ty / TILE_SIZE) * l.tiles_x + tx / TILE_SIZE;
+        offsets[j] = ((ty % TILE_SIZE) * TILE_SIZE + tx % TILE_SIZE) * bytes;
+    }
+    unsigned char texels[4 * 6], group[4 * 6];
+    bool done[4] = { false, false, false, false };
+    for (int i = 0; i < 4; i++) {
+        if (done[i]) continue;
+        int index[4], group_offsets[4], n = 0;
+        for (int j = i; j < 4; j++) {
+            if (done[j] || tile[j] != tile[i]) continue;
+            done[j] = true;
+            index[n] = j;
+            group_offsets[n++] = offsets[j];
+        }
+        uint64_t key = (uint64_t)id << 40 | (uint64_t)level << 32 | (uint32_t)tile[i];
+        cache->Read(key, tiles + (l.first_tile + tile[i]) * tile_bytes, tile_bytes, group_offsets, n, bytes, group);
+        for (int k = 0; k < n; k++) memcpy(texels + index[k] * bytes, group + k * bytes, bytes);
+    }
+    // 按与 MipMap 相同的顺序累加，结果逐位一致
+    for (int j = 0; j < 4; j++) accumulate<half>(texels + j * bytes, w[j], rgb);
+}
+
+template<bool half>
+Color TiledImage::Trilinear(double s, double t, double width) const {
+    float rgb[3] = { 0.f, 0.f, 0.f };
+    float f;
+    int level = MipMap::SelectLevel(width, std::max(levels[0].width, levels[0].height), (int)levels.size(), f);
+    Bilinear<half>(level, s, t, 1.f - f, rgb);
+    if (f > 0.f) Bilinear<half>(level + 1, s, t, f, rgb);
+    double scale = half ? 1. : INV_255;
+    return Color(rgb[0] * scale, rgb[1] * scale, rgb[2] * scale);
+}
+
+Color TiledImage::Lookup(double s, double t, double width) const {
+    if (levels.empty()) return Color();
+    MipMap::WrapCoords(s, t);
+    return is_half ? Trilinear<true>(s, t, width) : Trilinear<false>(s, t, width);
+}
+#pragma endregion TiledImage
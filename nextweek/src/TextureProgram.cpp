@@ -0,0 +1,71 @@
+﻿#include "TextureProgram.hpp"
+
+int TextureProgram::AddSolid(const Color& color) {
+    Node node{};
+    node.op = Op::Solid;
+    node.color = color;
+    nodes.push_back(node);
+    return (int)nodes.size() - 1;
+}
+
+// 返回 texture 对应节点的下标，失败返回 -1；同一个纹理对象只编译一次，多处引用时共用节点
+int TextureProgram::Compile(const Texture* texture, std::map<const Texture*, int>& ids) {
+    if (texture == nullptr) return -1;
+    auto it = ids.find(texture);
+    if (it != ids.end()) return it->second;
+
+    int id;
+    if (auto solid = dynamic_cast<const SolidTexture*>(texture)) id = AddSolid(solid->texture_color);
+    else if (auto checker = dynamic_cast<const CheckerTexture*>(texture)) {
+        // 先占位再编译子节点，子节点的下标总是大于父节点
+        id = (int)nodes.size();
+        nodes.push_back(Node{});
+        int odd = Compile(checker->odd.get(), ids);
+        int even = Compile(checker->even.get(), ids);
+        if (odd < 0 || even < 0) return -1;
+        Node& node = nodes[id];
+        node.op = Op::Checker;
+        node.odd = odd;
+        node.even = even;
+    }
+    else if (auto noise = dynamic_cast<const NoiseTexture*>(texture)) {
+        Node node{};
+        node.color = noise->color;
+        node.scale = noise->scale;
+        if (auto perlin = dynamic_cast<const PerlinNoise*>(noise->noise.get())) {
+            node.op = Op::Perlin;
+            node.perlin = perlin;
+        }
+        else if (auto volume = dynamic_cast<const NoiseVolume*>(noise->noise.get())) {
+            node.op = Op::NoiseVolume;
+            node.volume = volume;
+        }
+        else return -1;
+        nodes.push_back(node);
+        id = (int)nodes.size() - 1;
+    }
+    else if (auto image = dynamic_cast<const ImageTexture*>(texture)) {
+        Node node{};
+        if (image->tiled != nullptr) {
+            node.op = Op::Tiled;
+            node.tiled = image->tiled.get();
+        }
+        else if (image->mipmap != nullptr) {
+            node.op = Op::MipMap;
+            node.mipmap = image->mipmap.get();
+        }
+        else node.op = Op::Solid;
+        nodes.push_back(node);
+        id = (int)nodes.size() - 1;
+    }
+    else return -1;
+    return ids[texture] = id;
+}
+
+bool TextureProgram::Compile(const std::shared_ptr<Texture>& texture) {
+    nodes.clear();
+    std::map<const Texture*, int> ids;
+    if (Compile(texture.get(), ids) == 0) return true;
+    nodes.clear();
+    return false;
+}
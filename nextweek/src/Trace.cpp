@@ -0,0 +1,104 @@
+﻿#include "Trace.hpp"
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace {
+    struct Registry {
+        CRITICAL_SECTION cs;
+        std::vector<std::unique_ptr<TraceBuffer>> buffers;
+        std::vector<TraceBuffer*> free_buffers;
+        int64_t origin; // 时间线的零点
+        Registry() {
+            InitializeCriticalSection(&cs);
+            origin = Trace::Now();
+        }
+        ~Registry() { DeleteCriticalSection(&cs); }
+    };
+    Registry& GetRegistry() {
+        static Registry registry;
+        return registry;
+    }
+}
+
+// 每个线程只在第一次记录和退出时各加锁一次，之后写自己的缓冲不需要同步
+// 优先复用已退出线程的缓冲，缓冲总数不超过同时记录的线程数
+TraceBuffer* Trace::Acquire() {
+    auto& registry = GetRegistry();
+    TraceBuffer* buffer;
+    EnterCriticalSection(&registry.cs);
+    if (!registry.free_buffers.empty()) {
+        buffer = registry.free_buffers.back();
+        registry.free_buffers.pop_back();
+    }
+    else {
+        buffer = new TraceBuffer; // 事件不需要清零，只读 head 之前写过的部分
+        buffer->index = (int)registry.buffers.size();
+        registry.buffers.emplace_back(buffer);
+    }
+    LeaveCriticalSection(&registry.cs);
+    return buffer;
+}
+
+void Trace::Release(TraceBuffer* buffer) {
+    auto& registry = GetRegistry();
+    EnterCriticalSection(&registry.cs);
+    registry.free_buffers.push_back(buffer);
+    LeaveCriticalSection(&registry.cs);
+}
+
+int64_t Trace::Now() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+void Trace::Write(const std::string& json_file) {
+    auto& registry = GetRegistry();
+    std::ofstream out(json_file);
+    if (!out) {
+        std::cerr << json_file << " cannot be open.\n";
+        return;
+    }
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    double us_per_tick = 1e6 / frequency.QuadPart;
+    TraceBuffer* main_buffer = &Local();
+
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{ \"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": { \"name\": \"raytracer\" } }";
+    size_t events_num = 0, dropped = 0;
+    EnterCriticalSection(&registry.cs);
+    for (size_t i = 0; i < registry.buffers.size(); i++) {
+        auto& buffer = *registry.buffers[i];
+        // Perfetto 按 sort_index 排列轨道，主线程总在最上面
+        bool is_main = &buffer == main_buffer;
+        out << ",\n{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer.index
+            << ", \"args\": { \"name\": \"" << (is_main ? "main" : "worker " + std::to_string(buffer.index)) << "\" } }";
+        out << ",\n{ \"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer.index
+            << ", \"args\": { \"sort_index\": " << (is_main ? 0 : i + 1) << " } }";
+        uint64_t head = buffer.head.load(std::memory_order_acquire);
+        uint64_t first = head > TraceBuffer::capacity ? head - TraceBuffer::capacity : 0;
+        dropped += first;
+        for (uint64_t j = first; j < head; j++) {
+            auto& e = buffer.events[j & (TraceBuffer::capacity - 1)];
+            out << ",\n{ \"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer.index
+                << ", \"ts\": " << (e.start - registry.origin) * us_per_tick << ", \"dur\": " << (e.end - e.start) * us_per_tick;
+            if (e.from >= 0) out << ", \"args\": { \"from\": " << e.from << ", \"to\": " << e.to << " }";
+            out << " }";
+        }
+        events_num += head - first;
+    }
+    LeaveCriticalSection(&registry.cs);
+    out << "\n] }\n";
+    std::cout << "trace: " << events_num << " events";
+    if (dropped > 0) std::cout << ", " << dropped << " dropped";
+    std::cout << "\n" << json_file << " has been saved.\n";
+}
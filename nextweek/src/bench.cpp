@@ -0,0 +1,193 @@
+﻿#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include "BVH.hpp"
+#include "global.hpp"
+#include "material.hpp"
+#include "noise.hpp"
+#include "texture.hpp"
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+using namespace std;
+
+// 热点函数的单线程微基准：每个基准在固定种子生成的同一批输入上反复调用被测函数，
+// 取多次运行中最快的一次，结果写成 JSON，便于单独验证某个函数的优化
+
+// cmake --build build --target raytracer_bench
+// raytracer_bench [输出文件] [名字过滤]
+
+constexpr unsigned SEED = 20220325;
+constexpr int INPUTS_NUM = 1 << 16; // 每个基准的输入个数，循环使用
+constexpr int OPS_NUM = 1 << 20;    // 每次运行调用被测函数的次数
+constexpr int RUNS_NUM = 5;
+
+struct BenchResult {
+    string name;
+    double ns_per_op;
+    bool is_ray;     // 每次调用处理一条光线时才输出 rays/s
+    double checksum; // 击中次数或结果之和，防止调用被优化掉
+};
+
+vector<BenchResult> results;
+string name_filter;
+
+double get_time_ns() {
+    static LARGE_INTEGER frequency = [] { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f; }();
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * 1e9 / frequency.QuadPart;
+}
+
+// body(i) 调用一次被测函数并返回计入校验和的值，i 为输入下标
+void run_bench(const string& name, bool is_ray, const function<double(int)>& body) {
+    if (!name_filter.empty() && name.find(name_filter) == string::npos) return;
+    double best = numeric_limits<double>::infinity(), checksum = 0.;
+    for (int run = 0; run < RUNS_NUM; run++) {
+        double sum = 0.;
+        double start = get_time_ns();
+        for (int i = 0; i < OPS_NUM; i++) sum += body(i & (INPUTS_NUM - 1));
+        best = min(best, get_time_ns() - start);
+        checksum = sum;
+    }
+    results.push_back({ name, best / OPS_NUM, is_ray, checksum });
+    cout << "  " << name << ": " << best / OPS_NUM << " ns/op";
+    if (is_ray) cout << ", " << OPS_NUM / best * 1e3 << " Mrays/s";
+    cout << ", checksum = " << checksum << endl;
+}
+
+// 从半径为 r 的球面上射向 [-extent, extent]^3 内随机点的光线
+vector<Ray> get_random_rays(double r, double extent) {
+    vector<Ray> rays(INPUTS_NUM);
+    for (auto& ray : rays) {
+        point3d o = get_random_unit_vec3d() * r;
+        ray = Ray(o, (get_random_vec3d(-extent, extent) - o).normalize(), get_random());
+    }
+    return rays;
+}
+
+void bench_primitives() {
+    auto material = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    srand(SEED);
+    auto rays = get_random_rays(3., 1.5);
+    auto hit_test = [&rays](const shared_ptr<Hittable>& obj) {
+        return [&rays, obj](int i) {
+            hit_info hit;
+            return obj->hit(rays[i], 0.000001, numeric_limits<double>::infinity(), hit) ? 1. : 0.;
+        };
+    };
+
+    run_bench("sphere_hit", true, hit_test(make_shared<Sphere>(point3d(0, 0, 0), 1., material)));
+    point3d p1(-1, -1, -1), p2(1, 1, 1);
+    p1.x = p2.x = 0.;
+    run_bench("rect_x_hit", true, hit_test(make_shared<Rect<0>>(p1, p2, material)));
+    p1 = point3d(-1, 0, -1), p2 = point3d(1, 0, 1);
+    run_bench("rect_y_hit", true, hit_test(make_shared<Rect<1>>(p1, p2, material)));
+    p1 = point3d(-1, -1, 0), p2 = point3d(1, 1, 0);
+    run_bench("rect_z_hit", true, hit_test(make_shared<Rect<2>>(p1, p2, material)));
+
+    AABB box(point3d(-1, -1, -1), point3d(1, 1, 1));
+    run_bench("aabb_hit", true, [&](int i) {
+        return box.hit(rays[i], 0.000001, numeric_limits<double>::infinity()) ? 1. : 0.;
+    });
+}
+
+void bench_bvh() {
+    constexpr int spheres_num = 4096;
+    auto material = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    srand(SEED);
+    vector<shared_ptr<Hittable>> spheres;
+    for (int i = 0; i < spheres_num; i++)
+        spheres.push_back(make_shared<Sphere>(get_random_vec3d(-10., 10.), get_random(0.05, 0.3), material));
+    auto bvh = make_shared<BVH_Node>(spheres, 0, spheres.size(), 0., 1.);
+    auto rays = get_random_rays(30., 10.);
+    run_bench("bvh_hit", true, [&](int i) {
+        hit_info hit;
+        return bvh->hit(rays[i], 0.000001, numeric_limits<double>::infinity(), hit) ? 1. : 0.;
+    });
+}
+
+void bench_textures() {
+    srand(SEED);
+    auto noise = make_shared<PerlinNoise>(false);
+    noise->Generate();
+    vector<point3d> points(INPUTS_NUM);
+    for (auto& p : points) p = get_random_vec3d(-100., 100.);
+    run_bench("perlin_turb", false, [&](int i) { return noise->Turb(points[i]); });
+
+    // 程序生成的 1024x1024 图像，覆盖 MIP 金字塔各层的查询
+    constexpr int size = 1024;
+    auto image = make_shared<PPMImage>(size, size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++)
+            image->set_pixel(x, y, Color((x & 255) / 255., (y & 255) / 255., ((x ^ y) & 255) / 255.));
+    }
+    auto texture = make_shared<ImageTexture>(image);
+    texture->BuildMipMap();
+    struct Lookup { double u, v, footprint; };
+    vector<Lookup> lookups(INPUTS_NUM);
+    for (auto& l : lookups) l = { get_random(), get_random(), get_random() < 0.5 ? 0. : get_random(0., 16. / size) };
+    point3d p;
+    run_bench("image_texture", false, [&](int i) {
+        return texture->GetTexture(lookups[i].u, lookups[i].v, p, lookups[i].footprint).g;
+    });
+}
+
+void bench_materials() {
+    srand(SEED);
+    // 单位球面上的交点，光线从球外射入
+    vector<shared_ptr<scatter_info>> infos, dielectrics_infos;
+    for (int i = 0; i < INPUTS_NUM; i++) {
+        vec3d n = get_random_unit_vec3d();
+        vec3d dir = (get_random_unit_vec3d() - n * 2.).normalize();
+        double ratio = dot(dir, n) < 0. ? 1. / 1.5 : 1.5;
+        infos.push_back(make_shared<scatter_info>(n, n, dir, 0.));
+        dielectrics_infos.push_back(make_shared<dielectrics_scatter_info>(n, n, dir, 0., ratio));
+    }
+    Color white(1, 1, 1);
+    auto scatter_test = [](const shared_ptr<Material>& material, vector<shared_ptr<scatter_info>>& inputs) {
+        return [material, &inputs](int i) {
+            bool is_scatter = material->scatter(inputs[i]);
+            return is_scatter ? inputs[i]->scatter_ray.dir.x : 0.;
+        };
+    };
+    run_bench("lambertian_scatter", true, scatter_test(make_shared<Lambertian>(white), infos));
+    run_bench("metal_scatter", true, scatter_test(make_shared<Metal>(white, 0.3), infos));
+    run_bench("dielectrics_scatter", true, scatter_test(make_shared<Dielectrics>(1.5), dielectrics_infos));
+    run_bench("diffuse_light_scatter", true, scatter_test(make_shared<DiffuseLight>(white), infos));
+}
+
+void write_json(const string& file_name) {
+    ofstream out(file_name);
+    if (!out) {
+        std::cerr << file_name << " cannot be open.\n";
+        return;
+    }
+    out.precision(10);
+    out << "{\n  \"seed\": " << SEED << ",\n  \"ops\": " << OPS_NUM << ",\n  \"runs\": " << RUNS_NUM << ",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"ns_per_op\": " << r.ns_per_op;
+        if (r.is_ray) out << ", \"rays_per_s\": " << 1e9 / r.ns_per_op;
+        out << ", \"checksum\": " << r.checksum << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    cout << file_name << " has been saved.\n";
+}
+
+int main(int argc, char* argv[]) {
+    string output = argc > 1 ? argv[1] : "bench.json";
+    if (argc > 2) name_filter = argv[2];
+
+    cout << "microbenchmarks: seed = " << SEED << ", " << OPS_NUM << " ops x " << RUNS_NUM << " runs\n";
+    bench_primitives();
+    bench_bvh();
+    bench_textures();
+    bench_materials();
+    write_json(output);
+    return 0;
+}
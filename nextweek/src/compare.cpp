@@ -0,0 +1,108 @@
+﻿#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+// 比较两次基准结果，变差超过阈值的指标记为退化，有退化时返回 1，可用于发布前的检查
+// 结果文件为 raytracer_bench 的 bench.json 或 raytracer --bench 的 bench_scenes.json，每行一条带 name 的记录
+
+// raytracer_compare 基线文件 当前结果 [阈值百分比，默认 5]
+
+struct Metric {
+    const char* key;
+    bool higher_is_better;
+    double min_value; // 基线低于该值时计时精度不够，不参与比较
+};
+
+const Metric metrics[] = {
+    { "ns_per_op", false, 0. },
+    { "rays_per_s", true, 0. },
+    { "wall_time_s", false, 0.05 },
+    { "render_time_s", false, 0.05 },
+    { "bvh_build_s", false, 0.05 },
+    { "peak_rss_mb", false, 1. },
+};
+
+// 解析一行中的 "key": value，只处理数字和字符串两种值
+map<string, string> parse_record(const string& line) {
+    map<string, string> record;
+    size_t i = 0;
+    while ((i = line.find('"', i)) != string::npos) {
+        size_t key_end = line.find('"', i + 1);
+        if (key_end == string::npos) break;
+        string key = line.substr(i + 1, key_end - i - 1);
+        size_t j = key_end + 1;
+        while (j < line.size() && (line[j] == ' ' || line[j] == ':')) j++;
+        if (j < line.size() && line[j] == '"') {
+            size_t value_end = line.find('"', j + 1);
+            if (value_end == string::npos) break;
+            record[key] = line.substr(j + 1, value_end - j - 1);
+            i = value_end + 1;
+        }
+        else {
+            size_t value_end = line.find_first_of(",}", j);
+            if (value_end == string::npos) value_end = line.size();
+            record[key] = line.substr(j, value_end - j);
+            i = value_end;
+        }
+    }
+    return record;
+}
+
+bool read_results(const char* file_name, vector<string>& names, map<string, map<string, string>>& results) {
+    ifstream in(file_name);
+    if (!in) {
+        std::cerr << file_name << " cannot be open.\n";
+        return false;
+    }
+    string line;
+    while (std::getline(in, line)) {
+        if (line.find("\"name\"") == string::npos) continue;
+        auto record = parse_record(line);
+        names.push_back(record["name"]);
+        results[record["name"]] = record;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: raytracer_compare baseline.json current.json [threshold%]\n";
+        return 2;
+    }
+    double threshold = argc > 3 ? atof(argv[3]) : 5.;
+    vector<string> baseline_names, current_names;
+    map<string, map<string, string>> baseline, current;
+    if (!read_results(argv[1], baseline_names, baseline) || !read_results(argv[2], current_names, current)) return 2;
+
+    int regressions = 0, missing = 0;
+    for (auto& name : baseline_names) {
+        auto it = current.find(name);
+        if (it == current.end()) {
+            printf("  %-24s missing\n", name.c_str());
+            missing++;
+            continue;
+        }
+        for (auto& metric : metrics) {
+            auto base_it = baseline[name].find(metric.key), cur_it = it->second.find(metric.key);
+            if (base_it == baseline[name].end() || cur_it == it->second.end()) continue;
+            double base = atof(base_it->second.c_str()), cur = atof(cur_it->second.c_str());
+            if (!(base > 0.) || base < metric.min_value) continue;
+            // change 为正表示变好
+            double change = (metric.higher_is_better ? cur - base : base - cur) / base * 100.;
+            const char* verdict = change < -threshold ? "REGRESSION" : (change > threshold ? "improved" : "");
+            if (change < -threshold) regressions++;
+            printf("  %-24s %-14s %14.6g -> %14.6g  %+7.2f%%  %s\n", name.c_str(), metric.key, base, cur, change, verdict);
+        }
+    }
+    for (auto& name : current_names) {
+        if (baseline.find(name) == baseline.end()) printf("  %-24s new\n", name.c_str());
+    }
+    printf("%d regressions over %.1f%%, %d missing\n", regressions, threshold, missing);
+    return regressions > 0 || missing > 0 ? 1 : 0;
+}
@@ -9,6 +9,7 @@
 // ray.dir^2 * t^2 + 2*ray.dir*(ray.o-o) * t + ((ray.o-o)^2 - r^2) == 0
 // 当 b^2 - 4ac >=0 时，t 有解
 bool Sphere::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
+    STATS_PRIMITIVE(Sphere);
     vec3d or = ray.o - get_origin(ray.time);
     double b = 2 * dot(ray.dir, or);
     double a = ray.dir.length2();
@@ -30,6 +31,8 @@ bool Sphere::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
     }
     else ret.inside_obj = false;
     Sphere::GetUV(ret.u, ret.v, ret.point);
+    // u 方向对应赤道长 2PI*r，v 方向对应经线长 PI*r，取两者的几何平均
+    ret.uv_scale = PI * std::sqrt(2.) * std::abs(r);
     ret.obj = shared_from_this();
     return true;
 }
@@ -66,19 +69,26 @@ void Sphere::GetUV(double& u, double& v, const point3d& hit_p) const {
     v = theta / PI;
 }
 
-Color Sphere::get_material_texture(const double u, const double v, const point3d& hit_p) const {
+double Sphere::GetArea() const { return 4. * PI * r * r; }
+
+point3d Sphere::SamplePoint(const point3d&, vec3d& nm, const double time) const {
+    nm = get_random_unit_vec3d();
+    return get_origin(time) + nm * std::abs(r);
+}
+
+Color Sphere::get_material_texture(const double u, const double v, const point3d& hit_p, const double footprint) const {
     #if defined(MAP_SPHERE_TO_CUBE)
     point3d p = (hit_p + vec3d(point3d(0, 0, 0) - o)) / r;
     double x = abs(p.x), y = abs(p.y), z = abs(p.z);
     if (z >= x && z >= y) p.z = p.z > 0 ? 1 : -1;
     else if (y >= x && y >= z) p.y = p.y > 0 ? 1 : -1;
     else p.x = p.x > 0 ? 1 : -1;
-    return material->get_texture(u, v, p * r * 10);
+    return material->get_texture(u, v, p * r * 10, footprint);
     #elif defined(TEXTURE_WITH_UV)
-    return material->get_texture(u * 100, v * 100, hit_p);
+    return material->get_texture(u * 100, v * 100, hit_p, footprint * 100);
     #else
     // point3d p = (hit_p + vec3d(point3d(0, 0, 0) - o)) / r;
-    return material->get_texture(u, v, hit_p);
+    return material->get_texture(u, v, hit_p, footprint);
     #endif
 }
 
@@ -97,6 +107,206 @@ bool MovingSphere::bounding_box(const double time1, const double time2, AABB& ou
 }
 #pragma endregion Sphere
 
+#pragma region Plane
+Plane::Plane(const point3d& o_, const vec3d& n_, std::shared_ptr<Material> m) noexcept
+: Hittable(m), o(o_), n(n_.normalize()) {
+    tu = cross(std::abs(n.x) > 0.9 ? vec3d(0, 1, 0) : vec3d(1, 0, 0), n).normalize();
+    tv = cross(n, tu);
+}
+
+bool Plane::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
+    STATS_PRIMITIVE(Plane);
+    double denom = dot(n, ray.dir);
+    if (std::abs(denom) < EPS) return false;
+    double t = dot(o - ray.o, n) / denom;
+    if (t < t_min || t > t_max) return false;
+    ret.t = t;
+    ret.point = ray.at(t);
+    ret.normal = n;
+    if (denom > 0.) {
+        ret.normal = vec3d() - n;
+        ret.inside_obj = true;
+    }
+    else ret.inside_obj = false;
+    GetUV(ret.u, ret.v, ret.point);
+    ret.uv_scale = 1.;
+    ret.obj = shared_from_this();
+    return true;
+}
+
+bool Plane::scatter(Ray& ray_out, const hit_info& hit) const {
+    shared_ptr<scatter_info> info;
+    if (std::dynamic_pointer_cast<Dielectrics>(material)) {
+        auto dielectrics_material = std::dynamic_pointer_cast<Dielectrics>(material);
+        double refraction_ratio = global_air.get_refraction_eta() / dielectrics_material->get_refraction_eta();
+
+        info = std::make_shared<dielectrics_scatter_info>(hit.point, hit.normal, hit.cast_ray_dir, hit.ray_time, refraction_ratio);
+    }
+    else info = std::make_shared<scatter_info>(hit.point, hit.normal, hit.cast_ray_dir, hit.ray_time);
+    bool is_scatter = material->scatter(info);
+    ray_out = info->scatter_ray;
+    return is_scatter;
+}
+
+bool Plane::bounding_box(const double, const double, AABB&) const { return false; }
+
+void Plane::GetUV(double& u, double& v, const point3d& p) const {
+    u = dot(p - o, tu);
+    v = dot(p - o, tv);
+}
+#pragma endregion Plane
+
+#pragma region Box
+Box::Box(const point3d& p1, const point3d& p2, std::shared_ptr<Material> m) noexcept
+: Hittable(m) {
+    pmin = point3d(std::min(p1.x, p2.x), std::min(p1.y, p2.y), std::min(p1.z, p2.z));
+    pmax = point3d(std::max(p1.x, p2.x), std::max(p1.y, p2.y), std::max(p1.z, p2.z));
+}
+
+// 面上某一轴的 uv 坐标，厚度为 0 的盒子在该轴上取 0.5，避免除以 0 得到 NaN
+static double get_box_uv(double p, double lo, double hi) {
+    return hi - lo > 0. ? (p - lo) / (hi - lo) : 0.5;
+}
+
+// 与 AABB::hit 相同的 slab 测试，同时记下最迟进入和最早离开的轴
+bool Box::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
+    STATS_PRIMITIVE(Box);
+    double t_in = -std::numeric_limits<double>::infinity();
+    double t_out = std::numeric_limits<double>::infinity();
+    int in_axis = 0, out_axis = 0;
+    for (int i = 0; i < 3; i++) {
+        double invD = 1. / ray.dir[i];
+        double t0 = (pmin[i] - ray.o[i]) * invD;
+        double t1 = (pmax[i] - ray.o[i]) * invD;
+        if (t0 > t1) std::swap(t0, t1);
+        if (t0 > t_in) t_in = t0, in_axis = i;
+        if (t1 < t_out) t_out = t1, out_axis = i;
+        if (t_in > t_out) return false;
+    }
+
+    int axis;
+    if (t_in >= t_min && t_in <= t_max) ret.t = t_in, axis = in_axis, ret.inside_obj = false;
+    else if (t_out >= t_min && t_out <= t_max) ret.t = t_out, axis = out_axis, ret.inside_obj = true;
+    else return false;
+
+    ret.point = ray.at(ret.t);
+    ret.normal = vec3d();
+    ret.normal[axis] = ray.dir[axis] > 0. ? -1 : 1;
+
+    int t1 = (axis + 1) % 3, t2 = (axis + 2) % 3;
+    ret.u = get_box_uv(ret.point[t1], pmin[t1], pmax[t1]);
+    ret.v = get_box_uv(ret.point[t2], pmin[t2], pmax[t2]);
+    ret.uv_scale = std::sqrt((pmax[t1] - pmin[t1]) * (pmax[t2] - pmin[t2]));
+    ret.obj = shared_from_this();
+    return true;
+}
+
+bool Box::scatter(Ray& ray_out, const hit_info& hit) const {
+    shared_ptr<scatter_info> info;
+    if (std::dynamic_pointer_cast<Dielectrics>(material)) {
+        auto dielectrics_material = std::dynamic_pointer_cast<Dielectrics>(material);
+        double refraction_ratio;
+        if (hit.inside_obj) refraction_ratio = dielectrics_material->get_refraction_eta() / global_air.get_refraction_eta();
+        else refraction_ratio = global_air.get_refraction_eta() / dielectrics_material->get_refraction_eta();
+
+        info = std::make_shared<dielectrics_scatter_info>(hit.point, hit.normal, hit.cast_ray_dir, hit.ray_time, refraction_ratio);
+    }
+    else info = std::make_shared<scatter_info>(hit.point, hit.normal, hit.cast_ray_dir, hit.ray_time);
+    bool is_scatter = material->scatter(info);
+    ray_out = info->scatter_ray;
+    return is_scatter;
+}
+
+bool Box::bounding_box(const double, const double, AABB& output_box) const {
+    output_box = AABB(pmin, pmax);
+    return true;
+}
+
+// 离 p 最近的面所在的轴
+int Box::GetFaceAxis(const point3d& p) const {
+    int axis = 0;
+    double min_d = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < 3; i++) {
+        double d = std::min(std::abs(p[i] - pmin[i]), std::abs(p[i] - pmax[i]));
+        if (d < min_d) min_d = d, axis = i;
+    }
+    return axis;
+}
+
+void Box::GetUV(double& u, double& v, const point3d& p) const {
+    int axis = GetFaceAxis(p);
+    int t1 = (axis + 1) % 3, t2 = (axis + 2) % 3;
+    u = get_box_uv(p[t1], pmin[t1], pmax[t1]);
+    v = get_box_uv(p[t2], pmin[t2], pmax[t2]);
+}
+
+double Box::GetArea() const {
+    vec3d d = pmax - pmin;
+    return 2. * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// 按面积选一个面，再在面上均匀取点
+point3d Box::SamplePoint(const point3d&, vec3d& nm, const double) const {
+    vec3d d = pmax - pmin;
+    double areas[3] = { d.y * d.z, d.z * d.x, d.x * d.y };
+    double r = get_random(0, areas[0] + areas[1] + areas[2]);
+    int axis = r < areas[0] ? 0 : (r < areas[0] + areas[1] ? 1 : 2);
+    point3d p = pmin + get_random_vec3d() * d;
+    bool is_max = get_random() < 0.5;
+    p[axis] = is_max ? pmax[axis] : pmin[axis];
+    nm = vec3d();
+    nm[axis] = is_max ? 1 : -1;
+    return p;
+}
+#pragma endregion Box
+
+#pragma region Instance
+Instance::Instance(std::shared_ptr<Hittable> prototype_, const Transform& transform_) noexcept
+: prototype(prototype_), transform(transform_) {
+    has_box = TransformBox(0, 1, box_min, box_max);
+}
+
+// 原型包围盒的 8 个角变换到世界空间后再取包围盒
+bool Instance::TransformBox(const double time0, const double time1, point3d& bmin, point3d& bmax) const {
+    AABB box;
+    if (!prototype->bounding_box(time0, time1, box)) return false;
+    double inf = std::numeric_limits<double>::infinity();
+    bmin = point3d(inf, inf, inf);
+    bmax = point3d(-inf, -inf, -inf);
+    auto pmin = box.get_min_point();
+    auto pmax = box.get_max_point();
+    for (int i = 0; i < 8; i++) {
+        point3d p = transform.PointToWorld(point3d((i & 1) ? pmax.x : pmin.x, (i & 2) ? pmax.y : pmin.y, (i & 4) ? pmax.z : pmin.z));
+        bmin = point3d(std::min(bmin.x, p.x), std::min(bmin.y, p.y), std::min(bmin.z, p.z));
+        bmax = point3d(std::max(bmax.x, p.x), std::max(bmax.y, p.y), std::max(bmax.z, p.z));
+    }
+    return true;
+}
+
+// 方向不归一化，物体空间中的 t 与世界空间一致
+bool Instance::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
+    STATS_PRIMITIVE(Instance);
+    Ray local(transform.PointToLocal(ray.o), transform.VectorToLocal(ray.dir), ray.time);
+    if (!prototype->hit(local, t_min, t_max, ret)) return false;
+    ret.point = transform.PointToWorld(ret.point);
+    ret.normal = transform.NormalToWorld(ret.normal);
+    // 物体空间与世界空间共用参数 t，沿光线方向的长度比即为缩放
+    ret.uv_scale *= ray.dir.length() / local.dir.length();
+    return true;
+}
+
+// 动态原型的包围盒随快门区间变化，不能用构造时算好的
+bool Instance::bounding_box(const double time0, const double time1, AABB& output_box) const {
+    if (has_box && prototype->IsDynamic()) {
+        point3d bmin, bmax;
+        TransformBox(time0, time1, bmin, bmax);
+        output_box = AABB(bmin, bmax);
+    }
+    else if (has_box) output_box = AABB(box_min, box_max);
+    return has_box;
+}
+#pragma endregion Instance
+
 // bool XYRect::bounding_box(const double, const double, AABB& output_box) const {
 //     output_box = AABB(point3d(p1.x, p1.y, p1.z - 0.0001), point3d(p2.x, p2.y, p2.z + 0.0001));
 //     return true;
@@ -1,58 +1,216 @@
 ﻿#include "config.hpp"
 #include "BVH.hpp"
 #include <iostream>
+#include <atomic>
 #include "RenderThreadPool.hpp"
+#include "IrradianceCache.hpp"
+#include "LightBVH.hpp"
+#include "EnvironmentMap.hpp"
+#include "Accelerator.hpp"
+#include "SceneCache.hpp"
+#include "RenderStats.hpp"
+#include "Trace.hpp"
+#include <psapi.h>
+#include <filesystem>
 using namespace std;
 
 PPMImage image(default_height, default_width);
 shared_ptr<Camera> camera;
 vector<shared_ptr<Hittable>> objs;
-shared_ptr<BVH_Node> bvh_root;
-bool use_BVH = false;
+shared_ptr<Accelerator> accelerator;
+vector<shared_ptr<Hittable>> unbounded_objs;
+AcceleratorType accelerator_type = AcceleratorType::List;
 Color bgcolor = Color(0.7, 0.8, 1.);
 double aspect_ratio = default_aspect_ratio;
+shared_ptr<IrradianceCache> irradiance_cache;
+shared_ptr<TextureCache> texture_cache;
+shared_ptr<LightBVH> light_bvh;
+LightSampling light_sampling = LightSampling::None;
+int frames_num = 1;
+double frame_time = 1.;
+string output_file = "image.ppm";
+shared_ptr<EnvironmentMap> env_map;
+int spp = samples_per_pixel;
 
-bool world_hit(const Ray& ray, hit_info& hit) {
+// 基准模式下的固定设置：随机数种子、图像宽度（高度按配置的宽高比）、每像素采样数
+constexpr unsigned BENCH_SEED = 1;
+constexpr int BENCH_WIDTH = 320;
+constexpr int BENCH_SPP = 16;
+constexpr int BENCH_RUNS = 3; // 每个场景渲染几次，取渲染最快的一次
+// 等时画质比较的图像宽度和参考图的每像素采样数
+constexpr int QUALITY_WIDTH = 200;
+constexpr int REFERENCE_SPP = 1024;
+constexpr unsigned REFERENCE_SEED = 1u << 30; // 参考图与候选配置的随机数序列不重叠
+
+// 只在基准和画质比较中统计光线数，普通渲染不做计数
+// 每个线程先在 thread_rays 中计数，每渲染完一个像素再累加到 rays_num，避免每条光线都做原子操作
+bool count_rays = false;
+// 基准和画质比较中每个渲染任务开始时按任务序号重设随机数种子，结果与线程号和调度无关
+bool fixed_seed = false;
+thread_local uint64_t thread_rays = 0;
+std::atomic<uint64_t> rays_num(0);
+
+inline void flush_rays() {
+    if (thread_rays == 0) return;
+    rays_num += thread_rays;
+    thread_rays = 0;
+}
+
+bool world_hit(const Ray& ray, hit_info& hit, double t_max = std::numeric_limits<double>::infinity()) {
+    if (count_rays) ++thread_rays;
     bool hit_flag = false;
     double t_min = 0.000001;
-    double t_max = std::numeric_limits<double>::infinity();
-    if (use_BVH){
-        if (bvh_root->hit(ray, t_min, t_max, hit)) {
-            hit.cast_ray_dir = ray.dir;
-            hit.ray_time = ray.time;
+    if (accelerator != nullptr && accelerator->hit(ray, t_min, t_max, hit)) {
+        t_max = hit.t;
+        hit_flag = 1;
+    }
+    // 无限大平面等没有包围盒的物体不在加速结构中，单独求交
+    for (auto& obj : unbounded_objs) {
+        if (obj->hit(ray, t_min, t_max, hit)) {
+            t_max = hit.t;
             hit_flag = 1;
         }
     }
-    else {
-        for (auto& obj : objs) {
-            if (obj->hit(ray, t_min, t_max, hit)) {
-                t_max = hit.t;
-                hit_flag = 1;
-                hit.obj = obj;
+    hit.cast_ray_dir = ray.dir;
+    hit.ray_time = ray.time;
+    hit.cone_width = ray.cone_width + ray.cone_spread * hit.t;
+    hit.cone_spread = ray.cone_spread;
+    return hit_flag;
+}
+
+// 光锥在交点处覆盖的 UV 宽度，斜着看表面时按 1 / cos 放大，用于选择图像纹理的 MIP 层级
+double texture_footprint(const hit_info& hit) {
+    if (hit.uv_scale <= 0.) return 0.;
+    double cos_theta = std::abs(dot(hit.normal, hit.cast_ray_dir)) / hit.cast_ray_dir.length();
+    return hit.cone_width / (hit.uv_scale * std::sqrt(std::max(cos_theta, 0.01)));
+}
+
+// 在 Lambertian 表面上选一个光源并在其表面取一点（next event estimation），返回未乘反照率的直接光照
+Color sample_direct_light(const hit_info& hit, LightSampling strategy) {
+    double pmf;
+    auto& light = strategy == LightSampling::BVH ? light_bvh->Sample(hit.point, hit.normal, pmf) : light_bvh->SampleUniform(pmf);
+    if (pmf <= 0.) return Color();
+
+    vec3d light_nm;
+    point3d p = light->SamplePoint(hit.point, light_nm, hit.ray_time);
+    vec3d d = p - hit.point;
+    double dist2 = d.length2();
+    double dist = std::sqrt(dist2);
+    vec3d dir = d / dist;
+    double cos_s = dot(hit.normal, dir);
+    double cos_l = -dot(light_nm, dir);
+    if (cos_s <= 0. || cos_l <= 0.) return Color();
+
+    hit_info shadow;
+    STATS_ADD(shadow_rays, 1);
+    if (world_hit(Ray(hit.point, dir, hit.ray_time), shadow, dist * (1. - 0.0001))) return Color();
+
+    double u, v;
+    light->GetUV(u, v, p);
+    return light->get_material_emitted(u, v, p) * (cos_s * cos_l * light->GetArea() / (dist2 * PI * pmf));
+}
+
+Color background(const Ray& ray) {
+    return env_map != nullptr ? env_map->Lookup(ray.dir) : bgcolor;
+}
+
+// 按环境贴图的亮度分布采样一个方向，返回未乘反照率的直接光照
+Color sample_environment(const hit_info& hit) {
+    vec3d dir;
+    double pdf;
+    Color le = env_map->Sample(dir, pdf);
+    double cos_s = dot(hit.normal, dir);
+    if (pdf <= 0. || cos_s <= 0.) return Color();
+
+    hit_info shadow;
+    STATS_ADD(shadow_rays, 1);
+    if (world_hit(Ray(hit.point, dir, hit.ray_time), shadow)) return Color();
+    return le * (cos_s / (PI * pdf));
+}
+
+Color ray_cast(const Ray& ray, int depth = max_depth, bool diffuse_bounced = false, bool skip_emitted = false);
+Color shade(hit_info& hit, int depth, bool diffuse_bounced, bool skip_emitted);
+
+// 在 hit 点的法线半球内按余弦分布分层采样，返回入射辐亮度的均值，r 为击中距离的调和平均
+// 调用方保证 depth > 0
+Color sample_irradiance(const hit_info& hit, int depth, bool skip_emitted, double& r) {
+    int m = std::max(1, (int)std::sqrt(irradiance_cache->samples));
+    int n = std::max(1, irradiance_cache->samples / m);
+    vec3d w = hit.normal;
+    vec3d t = cross(std::abs(w.x) > 0.9 ? vec3d(0, 1, 0) : vec3d(1, 0, 0), w).normalize();
+    vec3d b = cross(w, t);
+
+    Color sum;
+    double inv_dist = 0.;
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            double u1 = (i + get_random()) / m;
+            double u2 = (j + get_random()) / n;
+            double sr = std::sqrt(u1), phi = 2. * PI * u2;
+            vec3d dir = (t * (sr * std::cos(phi)) + b * (sr * std::sin(phi)) + w * std::sqrt(1. - u1)).normalize();
+            STATS_ADD(rays[max_depth - depth + 1], 1);
+            hit_info h;
+            Ray ray(hit.point, dir, hit.ray_time);
+            if (world_hit(ray, h)) {
+                inv_dist += 1. / h.t;
+                sum = sum + shade(h, depth - 1, true, skip_emitted);
             }
+            else if (!skip_emitted || env_map == nullptr) sum = sum + background(ray);
         }
-        hit.cast_ray_dir = ray.dir;
-        hit.ray_time = ray.time;
     }
-    return hit_flag;
+    r = inv_dist > 0. ? m * n / inv_dist : std::numeric_limits<double>::infinity();
+    return sum / (m * n);
 }
 
-Color ray_cast(const Ray& ray, int depth = max_depth) {
-    if (depth < 0) return Color();
-    hit_info hit;
-    if (world_hit(ray, hit)) {
-        Ray scatter_ray;
-        Color color = hit.obj->get_material_emitted(hit.u, hit.v, hit.point);
-        if (hit.obj->scatter(scatter_ray, hit)) {
-            color = color + (hit.obj->get_material_texture(hit.u, hit.v, hit.point) * ray_cast(scatter_ray, depth - 1));
+// 开启光源采样或使用环境贴图后，漫反射点的直接光照由 sample_direct_light 和 sample_environment 给出，
+// 其散射光线再击中被采样的光源或环境时不再计入，避免重复计算
+// 路径上第一个漫反射点的间接光照从辐照度缓存中插值，缺少有效记录时再采样生成一条新记录
+// 已到 max_depth 的点采不到任何半球样本，不查也不写缓存，按普通散射处理
+Color shade(hit_info& hit, int depth, bool diffuse_bounced, bool skip_emitted) {
+    Color color;
+    if (!skip_emitted || light_bvh == nullptr || !light_bvh->IsSampledLight(hit.obj.get()))
+        color = hit.obj->get_material_emitted(hit.u, hit.v, hit.point);
+
+    bool is_diffuse = dynamic_cast<Lambertian*>(hit.obj->get_material().get()) != nullptr;
+    bool sample_lights = is_diffuse && light_sampling != LightSampling::None && light_bvh->GetLightsNum() > 0;
+    bool sample_env = is_diffuse && env_map != nullptr;
+    bool use_nee = sample_lights || sample_env;
+    Color direct;
+    if (sample_lights) direct = sample_direct_light(hit, light_sampling);
+    if (sample_env) direct = direct + sample_environment(hit);
+
+    if (irradiance_cache != nullptr && !diffuse_bounced && is_diffuse && depth > 0) {
+        Color e;
+        if (!irradiance_cache->Lookup(hit.point, hit.normal, e)) {
+            double r;
+            e = sample_irradiance(hit, depth, use_nee, r);
+            irradiance_cache->Insert(hit.point, hit.normal, e, r);
         }
-        return color;
+        return color + (hit.obj->get_material_texture(hit.u, hit.v, hit.point, texture_footprint(hit)) * (direct + e));
+    }
+    Ray scatter_ray;
+    if (hit.obj->scatter(scatter_ray, hit)) {
+        // 散射光线沿用入射光锥，从交点处的宽度继续扩散
+        scatter_ray.cone_width = hit.cone_width;
+        scatter_ray.cone_spread = hit.cone_spread;
+        color = color + (hit.obj->get_material_texture(hit.u, hit.v, hit.point, texture_footprint(hit)) * (direct + ray_cast(scatter_ray, depth - 1, diffuse_bounced, use_nee)));
+    }
+    return color;
+}
+
+Color ray_cast(const Ray& ray, int depth, bool diffuse_bounced, bool skip_emitted) {
+    if (depth < 0) {
+        STATS_ADD(max_depth_paths, 1);
+        return Color();
     }
-    return bgcolor;
+    STATS_ADD(rays[max_depth - depth], 1);
+    hit_info hit;
+    if (world_hit(ray, hit)) return shade(hit, depth, diffuse_bounced, skip_emitted);
+    if (skip_emitted && env_map != nullptr) return Color();
+    return background(ray);
 }
 
 #ifdef MUTILTHREAD
-constexpr int thread_num = 8;
 constexpr int thread_w = 2;
 
 void render(RenderTaskParam param) {
@@ -60,19 +218,21 @@ void render(RenderTaskParam param) {
     int h = image.get_height();
     int w = image.get_width();
     // srand(from);
+    if (fixed_seed) srand(BENCH_SEED + from);
     for (int y = 0; y < h; y++) {
         for (int x = from; x < to; x++) {
             Color c;
-            for (int i = 0; i < samples_per_pixel; i++){
+            for (int i = 0; i < spp; i++){
                 double v = (double)(y + get_random()) / (h - 1.);
                 double u = (double)(x + get_random()) / (w - 1.);
                 c = c + ray_cast(camera->get_ray(u, v));
             }
-            // Gamma Correction
-            c = Color(std::pow(c.r/samples_per_pixel, 0.45), std::pow(c.g/samples_per_pixel, 0.45), std::pow(c.b/samples_per_pixel, 0.45));
+            // 帧缓冲保存线性值，gamma 校正在写文件时统一进行
+            c = c / spp;
             image.set_pixel(x, y, c);
         }
     }
+    flush_rays();
     //std::cout << "render " << from << " to " << to << " end\n";
 }
 
@@ -82,18 +242,21 @@ void render_pixel(RenderTaskParam param) {
     int h = image.get_height();
     int w = image.get_width();
     // srand(x*1000+y);
+    if (fixed_seed) srand(BENCH_SEED + y * w + x);
     Color c;
-    for (int i = 0; i < samples_per_pixel; i++){
+    for (int i = 0; i < spp; i++){
         double v = (double)(y + get_random()) / (h - 1.);
         double u = (double)(x + get_random()) / (w - 1.);
         c = c + ray_cast(camera->get_ray(u, v));
     }
-    // Gamma Correction
-    c = Color(std::pow(c.r/samples_per_pixel, 0.45), std::pow(c.g/samples_per_pixel, 0.45), std::pow(c.b/samples_per_pixel, 0.45));
+    // 帧缓冲保存线性值，gamma 校正在写文件时统一进行
+    c = c / spp;
     image.set_pixel(x, y, c);
+    flush_rays();
 }
 
-void render_with_mutilthread() {
+// 返回渲染用时（ms）
+DWORD render_with_mutilthread() {
     RenderThreadPool pool(thread_num);
     // int from = 0, w = image.get_width();
     // int step = w / thread_num;
@@ -117,9 +280,10 @@ void render_with_mutilthread() {
     
     t2 = GetTickCount();
     std::cout << "time = " << ((t2 - t1) * 1.0 / 1000) << "s" << std::endl;
+    return t2 - t1;
 }
 #else
-void render(){
+DWORD render(){
     DWORD t1,t2;
     t1 = GetTickCount();
 
@@ -128,22 +292,53 @@ void render(){
     for (int y = 0; y < h; y++) {
         for (int x = 0; x < w; x++) {
             Color c;
-            for (int i = 0; i < samples_per_pixel; i++){
+            for (int i = 0; i < spp; i++){
                 double v = (double)(y + get_random()) / (h - 1.);
                 double u = (double)(x + get_random()) / (w - 1.);
                 c = c + ray_cast(camera.get_ray(u, v));
             }
-            // Gamma Correction
-            c = Color(std::pow(c.r/samples_per_pixel, 0.45), std::pow(c.g/samples_per_pixel, 0.45), std::pow(c.b/samples_per_pixel, 0.45));
+            // 帧缓冲保存线性值，gamma 校正在写文件时统一进行
+            c = c / spp;
             image.set_pixel(x, y, c);
         }
     }
+    flush_rays();
     
     t2 = GetTickCount();
     std::cout << "time = " << ((t2 - t1) * 1.0 / 1000) << "s" << std::endl;
+    return t2 - t1;
 }
 #endif
 
+// 实例共享的动态原型建树时用的是 [0, 1]，按当前快门区间逐个 refit，之后加速结构建树或并行更新时对原型只读
+void refit_prototypes() {
+    for (auto& obj : objs) {
+        if (obj->IsDynamic() && dynamic_cast<Instance*>(obj.get()) != nullptr) obj->Refit(camera->t1, camera->t2);
+    }
+}
+
+void get_config_settings(ConfigManager* configManager) {
+    image = PPMImage(configManager->window_h, configManager->window_w);
+    aspect_ratio = configManager->window_ar;
+    accelerator_type = configManager->GetAcceleratorType();
+    camera = configManager->GetCamera();
+    camera->aspect_ratio = aspect_ratio;
+    bgcolor = configManager->bgcolor;
+    irradiance_cache = configManager->GetIrradianceCache();
+    texture_cache = configManager->GetTextureCache();
+    light_sampling = configManager->GetLightSampling();
+    frames_num = configManager->frames_num;
+    frame_time = configManager->frame_time;
+    output_file = configManager->output_file;
+}
+
+// 环境贴图的图像在后台解码，等解码结束后再建立采样表
+void get_env_map(ConfigManager* configManager) {
+    auto& env_image = configManager->GetEnvImage();
+    if (env_image != nullptr && env_image->get_width() > 0)
+        env_map = make_shared<EnvironmentMap>(env_image, configManager->env_scale, thread_num);
+}
+
 void get_sample_world(ConfigManager* configManager) {
     if (configManager == nullptr) {
         camera = make_shared<Camera>(point3d(-2,0,2), default_up_dir, default_look_at, 40, 0.02, 4);
@@ -152,20 +347,15 @@ void get_sample_world(ConfigManager* configManager) {
         auto material_left   = make_shared<Dielectrics>(1.5);
         auto material_right  = make_shared<Metal>(Color(0.8, 0.6, 0.2), 0.9);
 
-        objs.push_back(make_shared<Sphere>(point3d( 0., -100.5, .0), 100.0, material_ground));
+        objs.push_back(make_shared<Plane>(point3d( 0., -0.5, .0), vec3d(0, 1, 0), material_ground));
         objs.push_back(make_shared<Sphere>(point3d( 0.,    0.0, .0),   0.5, material_center));
         objs.push_back(make_shared<Sphere>(point3d(-1.,    0.0, .0),   0.5, material_left));
         objs.push_back(make_shared<Sphere>(point3d(-1.,    0.0, .0),  -0.4, material_left));
         objs.push_back(make_shared<Sphere>(point3d( 1.,    0.0, .0),   0.5, material_right));
     }
     else {
-        image = PPMImage(configManager->window_h, configManager->window_w);
-        aspect_ratio = configManager->window_ar;
-        camera = configManager->GetCamera();
-        camera->aspect_ratio = aspect_ratio;
+        get_config_settings(configManager);
         objs = configManager->GetObjects();
-        use_BVH = configManager->CheckUseBVH();
-        bgcolor = configManager->bgcolor;
     }
 }
 
@@ -173,18 +363,12 @@ void get_complex_world(ConfigManager* configManager) {
     if (configManager == nullptr) {
         camera = make_shared<Camera>(point3d(13,2,3), default_up_dir, default_look_at, 20, 0.02, 13.3, 0, 1);
     }
-    else {
-        image = PPMImage(configManager->window_h, configManager->window_w);
-        aspect_ratio = configManager->window_ar;
-        use_BVH = configManager->CheckUseBVH();
-        camera = configManager->GetCamera();
-        camera->aspect_ratio = aspect_ratio;
-        bgcolor = configManager->bgcolor;
-    }
+    else get_config_settings(configManager);
 
     auto ground_texture = make_shared<CheckerTexture>(Color(0, 0, 0), Color(1, 1, 1));
     auto material_ground = make_shared<Lambertian>(ground_texture);
-    objs.push_back(make_shared<Sphere>(point3d(0, -1000, 0), 1000, material_ground));
+    // 棋盘纹理取 sin(10x)sin(10y)sin(10z) 的符号，地面放在 y=0 上会整个落在同一格里
+    objs.push_back(make_shared<Plane>(point3d(0, -0.001, 0), vec3d(0, 1, 0), material_ground));
 
     auto big_sphere_o1 = point3d(0, 1, 0);
     auto big_sphere_o2 = point3d(-4, 1, 0);
@@ -240,8 +424,504 @@ void get_complex_world(ConfigManager* configManager) {
     }
 }
 
+// 在地面上随机生成 lights_num 个小的发光球和一些漫反射球，用于测试多光源采样
+void get_many_light_world(ConfigManager* configManager, int lights_num) {
+    get_config_settings(configManager);
+
+    auto material_ground = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+    point3d ground_p1(-60, 0, -60), ground_p2(60, 0, 60);
+    objs.push_back(make_shared<Rect<1>>(ground_p1, ground_p2, material_ground));
+
+    for (int i = 0; i < 200; i++) {
+        point3d o(get_random(-30, 30), 0.5, get_random(-30, 30));
+        auto material = make_shared<Lambertian>(Color(get_random(0.2, 0.9), get_random(0.2, 0.9), get_random(0.2, 0.9)));
+        objs.push_back(make_shared<Sphere>(o, 0.5, material));
+    }
+    for (int i = 0; i < lights_num; i++) {
+        point3d o(get_random(-30, 30), get_random(0.2, 3), get_random(-30, 30));
+        auto c = Color(get_random(0.3, 1), get_random(0.3, 1), get_random(0.3, 1)) * get_random(2, 20);
+        auto material = make_shared<DiffuseLight>(c);
+        objs.push_back(make_shared<Sphere>(o, get_random(0.05, 0.2), material));
+    }
+}
+
+// 在相机看到的漫反射点上分别用均匀选择和光源 BVH 估计直接光照，比较耗时与方差
+void benchmark_light_sampling() {
+    constexpr int points_num = 1000;
+    constexpr int samples_num = 256;
+
+    std::vector<hit_info> points;
+    for (int i = 0; i < points_num * 20 && (int)points.size() < points_num; i++) {
+        hit_info hit;
+        if (world_hit(camera->get_ray(get_random(), get_random()), hit) && dynamic_cast<Lambertian*>(hit.obj->get_material().get()))
+            points.push_back(hit);
+    }
+    std::cout << "light sampling benchmark: " << light_bvh->GetLightsNum() << " lights, "
+              << points.size() << " points, " << samples_num << " samples per point\n";
+    if (points.empty() || light_bvh->GetLightsNum() == 0) return;
+
+    auto luminance = [](const Color& c) { return 0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b; };
+    for (auto strategy : { LightSampling::Uniform, LightSampling::BVH }) {
+        double variance = 0., rel_variance = 0.;
+        DWORD t1 = GetTickCount();
+        for (auto& hit : points) {
+            double sum = 0., sum2 = 0.;
+            for (int i = 0; i < samples_num; i++) {
+                double l = luminance(sample_direct_light(hit, strategy));
+                sum += l, sum2 += l * l;
+            }
+            double mean = sum / samples_num;
+            double var = sum2 / samples_num - mean * mean;
+            variance += var;
+            if (mean > 0.) rel_variance += var / (mean * mean);
+        }
+        DWORD t2 = GetTickCount();
+        double time = (t2 - t1) * 1.0 / 1000;
+        variance /= points.size();
+        rel_variance /= points.size();
+        std::cout << (strategy == LightSampling::BVH ? "  light bvh: " : "  uniform:   ")
+                  << "time = " << time << "s, mean variance = " << variance
+                  << ", mean relative variance = " << rel_variance
+                  << ", efficiency = " << 1. / (rel_variance * std::max(time, 0.001)) << std::endl;
+    }
+}
+
+// 对同一批光线（相机光线和它们在击中点上的漫反射光线）比较各加速结构的构建时间和求交速度
+void benchmark_accelerators(const vector<shared_ptr<Hittable>>& bounded_objs) {
+    constexpr int rays_num = 1 << 20;
+    constexpr int chunk = 4096;
+
+    auto reference = CreateAccelerator(AcceleratorType::BVH, bounded_objs, camera->t1, camera->t2, thread_num);
+    vector<Ray> rays;
+    rays.reserve(rays_num);
+    while ((int)rays.size() < rays_num) {
+        Ray ray = camera->get_ray(get_random(), get_random());
+        rays.push_back(ray);
+        hit_info hit;
+        if (reference->hit(ray, 0.000001, std::numeric_limits<double>::infinity(), hit))
+            rays.push_back(Ray(hit.point, (hit.normal + get_random_unit_vec3d()).normalize(), ray.time));
+    }
+    rays.resize(rays_num);
+
+    std::cout << "accelerator benchmark: " << bounded_objs.size() << " objects, " << rays_num << " rays\n";
+    for (auto type : { AcceleratorType::List, AcceleratorType::BVH, AcceleratorType::Grid, AcceleratorType::LazyBVH }) {
+        // 逐个求交太慢，物体多时只测一部分光线
+        int n = type == AcceleratorType::List ? std::min(rays_num, (int)(rays_num * 64 / std::max<size_t>(64, bounded_objs.size()))) : rays_num;
+        DWORD t1 = GetTickCount();
+        auto acc = CreateAccelerator(type, bounded_objs, camera->t1, camera->t2, thread_num);
+        DWORD t2 = GetTickCount();
+
+        std::atomic<int> hits_num(0);
+        RenderThreadPool pool(thread_num);
+        for (int from = 0; from < n; from += chunk) {
+            pool.AddTask([&](RenderTaskParam param) {
+                int hits = 0;
+                for (int i = param.from; i < param.to; i++) {
+                    hit_info hit;
+                    if (acc->hit(rays[i], 0.000001, std::numeric_limits<double>::infinity(), hit)) hits++;
+                }
+                hits_num += hits;
+            }, { from, std::min(n, from + chunk) });
+        }
+        pool.Dispatch();
+        pool.WaitForTaskEnding();
+        DWORD t3 = GetTickCount();
+
+        double trace_time = std::max(t3 - t2, (DWORD)1) * 1.0 / 1000;
+        std::cout << "  " << acc->GetName() << ": build = " << (t2 - t1) * 1.0 / 1000 << "s, "
+                  << n / trace_time / 1e6 << " Mrays/s, hit rate = " << (double)hits_num / n << std::endl;
+    }
+}
+
+// 比较噪声纹理的各种实现：Perlin 噪声的 SSE 版本与 double 参照版本，预采样网格与它的源噪声
+void benchmark_noise(vector<shared_ptr<Noise>> noises) {
+    constexpr int points_num = 1 << 20;
+
+    // 预采样网格的源噪声也单独比较一次
+    for (size_t i = 0; i < noises.size(); i++) {
+        auto volume = std::dynamic_pointer_cast<NoiseVolume>(noises[i]);
+        if (volume != nullptr && std::find(noises.begin(), noises.end(), volume->GetSource()) == noises.end())
+            noises.push_back(volume->GetSource());
+    }
+
+    std::cout << "noise benchmark: " << noises.size() << " noises, " << points_num << " points\n";
+    vector<point3d> points(points_num);
+    vector<double> values(points_num), reference(points_num);
+    // 每个实现对同一批点求值，返回每次调用的平均耗时（ns）
+    auto measure = [&](const Noise* noise, vector<double>& out, double (*turb)(const Noise*, const point3d&)) {
+        DWORD t = GetTickCount();
+        for (int i = 0; i < points_num; i++) out[i] = turb(noise, points[i]);
+        return std::max(GetTickCount() - t, (DWORD)1) * 1e6 / points_num;
+    };
+    auto compare = [&](double& max_error) {
+        double sum = 0.;
+        max_error = 0.;
+        for (int i = 0; i < points_num; i++) {
+            double d = std::abs(values[i] - reference[i]);
+            sum += d * d;
+            max_error = std::max(max_error, d);
+        }
+        return std::sqrt(sum / points_num);
+    };
+    auto turb = [](const Noise* noise, const point3d& p) { return noise->Turb(p); };
+    for (auto& noise : noises) {
+        double max_error, rms_error;
+        if (auto volume = std::dynamic_pointer_cast<NoiseVolume>(noise)) {
+            point3d p1, p2;
+            int nx, ny, nz;
+            volume->GetBounds(p1, p2);
+            volume->GetResolution(nx, ny, nz);
+            for (auto& p : points) p = point3d(get_random(p1.x, p2.x), get_random(p1.y, p2.y), get_random(p1.z, p2.z));
+            double source_time = measure(volume->GetSource().get(), reference, turb);
+            double volume_time = measure(volume.get(), values, turb);
+            rms_error = compare(max_error);
+            std::cout << "  volume " << nx << "x" << ny << "x" << nz << " (" << volume->GetMemorySize() / 1024 << " KB): lookup = "
+                      << volume_time << " ns, source = " << source_time << " ns, rms error = " << rms_error << ", max error = " << max_error << std::endl;
+        }
+        else if (auto perlin = std::dynamic_pointer_cast<PerlinNoise>(noise)) {
+            for (auto& p : points) p = get_random_vec3d(-100., 100.);
+            double reference_time = measure(perlin.get(), reference, [](const Noise* n, const point3d& p) {
+                return static_cast<const PerlinNoise*>(n)->TurbReference(p);
+            });
+            double sse_time = measure(perlin.get(), values, turb);
+            rms_error = compare(max_error);
+            std::cout << "  perlin: turb = " << sse_time << " ns, reference = " << reference_time << " ns, rms error = "
+                      << rms_error << ", max error = " << max_error << std::endl;
+        }
+    }
+}
+
+// 进程的峰值内存（MB）
+double get_peak_memory() {
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0.;
+    return counters.PeakWorkingSetSize / (1024. * 1024.);
+}
+
+// 以 args 为参数再启动一个 raytracer 进程，等它结束后返回退出码
+int run_child(const char* exe, const string& args) {
+    string command = "\"" + string(exe) + "\" " + args;
+    #ifdef _WIN32
+    // cmd 会去掉整条命令最外层的一对引号
+    command = "\"" + command + "\"";
+    #endif
+    return std::system(command.c_str());
+}
+
+// 以固定的分辨率、采样数和种子渲染 static 下的每个场景，每次渲染单独启动一个子进程（--bench-scene），峰值内存互不影响
+// 子进程把一行 JSON 写到临时文件，这里取每个场景最快的一次合并后写入 output，用 raytracer_compare 与基线比较
+int benchmark_scenes(const char* exe, const char* output) {
+    vector<string> scenes;
+    for (auto& entry : std::filesystem::directory_iterator(source_path)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".data") scenes.push_back(entry.path().filename().string());
+    }
+    std::sort(scenes.begin(), scenes.end());
+
+    ofstream out(output);
+    if (!out) {
+        std::cerr << output << " cannot be open.\n";
+        return 1;
+    }
+    string part_file = string(output) + ".part";
+    out << "{\n  \"seed\": " << BENCH_SEED << ",\n  \"width\": " << BENCH_WIDTH << ",\n  \"spp\": " << BENCH_SPP
+        << ",\n  \"runs\": " << BENCH_RUNS << ",\n  \"threads\": " << thread_num << ",\n  \"scenes\": [\n";
+    int failed = 0;
+    bool first = true;
+    for (auto& scene : scenes) {
+        string best_line;
+        double best_time = std::numeric_limits<double>::infinity();
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            std::remove(part_file.c_str());
+            std::cout << "bench " << scene << " run " << run + 1 << "/" << BENCH_RUNS << std::endl;
+            int code = run_child(exe, "--bench-scene " + scene + " \"" + part_file + "\"");
+            string line;
+            ifstream in(part_file);
+            if (in) std::getline(in, line);
+            size_t key = line.find("\"render_time_s\": ");
+            if (code != 0 || key == string::npos) {
+                best_line.clear();
+                break;
+            }
+            double render_time = atof(line.c_str() + key + 17);
+            if (render_time < best_time) best_time = render_time, best_line = line;
+        }
+        if (best_line.empty()) {
+            std::cerr << "bench " << scene << " failed.\n";
+            failed++;
+            continue;
+        }
+        out << (first ? "" : ",\n") << "    " << best_line;
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+    std::remove(part_file.c_str());
+    std::cout << output << " has been saved, " << scenes.size() - failed << " scenes, " << failed << " failed.\n";
+    return failed == 0 ? 0 : 1;
+}
+
+double get_seconds() {
+    static LARGE_INTEGER frequency = [] { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f; }();
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+}
+
+// 渐进渲染：工作线程在所有遍之间常驻，每遍由主线程发布 h 个行任务，工作线程按全局序号领取，第 i 个任务是第 i / h 遍的第 i % h 行
+// 线程只在构造时创建一次，析构时回收，每遍的用时不包含线程创建和退出
+class ProgressiveRender {
+    vector<Color>& accum;
+    int pass_spp;
+    int h, w;
+    unsigned seed = 0;
+    std::atomic<int> next{ 0 }, limit{ 0 }, done{ 0 };
+    std::atomic<bool> stop{ false };
+    RenderThreadPool pool;
+
+    void Work() {
+        while (!stop.load()) {
+            int i = next.load();
+            if (i >= limit.load()) {
+                Sleep(0);
+                continue;
+            }
+            if (!next.compare_exchange_weak(i, i + 1)) continue;
+            RenderRow(i % h);
+            done.fetch_add(1);
+        }
+    }
+    void RenderRow(int y) {
+        srand(seed + y);
+        for (int x = 0; x < w; x++) {
+            Color c;
+            for (int i = 0; i < pass_spp; i++) {
+                double v = (double)(y + get_random()) / (h - 1.);
+                double u = (double)(x + get_random()) / (w - 1.);
+                c = c + ray_cast(camera->get_ray(u, v));
+            }
+            accum[(size_t)y * w + x] = accum[(size_t)y * w + x] + c;
+        }
+        flush_rays();
+    }
+public:
+    ProgressiveRender(vector<Color>& accum, int pass_spp) : accum(accum), pass_spp(pass_spp), h(image.get_height()), w(image.get_width()), pool(thread_num) {
+        for (int i = 0; i < thread_num; i++) pool.AddTask([this](RenderTaskParam) { Work(); }, { i, i + 1 });
+        pool.Dispatch();
+    }
+    ~ProgressiveRender() {
+        stop.store(true);
+        pool.WaitForTaskEnding();
+    }
+    // 每个像素再采 pass_spp 个样本累加到 accum，第 y 行的随机数种子为 pass_seed + y，返回从发布任务到最后一行完成的秒数
+    double Pass(unsigned pass_seed) {
+        seed = pass_seed;
+        double start = get_seconds();
+        int target = limit.load() + h;
+        limit.store(target);
+        while (done.load() < target) Sleep(0);
+        return get_seconds() - start;
+    }
+};
+
+// 按通道计算 RMSE 和 relMSE（误差平方除以参考值平方加 0.01，暗处不会被放大成无穷）
+// 读入的参考图第 0 行在最上面，帧缓冲第 0 行在最下面
+void compute_error(const vector<Color>& accum, int total_spp, PPMImage& reference, double& rmse, double& relmse) {
+    int h = image.get_height(), w = image.get_width();
+    double sum = 0., rel_sum = 0.;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            Color c = accum[(size_t)y * w + x] / total_spp, r = reference.get_color(x, h - 1 - y);
+            double d[3] = { c.r - r.r, c.g - r.g, c.b - r.b }, ref[3] = { r.r, r.g, r.b };
+            for (int k = 0; k < 3; k++) {
+                sum += d[k] * d[k];
+                rel_sum += d[k] * d[k] / (ref[k] * ref[k] + 0.01);
+            }
+        }
+    }
+    rmse = std::sqrt(sum / ((size_t)h * w * 3));
+    relmse = rel_sum / ((size_t)h * w * 3);
+}
+
+// 参考图：以 REFERENCE_SPP 渲染后保存为 PFM（线性值）
+int render_reference(const char* reference_name) {
+    vector<Color> accum((size_t)image.get_width() * image.get_height());
+    ProgressiveRender render(accum, 16);
+    double start = get_seconds();
+    for (int total = 0; total < REFERENCE_SPP; total += 16) {
+        render.Pass(REFERENCE_SEED + total / 16 * image.get_height());
+        if ((total + 16) % 256 == 0) std::cout << "reference: " << total + 16 << "/" << REFERENCE_SPP << " spp, " << get_seconds() - start << "s" << std::endl;
+    }
+    for (int y = 0; y < image.get_height(); y++) {
+        for (int x = 0; x < image.get_width(); x++)
+            image.set_pixel(x, y, accum[(size_t)y * image.get_width() + x] / REFERENCE_SPP);
+    }
+    image.write_to_file((string(source_path) + reference_name).c_str());
+    return 0;
+}
+
+// 在 budget 秒内逐遍加 1 spp，spp 每增加约 25% 记录一次用时和误差，最后一遍结束时再记录一次，结果写成一行 JSON
+// 计算误差和创建线程池的时间不计入用时
+int render_equal_time(const char* config_name, const char* reference_name, double budget, const char* output) {
+    PPMImage reference;
+    reference.read_from_file(reference_name);
+    if (reference.get_width() != image.get_width() || reference.get_height() != image.get_height()) {
+        std::cerr << reference_name << " does not match " << config_name << ".\n";
+        return 1;
+    }
+    vector<Color> accum((size_t)image.get_width() * image.get_height());
+    vector<double> times, rmses, relmses;
+    vector<int> spps;
+    ProgressiveRender render(accum, 1);
+    double render_time = 0.;
+    int next_record = 1;
+    for (int total = 1; ; total++) {
+        render_time += render.Pass(BENCH_SEED + (total - 1) * image.get_height());
+        bool last = render_time >= budget;
+        if (total >= next_record || last) {
+            double rmse, relmse;
+            compute_error(accum, total, reference, rmse, relmse);
+            spps.push_back(total), times.push_back(render_time), rmses.push_back(rmse), relmses.push_back(relmse);
+            next_record = std::max(total + 1, (int)(total * 1.25));
+        }
+        if (last) break;
+    }
+    std::cout << config_name << ": " << spps.back() << " spp in " << render_time << "s, rmse = " << rmses.back()
+              << ", relmse = " << relmses.back() << ", " << rays_num.load() / render_time / 1e6 << " Mrays/s" << std::endl;
+
+    ofstream out(output);
+    auto write_array = [&out](const char* key, const auto& values) {
+        out << ", \"" << key << "\": [";
+        for (size_t i = 0; i < values.size(); i++) out << (i > 0 ? ", " : "") << values[i];
+        out << "]";
+    };
+    out.precision(8);
+    out << "{ \"name\": \"" << config_name << "\", \"spp\": " << spps.back() << ", \"rmse\": " << rmses.back() << ", \"relmse\": " << relmses.back();
+    write_array("spp_curve", spps);
+    write_array("time_curve", times);
+    write_array("rmse_curve", rmses);
+    write_array("relmse_curve", relmses);
+    out << " }\n";
+    return out ? 0 : 1;
+}
+
+// 从 render_equal_time 写的一行 JSON 中取出 key 对应的数组
+vector<double> get_json_array(const string& line, const char* key) {
+    vector<double> values;
+    size_t p = line.find("\"" + string(key) + "\": [");
+    if (p == string::npos) return values;
+    const char* c = line.c_str() + line.find('[', p) + 1;
+    while (*c != ']' && *c != '\0') {
+        char* next;
+        values.push_back(strtod(c, &next));
+        if (next == c) break;
+        c = next;
+        while (*c == ',' || *c == ' ') ++c;
+    }
+    return values;
+}
+
+// 误差-时间曲线（双对数坐标）画成 SVG，每个候选配置一条折线
+void write_error_plot(const char* file_name, const vector<string>& names, const vector<vector<double>>& times, const vector<vector<double>>& errors) {
+    constexpr int width = 800, height = 500, left = 70, right = 200, top = 20, bottom = 50;
+    const char* colors[] = { "#1f77b4", "#d62728", "#2ca02c", "#ff7f0e", "#9467bd", "#8c564b", "#e377c2", "#17becf" };
+    double t_min = std::numeric_limits<double>::infinity(), t_max = 0., e_min = t_min, e_max = 0.;
+    for (size_t i = 0; i < names.size(); i++) {
+        for (size_t j = 0; j < times[i].size(); j++) {
+            if (times[i][j] <= 0. || errors[i][j] <= 0.) continue;
+            t_min = std::min(t_min, times[i][j]), t_max = std::max(t_max, times[i][j]);
+            e_min = std::min(e_min, errors[i][j]), e_max = std::max(e_max, errors[i][j]);
+        }
+    }
+    if (!(t_max > t_min) || !(e_max > e_min)) return;
+    // 坐标轴范围取到整 10 的幂
+    double lt0 = std::floor(std::log10(t_min)), lt1 = std::ceil(std::log10(t_max));
+    double le0 = std::floor(std::log10(e_min)), le1 = std::ceil(std::log10(e_max));
+    auto px = [&](double t) { return left + (std::log10(t) - lt0) / (lt1 - lt0) * (width - left - right); };
+    auto py = [&](double e) { return top + (le1 - std::log10(e)) / (le1 - le0) * (height - top - bottom); };
+
+    ofstream out(file_name);
+    out << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << width << "\" height=\"" << height << "\" font-family=\"sans-serif\" font-size=\"12\">\n";
+    out << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
+    for (double l = lt0; l <= lt1; l++) {
+        double x = px(std::pow(10., l));
+        out << "<line x1=\"" << x << "\" y1=\"" << top << "\" x2=\"" << x << "\" y2=\"" << height - bottom << "\" stroke=\"#ddd\"/>\n";
+        out << "<text x=\"" << x << "\" y=\"" << height - bottom + 16 << "\" text-anchor=\"middle\">" << std::pow(10., l) << "</text>\n";
+    }
+    for (double l = le0; l <= le1; l++) {
+        double y = py(std::pow(10., l));
+        out << "<line x1=\"" << left << "\" y1=\"" << y << "\" x2=\"" << width - right << "\" y2=\"" << y << "\" stroke=\"#ddd\"/>\n";
+        out << "<text x=\"" << left - 6 << "\" y=\"" << y + 4 << "\" text-anchor=\"end\">" << std::pow(10., l) << "</text>\n";
+    }
+    out << "<text x=\"" << (left + width - right) / 2 << "\" y=\"" << height - 12 << "\" text-anchor=\"middle\">render time (s)</text>\n";
+    out << "<text x=\"16\" y=\"" << (top + height - bottom) / 2 << "\" text-anchor=\"middle\" transform=\"rotate(-90 16 " << (top + height - bottom) / 2 << ")\">RMSE</text>\n";
+    for (size_t i = 0; i < names.size(); i++) {
+        const char* color = colors[i % 8];
+        out << "<polyline fill=\"none\" stroke=\"" << color << "\" stroke-width=\"2\" points=\"";
+        for (size_t j = 0; j < times[i].size(); j++) {
+            if (times[i][j] > 0. && errors[i][j] > 0.) out << px(times[i][j]) << "," << py(errors[i][j]) << " ";
+        }
+        out << "\"/>\n";
+        out << "<text x=\"" << width - right + 10 << "\" y=\"" << top + 16 * (i + 1) << "\" fill=\"" << color << "\">" << names[i] << "</text>\n";
+    }
+    out << "</svg>\n";
+    std::cout << file_name << " has been saved.\n";
+}
+
+// 等时画质比较：raytracer --quality 时间预算（秒） 参考场景 [候选场景...]
+// 参考图只渲染一次，保存在 static 下（名字为场景名加 .reference.pfm），删掉后才会重新渲染
+// 每个候选配置在同样的时间预算内渐进渲染，与参考图比较误差，结果写入 quality.json，误差-时间曲线写入 quality.svg
+int compare_quality(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "usage: raytracer --quality budget_seconds reference.data [candidate.data ...]\n";
+        return 1;
+    }
+    const char* exe = argv[0];
+    string budget = argv[2], reference_config = argv[3];
+    vector<string> candidates(argv + 4, argv + argc);
+    if (candidates.empty()) candidates.push_back(reference_config);
+
+    string reference_name = reference_config.substr(0, reference_config.find_last_of('.')) + ".reference.pfm";
+    if (!std::filesystem::exists(string(source_path) + reference_name)) {
+        std::cout << "render reference " << reference_name << " (" << REFERENCE_SPP << " spp)" << std::endl;
+        if (run_child(exe, "--quality-reference " + reference_config + " " + reference_name) != 0) {
+            std::cerr << "render reference failed.\n";
+            return 1;
+        }
+    }
+
+    string part_file = "quality.json.part";
+    vector<string> names, lines;
+    vector<vector<double>> times, errors;
+    for (auto& candidate : candidates) {
+        std::remove(part_file.c_str());
+        string line;
+        if (run_child(exe, "--quality-run " + candidate + " " + reference_name + " " + budget + " " + part_file) == 0) {
+            ifstream in(part_file);
+            std::getline(in, line);
+        }
+        if (line.empty()) {
+            std::cerr << "quality " << candidate << " failed.\n";
+            continue;
+        }
+        names.push_back(candidate);
+        lines.push_back(line);
+        times.push_back(get_json_array(line, "time_curve"));
+        errors.push_back(get_json_array(line, "rmse_curve"));
+    }
+    std::remove(part_file.c_str());
+
+    ofstream out("quality.json");
+    out << "{\n  \"reference\": \"" << reference_name << "\",\n  \"reference_spp\": " << REFERENCE_SPP << ",\n  \"budget_s\": " << budget
+        << ",\n  \"width\": " << QUALITY_WIDTH << ",\n  \"candidates\": [\n";
+    for (size_t i = 0; i < lines.size(); i++) out << "    " << lines[i] << (i + 1 < lines.size() ? ",\n" : "\n");
+    out << "  ]\n}\n";
+    std::cout << "quality.json has been saved.\n";
+    write_error_plot("quality.svg", names, times, errors);
+    return lines.size() == candidates.size() ? 0 : 1;
+}
+
 void init_world(ConfigManager* configManager) {
-    if (configManager->CheckIsSampleWorld()) get_sample_world(configManager);
+    if (configManager->GetManyLightsNum() > 0) get_many_light_world(configManager, configManager->GetManyLightsNum());
+    else if (configManager->CheckIsSampleWorld()) get_sample_world(configManager);
     else get_complex_world(configManager);
 }
 
@@ -250,30 +930,178 @@ void init_world(ConfigManager* configManager) {
 int main(int argc, char *argv[])
 {
     //srand((unsigned)time(NULL));
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) return benchmark_scenes(argv[0], argc > 2 ? argv[2] : "bench_scenes.json");
+    if (argc > 1 && strcmp(argv[1], "--quality") == 0) return compare_quality(argc, argv);
+    // 基准和画质比较的子进程，由 benchmark_scenes 和 compare_quality 启动：
+    // raytracer --bench-scene 场景 输出文件
+    // raytracer --quality-reference 场景 参考图
+    // raytracer --quality-run 场景 参考图 时间预算 输出文件
+    bool quality_reference = argc > 3 && strcmp(argv[1], "--quality-reference") == 0;
+    bool quality_run = argc > 5 && strcmp(argv[1], "--quality-run") == 0;
+    bool bench = (argc > 3 && strcmp(argv[1], "--bench-scene") == 0) || quality_reference || quality_run;
+    if (bench) {
+        srand(BENCH_SEED);
+        count_rays = true;
+        fixed_seed = true;
+    }
 
+    DWORD load_start = GetTickCount();
+    DWORD build_time = 0;
+    TraceSpan load_span("scene load");
     #ifdef INIT_WORLD_WITH_CONFIG
     ConfigManager* configManager = nullptr;
 
-    if (argc > 1) configManager = new ConfigManager(argv[1]);
+    if (bench) configManager = new ConfigManager(argv[2]);
+    else if (argc > 1) configManager = new ConfigManager(argv[1]);
     
     if (configManager == nullptr) configManager = new ConfigManager("cornell.data");
-    configManager->GetConfig();
-
-    init_world(configManager);
 
-    delete configManager;
+    // 配置文件和它引用的文件都没有变化时直接从场景缓存恢复，跳过解析和建树；基准模式总是完整加载
+    SceneCache scene_cache(*configManager);
+    bool from_cache = !bench && scene_cache.Load(*configManager);
+    if (from_cache) {
+        get_config_settings(configManager);
+        objs = configManager->GetObjects();
+    }
+    else {
+        configManager->GetConfig();
+        init_world(configManager);
+    }
+    bool light_bench = !bench && configManager->CheckLightBench() && light_sampling != LightSampling::None;
+    bool accel_bench = !bench && configManager->CheckAccelBench();
+    bool noise_bench = !bench && configManager->CheckNoiseBench();
+    vector<shared_ptr<Noise>> noises;
     #else
     init_world(nullptr);
     #endif
 
-    bvh_root = make_shared<BVH_Node>(objs, 0, objs.size(), 0, 1);
+    vector<shared_ptr<Hittable>> bounded_objs;
+    for (auto& obj : objs) {
+        AABB box;
+        if (obj->bounding_box(0, 1, box)) bounded_objs.push_back(obj);
+        else unbounded_objs.push_back(obj);
+    }
 
-    #ifdef MUTILTHREAD
-    render_with_mutilthread();
-    #else
-    render();
+    #ifdef INIT_WORLD_WITH_CONFIG
+    if (accel_bench) {
+        delete configManager;
+        benchmark_accelerators(bounded_objs);
+        return 0;
+    }
+    if (from_cache) accelerator = scene_cache.GetAccelerator();
+    #endif
+    refit_prototypes();
+    if (accelerator == nullptr) {
+        DWORD build_start = GetTickCount();
+        TraceSpan build_span("bvh build");
+        accelerator = CreateAccelerator(accelerator_type, bounded_objs, camera->t1, camera->t2, thread_num);
+        build_span.End();
+        build_time = GetTickCount() - build_start;
+        std::cout << accelerator->GetName() << " build: " << build_time * 1.0 / 1000 << "s" << std::endl;
+    }
+
+    #ifdef INIT_WORLD_WITH_CONFIG
+    // 解析结束后图像解码和噪声表生成已交给线程池，与上面的加速结构构建同时进行
+    configManager->WaitForLoading();
+    configManager->CompileTextures();
+    get_env_map(configManager);
+    if (noise_bench) noises = configManager->GetNoises();
+    if (!from_cache && !bench && configManager->CheckSceneCache()) scene_cache.Save(*configManager, objs, accelerator);
+    delete configManager;
+    #endif
+    // 代码里搭建的场景不经过 ConfigManager，材质的纹理图在这里编译
+    for (auto& obj : objs) {
+        if (obj->get_material() != nullptr) obj->get_material()->compile_texture();
+    }
+    load_span.End();
+    std::cout << "scene load: " << (GetTickCount() - load_start) * 1.0 / 1000 << "s" << std::endl;
+
+    if (light_sampling != LightSampling::None) {
+        light_bvh = make_shared<LightBVH>(objs, 0, 1);
+        std::cout << "light bvh: " << light_bvh->GetLightsNum() << " lights\n";
+    }
+
+    #ifdef INIT_WORLD_WITH_CONFIG
+    if (light_bench) {
+        benchmark_light_sampling();
+        return 0;
+    }
+    if (noise_bench) {
+        benchmark_noise(noises);
+        return 0;
+    }
     #endif
 
-    image.write_to_file("image.ppm");
+    if (bench) {
+        int bench_width = quality_reference || quality_run ? QUALITY_WIDTH : BENCH_WIDTH;
+        image = PPMImage((int)std::lround((double)bench_width * image.get_height() / image.get_width()), bench_width);
+        spp = BENCH_SPP;
+        frames_num = 1;
+    }
+
+    // 主光线的光锥每个像素张开一个像素的视角
+    camera->pixel_spread = std::tan(camera->vfov * PI / 180. / 2) * 2. / image.get_height();
+
+    if (quality_reference) return render_reference(argv[3]);
+    if (quality_run) return render_equal_time(argv[2], argv[3], atof(argv[4]), argv[5]);
+
+    // 多帧时每帧的快门区间依次后移 frame_time，加速结构按新的区间更新
+    double shutter_t1 = camera->t1, shutter_t2 = camera->t2;
+    for (int frame = 0; frame < frames_num; frame++) {
+        if (frame > 0) {
+            camera->t1 = shutter_t1 + frame * frame_time;
+            camera->t2 = shutter_t2 + frame * frame_time;
+            DWORD t = GetTickCount();
+            TraceSpan update_span("bvh update");
+            refit_prototypes();
+            accelerator->Update(camera->t1, camera->t2, thread_num);
+            update_span.End();
+            std::cout << "frame " << frame << " " << accelerator->GetName() << " update: " << (GetTickCount() - t) * 1.0 / 1000 << "s" << std::endl;
+            if (irradiance_cache != nullptr) irradiance_cache->Clear();
+        }
+
+        TraceSpan render_span("render", frame, frame + 1);
+        #ifdef MUTILTHREAD
+        DWORD render_time = render_with_mutilthread();
+        #else
+        DWORD render_time = render();
+        #endif
+        render_span.End();
+
+        auto lazy_bvh = std::dynamic_pointer_cast<LazyBVHAccelerator>(accelerator);
+        if (lazy_bvh != nullptr) std::cout << "lazy bvh expanded nodes = " << lazy_bvh->GetNodesNum() << std::endl;
+        if (irradiance_cache != nullptr) std::cout << "irradiance cache records = " << irradiance_cache->GetRecordsNum() << std::endl;
+        if (texture_cache != nullptr) texture_cache->PrintStatistics();
+
+        // 多帧时在扩展名前加上帧号，如 image_001.ppm
+        size_t dot = output_file.find_last_of('.');
+        if (dot == string::npos) dot = output_file.size();
+        char frame_id[16] = "";
+        if (frames_num > 1) snprintf(frame_id, sizeof(frame_id), "_%03d", frame);
+        #ifdef RENDER_STATS
+        // 每帧单独统计，写到与图像同名的 _stats.json
+        RenderStats::Report(output_file.substr(0, dot) + frame_id + "_stats.json");
+        RenderStats::Reset();
+        #endif
+
+        if (bench) {
+            // 不写图像，只把本场景的结果写成一行 JSON
+            double wall_time = (GetTickCount() - load_start) * 1.0 / 1000;
+            double render_seconds = std::max(render_time, (DWORD)1) * 1.0 / 1000;
+            ofstream out(argv[3]);
+            out << "{ \"name\": \"" << argv[2] << "\", \"width\": " << image.get_width() << ", \"height\": " << image.get_height()
+                << ", \"wall_time_s\": " << wall_time << ", \"render_time_s\": " << render_time * 1.0 / 1000
+                << ", \"bvh_build_s\": " << build_time * 1.0 / 1000 << ", \"rays\": " << rays_num.load()
+                << ", \"rays_per_s\": " << rays_num.load() / render_seconds << ", \"peak_rss_mb\": " << get_peak_memory() << " }\n";
+            return out ? 0 : 1;
+        }
+        TraceSpan write_span("image write", frame, frame + 1);
+        image.write_to_file((output_file.substr(0, dot) + frame_id + output_file.substr(dot)).c_str());
+    }
+    #ifdef RENDER_TRACE
+    // 整个运行过程的时间线，写到与图像同名的 _trace.json
+    size_t dot = output_file.find_last_of('.');
+    Trace::Write(output_file.substr(0, dot == string::npos ? output_file.size() : dot) + "_trace.json");
+    #endif
     return 0;
 }
\ No newline at end of file
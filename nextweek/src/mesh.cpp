@@ -0,0 +1,268 @@
+﻿#include "mesh.hpp"
+#include "global.hpp"
+#include <numeric>
+
+static constexpr int MAX_LEAF_SIZE = 4;
+static constexpr int SAH_BINS = 16;
+// 遍历栈的大小；SAH 划分到 MAX_SAH_DEPTH 层后改用中位数划分，再往下最多 31 层，树深不会超过栈的大小
+static constexpr int STACK_SIZE = 128;
+static constexpr int MAX_SAH_DEPTH = 64;
+
+static point3d min_point(const point3d& a, const point3d& b) { return point3d(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)); }
+static point3d max_point(const point3d& a, const point3d& b) { return point3d(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)); }
+static double surface_area(const point3d& bmin, const point3d& bmax) {
+    vec3d d = bmax - bmin;
+    return 2. * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+Mesh::Mesh(std::shared_ptr<MeshData> data_, std::shared_ptr<Material> m) : Hittable(m), data(data_) {
+    size_t n = data->GetTrianglesNum();
+    std::vector<point3d> tri_min(n), tri_max(n), centroids(n);
+    for (size_t i = 0; i < n; i++) {
+        auto& idx = data->position_indices[i];
+        auto& p0 = data->positions[idx.x];
+        auto& p1 = data->positions[idx.y];
+        auto& p2 = data->positions[idx.z];
+        tri_min[i] = min_point(min_point(p0, p1), p2);
+        tri_max[i] = max_point(max_point(p0, p1), p2);
+        centroids[i] = (tri_min[i] + tri_max[i]) * 0.5;
+    }
+    triangles.resize(n);
+    std::iota(triangles.begin(), triangles.end(), 0);
+    nodes.reserve(n / 2 + 1);
+    if (n > 0) Build(0, (int)n, 0, tri_min, tri_max, centroids);
+}
+
+// 在质心包围盒最长轴上分桶计算 SAH，返回节点下标
+int Mesh::Build(int start, int end, int depth, const std::vector<point3d>& tri_min, const std::vector<point3d>& tri_max, const std::vector<point3d>& centroids) {
+    int index = (int)nodes.size();
+    nodes.emplace_back();
+
+    double inf = std::numeric_limits<double>::infinity();
+    point3d bmin(inf, inf, inf), bmax(-inf, -inf, -inf);
+    point3d cmin = bmin, cmax = bmax;
+    for (int i = start; i < end; i++) {
+        int t = triangles[i];
+        bmin = min_point(bmin, tri_min[t]);
+        bmax = max_point(bmax, tri_max[t]);
+        cmin = min_point(cmin, centroids[t]);
+        cmax = max_point(cmax, centroids[t]);
+    }
+    Node node{ bmin, bmax, start, end - start, 0 };
+    int count = end - start;
+    if (count <= MAX_LEAF_SIZE) {
+        nodes[index] = node;
+        return index;
+    }
+
+    vec3d extent = cmax - cmin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    double cmin_axis = cmin[axis];
+    double axis_extent = extent[axis];
+    int mid = (start + end) / 2;
+
+    bool use_sah = axis_extent > EPS && depth < MAX_SAH_DEPTH;
+    if (use_sah) {
+        auto get_bin = [&](int t) { return std::min(SAH_BINS - 1, (int)((centroids[t][axis] - cmin_axis) / axis_extent * SAH_BINS)); };
+        struct Bin { point3d bmin, bmax; int count; };
+        Bin bins[SAH_BINS];
+        for (auto& bin : bins) bin = Bin{ point3d(inf, inf, inf), point3d(-inf, -inf, -inf), 0 };
+        for (int i = start; i < end; i++) {
+            int t = triangles[i];
+            auto& bin = bins[get_bin(t)];
+            bin.bmin = min_point(bin.bmin, tri_min[t]);
+            bin.bmax = max_point(bin.bmax, tri_max[t]);
+            bin.count++;
+        }
+
+        // right_cost[i] 为第 i+1 到最后一个桶的 N * A
+        double right_cost[SAH_BINS];
+        point3d rmin(inf, inf, inf), rmax(-inf, -inf, -inf);
+        int rcount = 0;
+        for (int i = SAH_BINS - 1; i > 0; i--) {
+            rmin = min_point(rmin, bins[i].bmin);
+            rmax = max_point(rmax, bins[i].bmax);
+            rcount += bins[i].count;
+            right_cost[i - 1] = rcount > 0 ? rcount * surface_area(rmin, rmax) : 0.;
+        }
+        point3d lmin(inf, inf, inf), lmax(-inf, -inf, -inf);
+        int lcount = 0, best = -1;
+        double best_cost = inf;
+        for (int i = 0; i < SAH_BINS - 1; i++) {
+            lmin = min_point(lmin, bins[i].bmin);
+            lmax = max_point(lmax, bins[i].bmax);
+            lcount += bins[i].count;
+            if (lcount == 0 || lcount == count) continue;
+            double cost = lcount * surface_area(lmin, lmax) + right_cost[i];
+            if (cost < best_cost) best_cost = cost, best = i;
+        }
+
+        if (best >= 0) {
+            if (count <= 4 * MAX_LEAF_SIZE && count * surface_area(bmin, bmax) <= best_cost) {
+                nodes[index] = node;
+                return index;
+            }
+            mid = (int)(std::partition(triangles.begin() + start, triangles.begin() + end,
+                [&](int t) { return get_bin(t) <= best; }) - triangles.begin());
+        }
+    }
+    if (mid == start || mid == end || !use_sah) {
+        mid = (start + end) / 2;
+        std::nth_element(triangles.begin() + start, triangles.begin() + mid, triangles.begin() + end,
+            [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+    }
+
+    Build(start, mid, depth + 1, tri_min, tri_max, centroids);
+    node.offset = Build(mid, end, depth + 1, tri_min, tri_max, centroids);
+    node.count = 0;
+    node.axis = axis;
+    nodes[index] = node;
+    return index;
+}
+
+// 检查从场景缓存读入的树：右孩子在左孩子之后，不会成环；叶节点的区间在 triangles 内，三角形编号有效；树深不超过遍历栈
+bool Mesh::CheckTree() const {
+    int nodes_num = (int)nodes.size(), triangles_num = (int)data->GetTrianglesNum();
+    std::vector<int> depth(nodes_num, 0);
+    for (int i = 0; i < nodes_num; i++) {
+        auto& node = nodes[i];
+        if (node.count == 0) {
+            if (node.offset <= i + 1 || node.offset >= nodes_num || node.axis < 0 || node.axis > 2 || depth[i] >= STACK_SIZE) return false;
+            depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+            depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+        }
+        else if (node.count < 0 || node.offset < 0 || node.offset > (int)triangles.size() - node.count) return false;
+    }
+    for (int tri : triangles) {
+        if (tri < 0 || tri >= triangles_num) return false;
+    }
+    return true;
+}
+
+static bool box_hit(const point3d& bmin, const point3d& bmax, const Ray& ray, const vec3d& inv_dir, double t_min, double t_max) {
+    for (int i = 0; i < 3; i++) {
+        double t0 = (bmin[i] - ray.o[i]) * inv_dir[i];
+        double t1 = (bmax[i] - ray.o[i]) * inv_dir[i];
+        if (t0 > t1) std::swap(t0, t1);
+        if (t0 > t_min) t_min = t0;
+        if (t1 < t_max) t_max = t1;
+        if (t_min > t_max) return false;
+    }
+    return true;
+}
+
+bool Mesh::hit(const Ray& ray, double t_min, double t_max, hit_info& ret) {
+    if (nodes.empty()) return false;
+
+    // watertight 测试：把光线方向最大的分量作为 z 轴，三角形顶点剪切到光线空间后用 2D 边函数判断
+    auto& dir = ray.dir;
+    int kz = std::abs(dir.x) > std::abs(dir.y) ? (std::abs(dir.x) > std::abs(dir.z) ? 0 : 2) : (std::abs(dir.y) > std::abs(dir.z) ? 1 : 2);
+    int kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+    if (dir[kz] < 0.) std::swap(kx, ky);
+    double sx = dir[kx] / dir[kz];
+    double sy = dir[ky] / dir[kz];
+    double sz = 1. / dir[kz];
+    vec3d inv_dir(1. / dir.x, 1. / dir.y, 1. / dir.z);
+
+    int stack[STACK_SIZE];
+    int sp = 0, node_index = 0, hit_tri = -1;
+    double closest = t_max, b0 = 0., b1 = 0., b2 = 0.;
+    while (true) {
+        const Node& node = nodes[node_index];
+        STATS_ADD(bvh_nodes, 1);
+        STATS_ADD(box_tests, 1);
+        if (box_hit(node.bmin, node.bmax, ray, inv_dir, t_min, closest)) {
+            if (node.count == 0) {
+                // 先走光线方向上较近的孩子
+                int near_index = node_index + 1, far_index = node.offset;
+                if (dir[node.axis] < 0.) std::swap(near_index, far_index);
+                stack[sp++] = far_index;
+                node_index = near_index;
+                continue;
+            }
+            STATS_ADD(primitive_tests[(int)StatsPrimitive::Triangle], node.count);
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                int tri = triangles[i];
+                auto& idx = data->position_indices[tri];
+                vec3d a = data->positions[idx.x] - ray.o;
+                vec3d b = data->positions[idx.y] - ray.o;
+                vec3d c = data->positions[idx.z] - ray.o;
+                double ax = a[kx] - sx * a[kz], ay = a[ky] - sy * a[kz];
+                double bx = b[kx] - sx * b[kz], by = b[ky] - sy * b[kz];
+                double cx = c[kx] - sx * c[kz], cy = c[ky] - sy * c[kz];
+                double u = cx * by - cy * bx;
+                double v = ax * cy - ay * cx;
+                double w = bx * ay - by * ax;
+                if ((u < 0. || v < 0. || w < 0.) && (u > 0. || v > 0. || w > 0.)) continue;
+                double det = u + v + w;
+                if (det == 0.) continue;
+                double t = (u * sz * a[kz] + v * sz * b[kz] + w * sz * c[kz]) / det;
+                if (t < t_min || t > closest) continue;
+                closest = t;
+                hit_tri = tri;
+                b0 = u / det, b1 = v / det, b2 = w / det;
+            }
+        }
+        if (sp == 0) break;
+        node_index = stack[--sp];
+    }
+    if (hit_tri < 0) return false;
+
+    auto& idx = data->position_indices[hit_tri];
+    auto& p0 = data->positions[idx.x];
+    vec3d ng = cross(data->positions[idx.y] - p0, data->positions[idx.z] - p0);
+    double area = ng.length();
+    ng = ng.normalize();
+    vec3d n = ng;
+    if (!data->normal_indices.empty() && data->normal_indices[hit_tri].x >= 0) {
+        auto& ni = data->normal_indices[hit_tri];
+        n = (data->normals[ni.x] * b0 + data->normals[ni.y] * b1 + data->normals[ni.z] * b2).normalize();
+        if (dot(n, ng) < 0.) ng = vec3d() - ng;
+    }
+    if (!data->uv_indices.empty() && data->uv_indices[hit_tri].x >= 0) {
+        auto& ti = data->uv_indices[hit_tri];
+        vec3d uv = data->uvs[ti.x] * b0 + data->uvs[ti.y] * b1 + data->uvs[ti.z] * b2;
+        ret.u = uv.x, ret.v = uv.y;
+        vec3d e1 = data->uvs[ti.y] - data->uvs[ti.x], e2 = data->uvs[ti.z] - data->uvs[ti.x];
+        double uv_area = std::abs(e1.x * e2.y - e1.y * e2.x);
+        ret.uv_scale = uv_area > 0. ? std::sqrt(area / uv_area) : 0.;
+    }
+    else {
+        // 没有 UV 时以重心坐标作为 UV，UV 空间里的三角形面积（的两倍）为 1
+        ret.u = b1, ret.v = b2;
+        ret.uv_scale = std::sqrt(area);
+    }
+
+    ret.t = closest;
+    ret.point = ray.at(closest);
+    ret.normal = n;
+    if (dot(ng, ray.dir) > 0.) {
+        ret.normal = vec3d() - n;
+        ret.inside_obj = true;
+    }
+    else ret.inside_obj = false;
+    ret.obj = shared_from_this();
+    return true;
+}
+
+bool Mesh::scatter(Ray& ray_out, const hit_info& hit) const {
+    shared_ptr<scatter_info> info;
+    if (std::dynamic_pointer_cast<Dielectrics>(material)) {
+        auto dielectrics_material = std::dynamic_pointer_cast<Dielectrics>(material);
+        double refraction_ratio;
+        if (hit.inside_obj) refraction_ratio = dielectrics_material->get_refraction_eta() / global_air.get_refraction_eta();
+        else refraction_ratio = global_air.get_refraction_eta() / dielectrics_material->get_refraction_eta();
+
+        info = std::make_shared<dielectrics_scatter_info>(hit.point, hit.normal, hit.cast_ray_dir, hit.ray_time, refraction_ratio);
+    }
+    else info = std::make_shared<scatter_info>(hit.point, hit.normal, hit.cast_ray_dir, hit.ray_time);
+    bool is_scatter = material->scatter(info);
+    ray_out = info->scatter_ray;
+    return is_scatter;
+}
+
+bool Mesh::bounding_box(const double, const double, AABB& output_box) const {
+    if (nodes.empty()) return false;
+    output_box = AABB(nodes[0].bmin, nodes[0].bmax);
+    return true;
+}
@@ -0,0 +1,116 @@
+#include "noise.hpp"
+#include "RenderThreadPool.hpp"
+#include <algorithm>
+#include <cmath>
+#ifdef PERLIN_SSE
+#include <emmintrin.h>
+#endif
+
+#ifdef PERLIN_SSE
+// 8 个角点按 (di << 2) | (dj << 1) | dk 编号，di = 0 和 di = 1 的 4 个角点各占一个 SSE 寄存器
+// 各倍频的结果先在寄存器里按权重累加，最后才做一次水平求和
+double PerlinNoise::TurbSSE(const point3d& p) const {
+    const __m128 corner_y = _mm_setr_ps(0.f, 0.f, 1.f, 1.f);
+    const __m128 corner_z = _mm_setr_ps(0.f, 1.f, 0.f, 1.f);
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    double x = p.x, y = p.y, z = p.z;
+    float weight = 1.f;
+    for (int depth = 0; depth < TURB_DEPTH; depth++) {
+        // 截断后负数再减 1 即为向下取整，不调用 std::floor
+        int i = (int)x, j = (int)y, k = (int)z;
+        i -= x < i, j -= y < j, k -= z < k;
+        float u = (float)(x - i), v = (float)(y - j), w = (float)(z - k);
+
+        int px0 = permutation_x[i & 255], px1 = permutation_x[(i + 1) & 255];
+        int py0 = permutation_y[j & 255], py1 = permutation_y[(j + 1) & 255];
+        int pz0 = permutation_z[k & 255], pz1 = permutation_z[(k + 1) & 255];
+        int yz[4] = { py0 ^ pz0, py0 ^ pz1, py1 ^ pz0, py1 ^ pz1 };
+
+        // 每个梯度是一行 (x, y, z, 0)，4 行转置后得到 4 个角点的 x, y, z 分量
+        __m128 gx0 = _mm_loadu_ps(gradients[px0 ^ yz[0]]), gy0 = _mm_loadu_ps(gradients[px0 ^ yz[1]]);
+        __m128 gz0 = _mm_loadu_ps(gradients[px0 ^ yz[2]]), g30 = _mm_loadu_ps(gradients[px0 ^ yz[3]]);
+        _MM_TRANSPOSE4_PS(gx0, gy0, gz0, g30);
+        __m128 gx1 = _mm_loadu_ps(gradients[px1 ^ yz[0]]), gy1 = _mm_loadu_ps(gradients[px1 ^ yz[1]]);
+        __m128 gz1 = _mm_loadu_ps(gradients[px1 ^ yz[2]]), g31 = _mm_loadu_ps(gradients[px1 ^ yz[3]]);
+        _MM_TRANSPOSE4_PS(gx1, gy1, gz1, g31);
+
+        // 角点到采样点的向量
+        __m128 wx = _mm_set1_ps(u);
+        __m128 wy = _mm_sub_ps(_mm_set1_ps(v), corner_y);
+        __m128 wz = _mm_sub_ps(_mm_set1_ps(w), corner_z);
+        __m128 yz_dot0 = _mm_add_ps(_mm_mul_ps(gy0, wy), _mm_mul_ps(gz0, wz));
+        __m128 yz_dot1 = _mm_add_ps(_mm_mul_ps(gy1, wy), _mm_mul_ps(gz1, wz));
+        __m128 dot0 = _mm_add_ps(_mm_mul_ps(gx0, wx), yz_dot0);
+        __m128 dot1 = _mm_add_ps(_mm_mul_ps(gx1, _mm_sub_ps(wx, _mm_set1_ps(1.f))), yz_dot1);
+
+        // 插值权重：dj, dk 为 1 的角点取 smoothstep(t)，否则取 1 - smoothstep(t)
+        float uu = u * u * (3.f - 2.f * u), vv = v * v * (3.f - 2.f * v), ww = w * w * (3.f - 2.f * w);
+        __m128 sy = _mm_add_ps(_mm_set1_ps(1.f - vv), _mm_mul_ps(corner_y, _mm_set1_ps(2.f * vv - 1.f)));
+        __m128 sz = _mm_add_ps(_mm_set1_ps(1.f - ww), _mm_mul_ps(corner_z, _mm_set1_ps(2.f * ww - 1.f)));
+        __m128 syz = _mm_mul_ps(_mm_mul_ps(sy, sz), _mm_set1_ps(weight));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(dot0, _mm_mul_ps(syz, _mm_set1_ps(1.f - uu))));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(dot1, _mm_mul_ps(syz, _mm_set1_ps(uu))));
+
+        x *= 2, y *= 2, z *= 2;
+        weight *= 0.5f;
+    }
+    __m128 acc = _mm_add_ps(acc0, acc1);
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return std::fabs((double)_mm_cvtss_f32(acc));
+}
+#else
+double PerlinNoise::TurbSSE(const point3d& p) const {
+    return TurbReference(p);
+}
+#endif
+
+NoiseVolume::NoiseVolume(const std::shared_ptr<Noise>& source_, const point3d& p1, const point3d& p2, double cell_size) : source(source_) {
+    min_p = point3d(std::min(p1.x, p2.x), std::min(p1.y, p2.y), std::min(p1.z, p2.z));
+    max_p = point3d(std::max(p1.x, p2.x), std::max(p1.y, p2.y), std::max(p1.z, p2.z));
+    // 每个方向至少两个采样点，盒子的两端都落在采样点上
+    nx = std::max(2, (int)std::ceil((max_p.x - min_p.x) / cell_size) + 1);
+    ny = std::max(2, (int)std::ceil((max_p.y - min_p.y) / cell_size) + 1);
+    nz = std::max(2, (int)std::ceil((max_p.z - min_p.z) / cell_size) + 1);
+    UpdateCell();
+}
+
+void NoiseVolume::UpdateCell() {
+    auto inv = [](double n, double len) { return len > 0. ? (n - 1) / len : 0.; };
+    inv_cell = vec3d(inv(nx, max_p.x - min_p.x), inv(ny, max_p.y - min_p.y), inv(nz, max_p.z - min_p.z));
+}
+
+void NoiseVolume::Build(int threads_num) {
+    samples.assign(GetSamplesNum(), 0.f);
+    vec3d cell((max_p.x - min_p.x) / (nx - 1), (max_p.y - min_p.y) / (ny - 1), (max_p.z - min_p.z) / (nz - 1));
+    RenderThreadPool pool(threads_num);
+    for (int k = 0; k < nz; k++) {
+        pool.AddTask([this, cell](RenderTaskParam param) {
+            int k = param.from;
+            float* slice = &samples[(size_t)k * nx * ny];
+            for (int j = 0; j < ny; j++) {
+                for (int i = 0; i < nx; i++)
+                    slice[(size_t)j * nx + i] = (float)source->Turb(min_p + vec3d(i * cell.x, j * cell.y, k * cell.z));
+            }
+        }, { k, k + 1 });
+    }
+    pool.Dispatch();
+    pool.WaitForTaskEnding();
+}
+
+double NoiseVolume::Turb(const point3d& p) const {
+    double fx = (p.x - min_p.x) * inv_cell.x, fy = (p.y - min_p.y) * inv_cell.y, fz = (p.z - min_p.z) * inv_cell.z;
+    if (samples.empty() || !(fx >= 0. && fy >= 0. && fz >= 0. && fx <= nx - 1 && fy <= ny - 1 && fz <= nz - 1))
+        return source->Turb(p);
+    // 落在最后一个采样点上时退回一格，保证 i + 1 不越界
+    int i = std::min((int)fx, nx - 2), j = std::min((int)fy, ny - 2), k = std::min((int)fz, nz - 2);
+    float dx = (float)(fx - i), dy = (float)(fy - j), dz = (float)(fz - k);
+    size_t row = (size_t)nx, slice = (size_t)nx * ny;
+    const float* c = &samples[(size_t)k * slice + (size_t)j * row + i];
+    float c00 = c[0] + (c[1] - c[0]) * dx;
+    float c01 = c[row] + (c[row + 1] - c[row]) * dx;
+    float c10 = c[slice] + (c[slice + 1] - c[slice]) * dx;
+    float c11 = c[slice + row] + (c[slice + row + 1] - c[slice + row]) * dx;
+    float c0 = c00 + (c01 - c00) * dy, c1 = c10 + (c11 - c10) * dy;
+    return c0 + (c1 - c0) * dz;
+}
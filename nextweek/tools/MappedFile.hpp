@@ -0,0 +1,28 @@
+﻿#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <string>
+
+// 只读的内存映射文件，文件内容直接由系统按页调入，不经过额外的拷贝
+class MappedFile {
+    HANDLE file;
+    HANDLE mapping;
+    const char* data;
+    size_t size;
+public:
+    MappedFile() noexcept;
+    ~MappedFile() noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path);
+    void Close();
+    bool IsOpen() const;
+    const char* GetData() const;
+    size_t GetSize() const;
+};
+
+#endif
@@ -2,13 +2,28 @@
 #define __PPMIMAGE_H__
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <memory>
 #include "Color.hpp"
 
+class MappedFile;
+
 class PPMImage {
 private:
     int height;
     int width;
     Color* image;
+    // 8 位的 P6 直接引用映射的文件内容，此时 image 为空
+    std::shared_ptr<MappedFile> mapped_file;
+    const unsigned char* texels = nullptr;
+    double texel_scale = 1.;
+    friend class SceneCache;
+
+    bool read_pfm(const char* data, size_t size);
+    bool read_pnm(const std::shared_ptr<MappedFile>& file, int threads_num);
+    bool read_p3(const char* p, const char* end, int maxval, int threads_num);
+    void write_p6(std::vector<char>& buffer) const;
+    void write_pfm(std::vector<char>& buffer) const;
 public:
     PPMImage() noexcept;
     ~PPMImage() noexcept;
@@ -20,7 +35,8 @@ public:
     int get_height() const;
     int get_width() const;
     void write_to_file(const char* file_name);
-    void read_from_file(std::string file_name);
+    // threads_num 为 P3 并行解码的线程数，为 0 时使用 thread_num 个；在线程池任务中调用时应传入剩余的线程数
+    void read_from_file(std::string file_name, int threads_num = 0);
 };
 
 #endif
\ No newline at end of file
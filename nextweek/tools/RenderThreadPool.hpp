@@ -1,12 +1,16 @@
 #ifndef __RENDER_THREAD_POOL__
 #define __RENDER_THREAD_POOL__
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
 #include <vector>
 #include <queue>
+#include <functional>
 
 struct RenderTaskParam { int from, to; };
 class RenderThreadPool;
-typedef void (*RenderTask)(RenderTaskParam);
+typedef std::function<void(RenderTaskParam)> RenderTask;
 DWORD WINAPI DispatchTask(LPVOID);
 
 class RenderThreadPool {
@@ -16,6 +20,7 @@ class RenderThreadPool {
     std::queue<std::pair<RenderTask, RenderTaskParam>> tasks;
 
     void CreateThreads();
+    void CloseHandles();
 public:
     RenderThreadPool(int num = 8) noexcept;
     ~RenderThreadPool() noexcept;